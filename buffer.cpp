@@ -27,10 +27,11 @@
 
 // implements refcounted buffer
 
-buffer::buffer(void) : buffer_(NULL)
+buffer::buffer(void) : buffer_(NULL), data_(NULL)
 #if GPGPU_CUDA
   , buffer_allocated_by_gpu_(false)
 #endif
+  , buffer_aligned_(false)
 {
 }
 
@@ -41,6 +42,9 @@ buffer::~buffer(void) {
       cuda::DeallocateHost(buffer_);
     else
 #endif
+    if (buffer_aligned_)
+      free(buffer_);
+    else
 #if WANT_CONCURRENT
       tbb::cache_aligned_allocator<u8>().deallocate(buffer_, 0);
 #else
@@ -58,11 +62,20 @@ buffer::alloc(size_t sz) {
     buffer_allocated_by_gpu_ = true;
   else
 #endif
+#ifndef WIN32
+  // Data is read straight into the buffer with direct I/O, if it is aligned for it
+  if (DiskFile::DirectIOAlignment() > 0) {
+    void *p;
+    buffer_ = 0 == posix_memalign(&p, DiskFile::DirectIOAlignment(), sz) ? (u8*) p : NULL;
+    buffer_aligned_ = true;
+  } else
+#endif
 #if WANT_CONCURRENT
     buffer_ = tbb::cache_aligned_allocator<u8>().allocate(sz);//new u8[sz];
 #else
     buffer_ = (u8*) malloc(sz);
 #endif
+  data_ = buffer_;
   return NULL != buffer_;
 }
 
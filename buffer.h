@@ -36,10 +36,12 @@
   class buffer {
   private:
     u8* buffer_;
+    const u8* data_; // buffer_, or the memory which the buffer views instead
 
   #if GPGPU_CUDA
     bool buffer_allocated_by_gpu_;
   #endif
+    bool buffer_aligned_; // allocated with the alignment that direct I/O needs
 
   #if !defined(NDEBUG) && defined(DEBUG_BUFFERS)
   public:
@@ -57,6 +59,11 @@
 
     const u8* get(void) const { return buffer_; }
     u8* get(void) { return buffer_; }
+
+    // The data to be processed: that in the buffer, unless the buffer has been
+    // set to view other memory (such as part of a mapped file) in its place.
+    const u8* data(void) const { return data_; }
+    void view(const u8* p) { data_ = NULL != p ? p : buffer_; }
   }; // buffer
 
   #if WANT_CONCURRENT
@@ -414,8 +414,15 @@ CommandLine::CommandLine(void)
 #if WANT_CONCURRENT
 , concurrent_processing_level(ALL_CONCURRENT) // whether to process everything serially or concurrently
 , numthreads(0)
+, splitplanes(true)
 #endif
 , create_dummy_par_files(false)
+, kernelname()
+, matrixcachedir()
+, onlyfiles()
+, inplace(false)
+, mappedfiles(false)
+, directio(false)
 {
   sInstance = this;
 }
@@ -457,11 +464,28 @@ void CommandLine::usage(void)
 	"     -t0 to checksum serially but create/repair concurrently - good for slow media such as CDs/DVDs\n"
 	"     -t- to checksum/create/repair serially - uses a single thread - good for testing this program\n"
     "  -p<n>  : Set the number of threads for parallel processing\n"
+    "  -a<+|->: Split-plane (ALTMAP) data layout for the Galois16 kernel. The options are:\n"
+    "     -a+ to split the data into low and high byte planes once, when it is read - [default]\n"
+    "     -a- to let the kernel split and recombine the data for every recovery block\n"
 #endif
     // 2007/10/21
     "  -d<dir>: root directory for paths to be put in par2 files OR root directory for files to repair from par2 files\n"
     // 2008/07/07
     "  -0     : create dummy par2 files - for getting actual final par2 files sizes without doing any computing\n"
+    "  -k<name>: Galois16 kernel to use (auto, scalar, mmx, ssse3, avx2, avx512bw, gfni,\n"
+    "           gfni-avx2 or gfni-avx512) - the default is the fastest one the CPU supports\n"
+    "  -x<dir>: folder in which to keep the solved Reed Solomon matrix of each repair, so\n"
+    "           that repairing the same files with the same recovery blocks again skips solving it\n"
+    "  -o<file>: only repair this file (may be given more than once) - the other damaged or\n"
+    "           missing files are left as they are, and only this file's blocks are recomputed\n"
+    "  -i     : repair damaged files in place, writing only their damaged blocks (the data\n"
+    "           which is overwritten is kept in a journal until the repair is verified)\n"
+    "  -z     : read files through memory mappings, using their data where it lies in\n"
+    "           memory rather than copying it into buffers (good when they are cached),\n"
+    "           and when creating in one pass, compute the recovery data in place in\n"
+    "           memory mappings of the recovery files\n"
+    "  --direct-io: read files with direct I/O, bypassing the page cache (the reads are\n"
+    "           fastest when the block size is a multiple of 4096)\n"
     "  --     : Treat all remaining CommandLine as filenames\n"
     "\n"
     "If you wish to create par2 files for a single source file, you may leave\n"
@@ -938,14 +962,106 @@ bool CommandLine::Parse(int argc, TCHAR *argv[])
                 }
             }
             break;
+
+        case 'a':  // Whether to process the data in the split-plane layout
+          {
+            switch (argv[0][2]) {
+            case '-':
+              splitplanes = false;
+              break;
+            case '+':
+              splitplanes = true;
+              break;
+            default:
+              cerr << "Expected -a+ (use the split-plane layout if possible) or -a- (never use it)." << endl;
+              return false;
+            }
+          }
+          break;
 #endif
 
         case '0':
           create_dummy_par_files = true;
           break;
 
+        case 'x': {
+          matrixcachedir = DiskFile::GetCanonicalPathname(native_char_array_to_utf8_string(2 + argv[0]));
+          if (matrixcachedir.empty() || !is_existing_folder(matrixcachedir)) {
+            cerr << "the matrix cache (" << argv[0] + 2 << ") must specify an accessible and existing folder" << endl;
+            return false;
+          }
+          if (matrixcachedir[matrixcachedir.length()-1] != OS_SEPARATOR)
+            matrixcachedir += OS_SEPARATOR;
+          break;
+        }
+
+        case 'o':  // Only repair the given file
+          {
+            if (operation != opRepair)
+            {
+              cerr << "Cannot specify the files to repair unless repairing." << endl;
+              return false;
+            }
+
+            // The file may well be missing, so only its folder can be resolved
+            string path, name;
+            DiskFile::SplitFilename(native_char_array_to_utf8_string(2 + argv[0]), path, name);
+            path = DiskFile::GetCanonicalPathname(path);
+            if (name.empty() || path.empty())
+            {
+              cerr << "Invalid file to repair: " << argv[0] << endl;
+              return false;
+            }
+            if (path[path.length()-1] != OS_SEPARATOR)
+              path += OS_SEPARATOR;
+
+            onlyfiles.push_back(path + name);
+          }
+          break;
+
+        case 'i':  // Repair damaged files in place
+          {
+            if (operation != opRepair)
+            {
+              cerr << "Cannot repair files in place unless repairing." << endl;
+              return false;
+            }
+            inplace = true;
+          }
+          break;
+
+        case 'z':  // Read and write files through memory mappings (zero-copy)
+          {
+            mappedfiles = true;
+          }
+          break;
+
+        case 'k':  // Force a particular Galois16 kernel
+          {
+            if (!kernelname.empty())
+            {
+              cerr << "Cannot specify the kernel twice." << endl;
+              return false;
+            }
+
+            kernelname = native_char_array_to_utf8_string(2 + argv[0]);
+            if (kernelname.empty())
+            {
+              cerr << "Invalid kernel option: " << argv[0] << endl;
+              return false;
+            }
+          }
+          break;
+
         case '-':
           {
+            if (native_char_array_to_utf8_string(argv[0]) == "--direct-io")
+            {
+              // Read files with direct I/O
+              directio = true;
+              break;
+            }
+
             argc--;
             argv++;
             options = false;
@@ -123,9 +123,16 @@ public:
 #if WANT_CONCURRENT
   unsigned               GetConcurrentProcessingLevel(void) const { return concurrent_processing_level; }
   u32                    GetNumThreads(void) const         {return numthreads;}
+  bool                   GetSplitPlanes(void) const        {return splitplanes;}
 #endif
 
   bool                   GetCreateDummyParFiles(void) const { return create_dummy_par_files; }
+  const string&          GetKernelName(void) const         {return kernelname;}
+  const string&          GetMatrixCacheDirectory(void) const {return matrixcachedir;}
+  const list<string>&    GetOnlyFiles(void) const          {return onlyfiles;}
+  bool                   GetInPlaceRepair(void) const      {return inplace;}
+  bool                   GetMappedFiles(void) const        {return mappedfiles;}
+  bool                   GetDirectIO(void) const           {return directio;}
 
   string                              GetParFilename(void) const {return parfilename;}
   const list<CommandLine::ExtraFile>& GetExtraFiles(void) const  {return extrafiles;}
@@ -188,8 +195,31 @@ protected:
   unsigned concurrent_processing_level; // whether to process serially or concurrently
     
   u32 numthreads;              // number of threads for parallel processing
+
+  bool splitplanes;            // whether to use the split-plane layout when
+                               // the Galois16 kernel supports it.
 #endif
   bool create_dummy_par_files; // so that final par2 size can be determined
+
+  string kernelname;           // if non-empty then the Galois16 kernel to use
+                               // instead of the fastest one available.
+
+  string matrixcachedir;       // if non-empty then the folder in which solved
+                               // RS matrices are kept between repairs.
+
+  list<string> onlyfiles;      // if not empty then the only files to repair
+                               // (the others are left as they are).
+
+  bool inplace;                // whether to repair damaged files in place,
+                               // writing only their damaged blocks.
+
+  bool mappedfiles;            // whether to use the data of the files being
+                               // read where it lies in memory mappings of them,
+                               // and to compute recovery data in mappings of
+                               // the recovery files.
+
+  bool directio;               // whether to read files with direct I/O, rather
+                               // than through the page cache.
 };
 
 typedef list<CommandLine::ExtraFile>::const_iterator ExtraFileIterator;
@@ -82,6 +82,64 @@ bool DataBlock::ReadData(u64    position, // Position within the block
   return true;
 }
 
+// How much of a buffer is left once any zeros at its end are removed.
+static size_t NonZeroLength(const void *buffer, size_t size)
+{
+  const u8 *b = (const u8*)buffer;
+
+  // Check the bytes after the last whole word, then a word at a time
+  while (size % sizeof(u64) != 0)
+  {
+    if (b[size-1] != 0)
+      return size;
+    --size;
+  }
+  while (size > 0)
+  {
+    u64 word;
+    memcpy(&word, &b[size - sizeof(u64)], sizeof(u64));
+    if (word != 0)
+      break;
+    size -= sizeof(u64);
+  }
+  while (size > 0 && b[size-1] == 0)
+    --size;
+
+  return size;
+}
+
+bool DataBlock::ReadData(u64     position,   // Position within the block
+                         size_t  size,       // Size of the memory buffer
+                         void   *buffer,     // Pointer to memory buffer
+                         size_t &datalength) // How much of the buffer might not be zero
+{
+  assert(diskfile != 0);
+
+  datalength = 0;
+  if (length > position)
+  {
+    // A hole in a sparse file does not need to be read
+    size_t want = (size_t)min((u64)size, length - position);
+    if (diskfile->IsHole(offset + position, want))
+    {
+      memset(buffer, 0, size);
+      return true;
+    }
+
+    if (!ReadData(position, size, buffer))
+      return false;
+
+    datalength = NonZeroLength(buffer, want);
+  }
+  else
+  {
+    // Zero the whole buffer
+    memset(buffer, 0, size);
+  }
+
+  return true;
+}
+
 // Write some data at a specified position within a datablock
 // from memory to disk
 
@@ -112,26 +170,87 @@ bool DataBlock::WriteData(u64         position, // Position within the block
   return true;
 }
 
+// Copy some data at a specified position within another data block to
+// the same position within this one
+
+bool DataBlock::CopyData(u64        position, // Position within the block
+                         size_t     size,     // Size of the data
+                         DataBlock &source,   // The block to copy from
+                         size_t    &wrote)    // Amount actually copied
+{
+  assert(diskfile != 0 && source.diskfile != 0);
+
+  wrote = 0;
+
+  // Check to see if the position from which data is to be copied
+  // is within the bounds of the data block
+  if (length > position)
+  {
+    // Compute how much data to physically copy
+    size_t have = (size_t)min((u64)size, length - position);
+
+    if (!diskfile->CopyFrom(*source.diskfile, source.offset + position, offset + position, have))
+      return false;
+
+    wrote = have;
+  }
+
+  return true;
+}
+
+const u8* DataBlock::MappedData(u64 position, size_t size) const {
+  assert(NULL != diskfile);
+
+  const u8 *mapping = diskfile->Mapping();
+  if (0 == mapping || position + size > length ||
+      offset + position + size > diskfile->MappingLength())
+    return 0;
+
+  diskfile->WillNeed(offset + position, size);
+  return &mapping[offset + position];
+}
+
+size_t DataBlock::DataLength(u64 position, size_t size, const void *buffer) const {
+  return length > position ? NonZeroLength(buffer, (size_t)min((u64)size, length - position)) : 0;
+}
+
 #if HAVE_ASYNC_IO
-bool DataBlock::ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer) {
+bool DataBlock::ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer, bool &started) {
   assert(NULL != diskfile);
 
+  started = false;
+
   // Check to see if the position from which data is to be read
   // is within the bounds of the data block
   if (position >= length) {
-//printf("DataBlock::ReadDataAsync(): position >= length\n");
     // Zero the whole buffer
     memset(buffer, 0, size);
-    return false;
+    return true;
   }
 
   // Compute the file offset and how much data to physically read from disk
   u64    fileoffset = offset + position;
   size_t want       = (size_t)min((u64)size, length - position);
 
-  // Read the data from the file into the buffer
-  if (!diskfile->ReadAsync(cb, fileoffset, buffer, want))
-    return false;
+  // A hole in a sparse file does not need to be read
+  if (diskfile->IsHole(fileoffset, want)) {
+    memset(buffer, 0, size);
+    return true;
+  }
+
+  // Read the data from the file into the buffer (straight away, if it is not
+  // aligned for the direct I/O that the file is open for)
+  if (diskfile->NeedsBounce(fileoffset, buffer, want))
+  {
+    if (!diskfile->Read(fileoffset, buffer, want))
+      return false;
+  }
+  else
+  {
+    if (!diskfile->ReadAsync(cb, fileoffset, buffer, want))
+      return false;
+    started = true;
+  }
 
   // If the read extends beyond the end of the data block,
   // then the rest of the buffer is zeroed.
@@ -141,6 +260,35 @@ bool DataBlock::ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *b
   return true;
 }
 
+#if HAVE_IO_ENGINE
+bool DataBlock::ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer, bool &started,
+                              ::buffer &bounce, const u8* &data) {
+  assert(NULL != diskfile);
+
+  data = (const u8*) buffer;
+  if (position >= length || !diskfile->NeedsBounce(offset + position, buffer, (size_t)min((u64)size, length - position)))
+    return ReadDataAsync(cb, position, size, buffer, started);
+
+  u64    fileoffset = offset + position;
+  size_t want       = (size_t)min((u64)size, length - position);
+
+  started = false;
+  if (diskfile->IsHole(fileoffset, want)) {
+    memset(buffer, 0, size);
+    return true;
+  }
+
+  // (the bounce buffer is kept for the next read, so it has room for size bytes)
+  if (NULL == bounce.get() && !bounce.alloc(DiskFile::BounceSize(size)))
+    return false;
+  data = diskfile->ReadBouncedAsync(cb, fileoffset, bounce.get(), want);
+  if (NULL == data)
+    return false;
+  started = true;
+  return true;
+}
+#endif
+
 bool DataBlock::WriteDataAsync(aiocb_type& cb, u64 position, size_t size, const void *buffer, size_t &wrote) {
   assert(NULL != diskfile);
 
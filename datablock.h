@@ -27,6 +27,7 @@
 #define __DATABLOCK_H__
 
 class DiskFile;
+class buffer;
 
 // A Data Block is a block of data of a specific length at a specific
 // offset in a specific file.
@@ -68,13 +69,41 @@ public:
 
   // Read some of the data from disk into memory.
   bool ReadData(u64 position, size_t size, void *buffer);
+  // The same, also setting datalength to how much of the buffer might not be
+  // zero: the rest is padding beyond the end of the block, a hole in a sparse
+  // file or zeros read from disk.
+  bool ReadData(u64 position, size_t size, void *buffer, size_t &datalength);
 
   // Write some of the data from memory to disk
   bool WriteData(u64 position, size_t size, const void *buffer, size_t &wrote);
 
-#if HAVE_ASYNC_IO
-  bool ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer);
+  // Copy some of the data of another block of the same length to this one,
+  // without reading it into memory, if the OS can.
+  bool CopyData(u64 position, size_t size, DataBlock &source, size_t &wrote);
+
+  // If the block's file is mapped into memory (see DiskFile::Map()) and all of
+  // the size bytes of data at position lie within the block, where they are in
+  // the mapping (and the OS is asked to read them in), otherwise NULL.
+  const u8* MappedData(u64 position, size_t size) const;
+
+  // Once it has been read (or mapped), how much of the buffer might not be zero
+  size_t DataLength(u64 position, size_t size, const void *buffer) const;
 
+#if HAVE_ASYNC_IO
+  // Start reading some of the data from disk into memory. If there is none to
+  // read (it is beyond the end of the block or in a hole of a sparse file), the
+  // buffer is zeroed instead and started is false, as it also is if the data had
+  // to be read there and then.
+  bool ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer, bool &started);
+#if HAVE_IO_ENGINE
+  // The same, except that data which is not aligned for the direct I/O that the file
+  // is open for is read into bounce (allocated the first time that it is needed; see
+  // DiskFile::ReadBouncedAsync()) rather than there and then. data is set to where the
+  // data will be: buffer, or in bounce, in which case the rest of the size bytes after
+  // the block's data have to be zeroed once the read has completed.
+  bool ReadDataAsync(aiocb_type& cb, u64 position, size_t size, void *buffer, bool &started,
+                     ::buffer &bounce, const u8* &data);
+#endif
   // parm 'wrote' is actually a promise, not a fact; this fn will write that many bytes if
   // the write completes OK, but at the time that the fn returns, it hasn't done so yet.
   bool WriteDataAsync(aiocb_type& cb, u64 position, size_t size, const void *buffer, size_t &wrote);
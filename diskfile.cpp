@@ -48,13 +48,18 @@ DiskFile::DiskFile(void)
 {
   //filename;
   filesize = 0;
-  offset = 0;
 
   hFile = INVALID_HANDLE_VALUE;
 
   exists = false;
 
   blockcount = 0;
+
+  direct = false;
+  directrefused = false;
+
+  mapping = 0;
+  mappinglength = 0;
 }
 
 DiskFile::~DiskFile(void)
@@ -124,8 +129,6 @@ bool DiskFile::Create(string _filename, u64 _filesize, bool async)
     }
   }
 
-  offset = filesize;
-
   exists = true;
   return true;
 }
@@ -136,23 +139,6 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length)
 {
   assert(hFile != INVALID_HANDLE_VALUE);
 
-  if (offset != _offset)
-  {
-    LONG lowoffset = ((LONG*)&_offset)[0];
-    LONG highoffset = ((LONG*)&_offset)[1];
-
-    // Seek to the required offset
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, lowoffset, &highoffset, FILE_BEGIN))
-    {
-      DWORD error = ::GetLastError();
-
-      cerr << "Could not write " << (u64)length << " bytes to \"" << filename << "\" at offset " << _offset << ": " << ErrorMessage(error) << endl;
-
-      return false;
-    }
-    offset = _offset;
-  }
-
   if (length > MaxLength)
   {
     cerr << "Could not write " << (u64)length << " bytes to \"" << filename << "\" at offset " << _offset << ": " << "Write too long" << endl;
@@ -163,8 +149,15 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length)
   DWORD write = (LengthType)length;
   DWORD wrote;
 
-  // Write the data
-  if (!::WriteFile(hFile, buffer, write, &wrote, NULL))
+  // Write the data at the required offset
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = ((DWORD*)&_offset)[0];
+  overlapped.OffsetHigh = ((DWORD*)&_offset)[1];
+
+  // (if the file was opened for async I/O, wait for the write to finish)
+  if (!::WriteFile(hFile, buffer, write, &wrote, &overlapped) &&
+      (ERROR_IO_PENDING != ::GetLastError() || !::GetOverlappedResult(hFile, &overlapped, &wrote, TRUE)))
   {
     DWORD error = ::GetLastError();
 
@@ -173,16 +166,19 @@ bool DiskFile::Write(u64 _offset, const void *buffer, size_t length)
     return false;
   }
 
-  offset += length;
-
-  if (filesize < offset)
+  if (filesize < _offset + length)
   {
-    filesize = offset;
+    filesize = _offset + length;
   }
 
   return true;
 }
 
+bool DiskFile::CopyFrom(DiskFile & /* source */, u64 /* sourceoffset */, u64 /* offset */, u64 /* length */)
+{
+  return false;
+}
+
 #if HAVE_ASYNC_IO
 
 bool DiskFile::ReadAsync(aiocb_type& cb, u64 offset, void *buffer, size_t length) {
@@ -206,7 +202,8 @@ bool DiskFile::Open(string _filename, u64 _filesize, bool async)
   filename = _filename;
   filesize = _filesize;
 
-  hFile = ::CreateFile(utf8_string_to_native_char_array(_filename), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+  // (other handles may write to it, for an in-place repair)
+  hFile = ::CreateFile(utf8_string_to_native_char_array(_filename), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
 #if HAVE_ASYNC_IO
                        async ? FILE_FLAG_OVERLAPPED : 0,
 #else
@@ -229,35 +226,66 @@ bool DiskFile::Open(string _filename, u64 _filesize, bool async)
     return false;
   }
 
-  offset = 0;
   exists = true;
 
   return true;
 }
 
-// Read some data from disk
+// Open an existing file for both reading and writing
 
-bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
+bool DiskFile::OpenForWriting(string _filename, bool async)
 {
-  assert(hFile != INVALID_HANDLE_VALUE);
+  assert(hFile == INVALID_HANDLE_VALUE);
+
+  filename = _filename;
+  filesize = GetFileSize(_filename);
 
-  if (offset != _offset)
+  hFile = ::CreateFile(utf8_string_to_native_char_array(_filename), GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+#if HAVE_ASYNC_IO
+                       async ? FILE_FLAG_OVERLAPPED : 0,
+#else
+                       0,
+#endif
+                       NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
   {
-    LONG lowoffset = ((LONG*)&_offset)[0];
-    LONG highoffset = ((LONG*)&_offset)[1];
+    DWORD error = ::GetLastError();
 
-    // Seek to the required offset
-    if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, lowoffset, &highoffset, FILE_BEGIN))
-    {
-      DWORD error = ::GetLastError();
+    cerr << "Could not open \"" << _filename << "\" for writing: " << ErrorMessage(error) << endl;
 
-      cerr << "Could not read " << (u64)length << " bytes from \"" << filename << "\" at offset " << _offset << ": " << ErrorMessage(error) << endl;
+    return false;
+  }
 
-      return false;
-    }
-    offset = _offset;
+  exists = true;
+
+  return true;
+}
+
+// Make sure that everything written to the file is on the disk
+
+bool DiskFile::Flush(void)
+{
+  assert(hFile != INVALID_HANDLE_VALUE);
+
+  if (!::FlushFileBuffers(hFile))
+  {
+    DWORD error = ::GetLastError();
+
+    cerr << "Could not flush \"" << filename << "\": " << ErrorMessage(error) << endl;
+
+    return false;
   }
 
+  return true;
+}
+
+// Read some data from disk
+
+bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
+{
+  assert(hFile != INVALID_HANDLE_VALUE);
+
   if (length > MaxLength)
   {
     cerr << "Could not read " << (u64)length << " bytes from \"" << filename << "\" at offset " << _offset << ": " << "Read too long" << endl;
@@ -268,8 +296,15 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
   DWORD want = (LengthType)length;
   DWORD got;
 
-  // Read the data
-  if (!::ReadFile(hFile, buffer, want, &got, NULL))
+  // Read the data from the required offset
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = ((DWORD*)&_offset)[0];
+  overlapped.OffsetHigh = ((DWORD*)&_offset)[1];
+
+  // (if the file was opened for async I/O, wait for the read to finish)
+  if (!::ReadFile(hFile, buffer, want, &got, &overlapped) &&
+      (ERROR_IO_PENDING != ::GetLastError() || !::GetOverlappedResult(hFile, &overlapped, &got, TRUE)))
   {
     DWORD error = ::GetLastError();
 
@@ -278,11 +313,15 @@ bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
     return false;
   }
 
-  offset += length;
-
   return true;
 }
 
+bool DiskFile::IsHole(u64 _offset, u64 length)
+{
+  // (sparse files are not detected)
+  return false;
+}
+
 void DiskFile::Close(void)
 {
   if (hFile != INVALID_HANDLE_VALUE)
@@ -292,6 +331,41 @@ void DiskFile::Close(void)
   }
 }
 
+// (files are not mapped: their data is always read and written)
+const u8* DiskFile::Map(void)
+{
+  return 0;
+}
+
+u8* DiskFile::MapForWrite(void)
+{
+  return 0;
+}
+
+// (files are always read through the cache)
+bool DiskFile::NeedsBounce(u64 /* offset */, const void * /* buffer */, size_t /* length */) const
+{
+  return false;
+}
+
+size_t DiskFile::DirectIOAlignment(void)
+{
+  return 0;
+}
+
+size_t DiskFile::DirectIOChunkSize(size_t chunksize)
+{
+  return chunksize;
+}
+
+void DiskFile::Unmap(void)
+{
+}
+
+void DiskFile::WillNeed(u64 /* offset */, u64 /* length */) const
+{
+}
+
 string DiskFile::GetCanonicalPathname(string filename)
 {
 #ifdef UNICODE
@@ -391,20 +465,17 @@ list<string>* DiskFile::FindFiles(string path, string wildcard)
 #else // !WIN32
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#ifdef HAVE_FSEEKO
-# define OffsetType off_t
-# define MaxOffset ((off_t)0x7fffffffffffffffULL)
-# define fseek fseeko
-#else
-# if _FILE_OFFSET_BITS == 64
-#  define OffsetType unsigned long long
-#  define MaxOffset 0x7fffffffffffffffULL
-# else
-#  define OffsetType long
-#  define MaxOffset 0x7fffffffUL
-# endif
+// The file is read and written with pread() and pwrite(), which do not move
+// (or depend on) the offset of the file descriptor, so that several threads
+// can read from the same file at the same time.
+
+#if HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
 #endif
 
+#define OffsetType off_t
+#define MaxOffset ((u64)(sizeof(off_t) > 4 ? 0x7fffffffffffffffULL : 0x7fffffffUL))
+
 #define LengthType unsigned int
 #define MaxLength 0xffffffffUL
 
@@ -412,102 +483,68 @@ DiskFile::DiskFile(void)
 {
   //filename;
   filesize = 0;
-  offset = 0;
 
-  file = 0;
+  fd = -1;
 
   exists = false;
 
   blockcount = 0;
+
+  direct = false;
+  directrefused = false;
+
+  mapping = 0;
+  mappinglength = 0;
 }
 
 DiskFile::~DiskFile(void)
 {
-  if (file != 0)
-    fclose(file);
+  Unmap();
+
+  if (fd != -1)
+    close(fd);
 }
 
 // Create new file on disk and make sure that there is enough
 // space on disk for it.
 bool DiskFile::Create(string _filename, u64 _filesize, bool /* async */)
 {
-  assert(file == 0);
+  assert(fd == -1);
 
   filename = _filename;
   filesize = _filesize;
 
-  file = fopen(_filename.c_str(), "wb");
-  if (file == 0)
+  if (_filesize > MaxOffset)
   {
-    cerr << "Could not create: " << _filename << endl;
-
+    cerr << "Requested file size for " << _filename << " is too large." << endl;
     return false;
   }
 
-  if (_filesize > (u64)MaxOffset)
+  // (opened for reading too, which a writable mapping of the file requires)
+  fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
   {
-    cerr << "Requested file size for " << _filename << " is too large." << endl;
+    cerr << "Could not create: " << _filename << endl;
+
     return false;
   }
 
   if (_filesize > 0)
   {
-    if (fseek(file, (OffsetType)_filesize-1, SEEK_SET))
-    {
-      fclose(file);
-      file = 0;
-      ::remove(filename.c_str());
-      
-      cerr << "Could not set end of file: " << _filename << endl;
-      return false;
-    }
-
-    if (1 != fwrite(&_filesize, 1, 1, file))
+    // (nothing is buffered, so unlike with a FILE, async writes to the
+    // file can be made straight away)
+    const char zero = 0;
+    if (1 != pwrite(fd, &zero, 1, (OffsetType)_filesize-1))
     {
-      fclose(file);
-      file = 0;
+      close(fd);
+      fd = -1;
       ::remove(filename.c_str());
       
       cerr << "Could not set end of file: " << _filename << endl;
       return false;
     }
-
-#if HAVE_ASYNC_IO
-    // 20090202 bug fix: async writes to the newly created file can
-    // fail for the last byte because the file's state hasn't been
-    // updated. This problem definitely occurs under Mac OS X
-    // 10.4/10.5, so fix this by flushing the new file.
-    // Closing and then re-opening the new file also works.
-    if (true) {
-      if (fflush(file)) {
-        fclose(file);
-        file = 0;
-        ::remove(filename.c_str());
-      
-        cerr << "Could not flush newly created file: " << _filename << endl;
-        return false;
-      }
-    } else {
-      if (fclose(file)) {
-        file = 0;
-        ::remove(filename.c_str());
-      
-        cerr << "Could not close created file: " << _filename << endl;
-        return false;
-      }
-
-      file = fopen(_filename.c_str(), "r+b"); // do NOT truncate file
-      if (file == 0) {
-        cerr << "Could not re-open newly created file: " << _filename << endl;
-
-        return false;
-      }
-    }
-#endif
   }
 
-  offset = filesize;
-
   exists = true;
   return true;
 }
@@ -516,58 +553,89 @@ bool DiskFile::Create(string _filename, u64 _filesize, bool /* async */)
 
 bool DiskFile::Write(u64 _offset, const void *buffer, size_t length)
 {
-  assert(file != 0);
+  assert(fd != -1);
 
-  if (offset != _offset)
+  if (_offset > MaxOffset || length > MaxLength)
   {
-    if (_offset > (u64)MaxOffset)
-    {
-      cerr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << endl;
-      return false;
-    }
-
+    cerr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << endl;
+    return false;
+  }
 
-    if (fseek(file, (OffsetType)_offset, SEEK_SET))
+  for (size_t done = 0; done < length; )
+  {
+    ssize_t wrote = pwrite(fd, (const char*)buffer + done, length - done, (OffsetType)(_offset + done));
+    if (wrote <= 0)
     {
+      if (wrote < 0 && EINTR == errno)
+        continue;
+
       cerr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << endl;
       return false;
     }
-    offset = _offset;
+
+    done += wrote;
   }
 
-  if (length > MaxLength)
+  if (filesize < _offset + length)
   {
-    cerr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << endl;
-    return false;
+    filesize = _offset + length;
   }
 
-  if (1 != fwrite(buffer, (LengthType)length, 1, file))
+  return true;
+}
+
+bool DiskFile::CopyFrom(DiskFile &source, u64 sourceoffset, u64 _offset, u64 length)
+{
+  assert(fd != -1 && source.fd != -1);
+
+#if HAVE_COPY_FILE_RANGE
+  loff_t in = (loff_t)sourceoffset;
+  loff_t out = (loff_t)_offset;
+  while (length > 0)
   {
-    cerr << "Could not write " << (u64)length << " bytes to " << filename << " at offset " << _offset << endl;
-    return false;
-  }
+    ssize_t copied = copy_file_range(source.fd, &in, fd, &out,
+                                     (size_t)min(length, (u64)MaxLength), 0);
+    if (copied <= 0)
+      return false; // (not supported between these files, so copy it some other way)
 
-  offset += length;
+    length -= copied;
+  }
 
-  if (filesize < offset)
+  if (filesize < (u64)out)
   {
-    filesize = offset;
+    filesize = out;
   }
 
   return true;
+#else
+  return false;
+#endif
 }
 
 #if HAVE_ASYNC_IO
 
 bool DiskFile::ReadAsync(aiocb_type& cb, u64 offset, void *buffer, size_t length) {
-  assert(NULL != file);
-  return cb.read(fileno(file), length, buffer, (off_t) offset);
+  assert(-1 != fd && !NeedsBounce(offset, buffer, length));
+  return cb.read(fd, length, buffer, (off_t) offset);
 }
 
 bool DiskFile::WriteAsync(aiocb_type& cb, u64 offset, const void *buffer, size_t length) {
-  assert(NULL != file);
-  return cb.write(fileno(file), length, buffer, (off_t) offset);
+  assert(-1 != fd);
+  return cb.write(fd, length, buffer, (off_t) offset);
+}
+
+#if HAVE_IO_ENGINE
+const u8* DiskFile::ReadBouncedAsync(aiocb_type& cb, u64 offset, void *bounce, size_t length) {
+  assert(-1 != fd && direct);
+  const u64 start = offset & ~(u64)(DIRECT_IO_ALIGNMENT-1);
+  const u64 end = (offset + length + DIRECT_IO_ALIGNMENT-1) & ~(u64)(DIRECT_IO_ALIGNMENT-1);
+
+  // (the file may end before the end of the last unit, but not before the data does)
+  if (!cb.read(fd, (size_t) (end - start), bounce, (off_t) start, (size_t) (offset + length - start)))
+    return NULL;
+  return (const u8*) bounce + (offset - start);
 }
+#endif
 
 #endif
 
@@ -575,76 +643,330 @@ bool DiskFile::WriteAsync(aiocb_type& cb, u64 offset, const void *buffer, size_t
 
 bool DiskFile::Open(string _filename, u64 _filesize, bool /* async */)
 {
-  assert(file == 0);
+  assert(fd == -1);
 
   filename = _filename;
   filesize = _filesize;
 
-  if (_filesize > (u64)MaxOffset)
+  if (_filesize > MaxOffset)
+  {
+    cerr << "File size for " << _filename << " is too large." << endl;
+    return false;
+  }
+
+  fd = -1;
+#ifdef O_DIRECT
+  if (DirectIOAlignment() > 0 && !directrefused)
+  {
+    fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+  #ifdef STATX_DIOALIGN
+    // (unless the filesystem cannot do direct I/O with DIRECT_IO_ALIGNMENT)
+    struct statx stx;
+    if (fd != -1 &&
+        0 == statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) && (stx.stx_mask & STATX_DIOALIGN) &&
+        (0 == stx.stx_dio_offset_align ||
+         DIRECT_IO_ALIGNMENT % stx.stx_dio_offset_align || DIRECT_IO_ALIGNMENT % stx.stx_dio_mem_align))
+    {
+      close(fd);
+      fd = -1;
+    }
+  #endif
+  }
+  direct = fd != -1;
+#endif
+  // (if it cannot be opened for direct I/O, it is read through the page cache)
+  if (fd == -1)
+    fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    return false;
+  }
+
+  if (DirectIOAlignment() > 0 && !direct && !directrefused)
+  {
+    directrefused = true;
+
+    CommandLine* cl = CommandLine::get();
+    if (cl && cl->GetNoiseLevel() > CommandLine::nlNormal)
+      cout << "Direct I/O is not possible for " << filename << ", so it is read through the page cache." << endl;
+  }
+
+  exists = true;
+
+  return true;
+}
+
+// Open an existing file for both reading and writing
+
+bool DiskFile::OpenForWriting(string _filename, bool /* async */)
+{
+  assert(fd == -1);
+
+  filename = _filename;
+  filesize = GetFileSize(_filename);
+
+  if (filesize > MaxOffset)
   {
     cerr << "File size for " << _filename << " is too large." << endl;
     return false;
   }
 
-  file = fopen(filename.c_str(), "rb");
-  if (file == 0)
+  fd = open(filename.c_str(), O_RDWR);
+  if (fd == -1)
   {
+    cerr << "Could not open for writing: " << _filename << endl;
     return false;
   }
 
-  offset = 0;
   exists = true;
 
   return true;
 }
 
+// Make sure that everything written to the file is on the disk
+
+bool DiskFile::Flush(void)
+{
+  assert(fd != -1);
+
+  if (fsync(fd))
+  {
+    cerr << "Could not flush: " << filename << endl;
+    return false;
+  }
+
+  return true;
+}
+
 // Read some data from disk
 
 bool DiskFile::Read(u64 _offset, void *buffer, size_t length)
 {
-  assert(file != 0);
+  assert(fd != -1);
+
+  if (_offset > MaxOffset || length > MaxLength)
+  {
+    cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
+    return false;
+  }
+
+  if (NeedsBounce(_offset, buffer, length))
+    return ReadBounced(_offset, buffer, length);
 
-  if (offset != _offset)
+  for (size_t done = 0; done < length; )
   {
-    if (_offset > (u64)MaxOffset)
+    ssize_t got = pread(fd, (char*)buffer + done, length - done, (OffsetType)(_offset + done));
+    if (got <= 0)
     {
+      if (got < 0 && EINTR == errno)
+        continue;
+
       cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
       return false;
     }
 
+    done += got;
+  }
+
+  return true;
+}
+
+bool DiskFile::NeedsBounce(u64 _offset, const void *buffer, size_t length) const
+{
+  return direct && 0 != (((size_t)_offset | (size_t)buffer | length) & (DIRECT_IO_ALIGNMENT-1));
+}
 
-    if (fseek(file, (OffsetType)_offset, SEEK_SET))
+// The aligned buffer which ReadBounced() reads through, kept by each thread (and
+// only grown) rather than allocated for every read.
+
+struct BounceBuffer
+{
+  void  *buffer;
+  size_t size;
+
+  BounceBuffer(void) : buffer(0), size(0) {}
+  ~BounceBuffer(void) {free(buffer);}
+};
+
+static void* GetBounceBuffer(size_t size)
+{
+#if WANT_CONCURRENT
+  static tbb::enumerable_thread_specific<BounceBuffer> perthread;
+  BounceBuffer &bounce = perthread.local();
+#else
+  static BounceBuffer bounce;
+#endif
+  if (bounce.size < size)
+  {
+    free(bounce.buffer);
+    bounce.size = 0;
+    if (0 != posix_memalign(&bounce.buffer, DiskFile::DIRECT_IO_ALIGNMENT, size))
     {
-      cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
-      return false;
+      bounce.buffer = 0;
+      return 0;
     }
-    offset = _offset;
+    bounce.size = size;
   }
+  return bounce.buffer;
+}
 
-  if (length > MaxLength)
+// Read the whole of the aligned units that the data lies in into an aligned
+// bounce buffer (a piece at a time, if there are many) and copy the data from there
+
+bool DiskFile::ReadBounced(u64 _offset, void *buffer, size_t length)
+{
+  const u64 start = _offset & ~(u64)(DIRECT_IO_ALIGNMENT-1);
+  const u64 end = _offset + length;
+  const size_t piece = (size_t)min((u64)16 << 20, (end - start + DIRECT_IO_ALIGNMENT-1) & ~(u64)(DIRECT_IO_ALIGNMENT-1));
+
+  void *bounce = GetBounceBuffer(piece);
+  if (0 == bounce)
   {
-    cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
+    cerr << "Could not allocate a buffer to read " << filename << endl;
     return false;
   }
 
-  if (1 != fread(buffer, (LengthType)length, 1, file))
+  for (u64 position = start; position < end; position += piece)
   {
-    cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
-    return false;
-  }
+    // (at the end of the file, less than a whole unit is read)
+    const size_t want = (size_t)min((u64)piece, (end - position + DIRECT_IO_ALIGNMENT-1) & ~(u64)(DIRECT_IO_ALIGNMENT-1));
+    ssize_t got;
+    do
+      got = pread(fd, bounce, want, (OffsetType)position);
+    while (got < 0 && EINTR == errno);
 
-  offset += length;
+    if (got <= 0 || position + got < min(position + want, end))
+    {
+      cerr << "Could not read " << (u64)length << " bytes from " << filename << " at offset " << _offset << endl;
+      return false;
+    }
+
+    const u64 from = max(position, _offset);
+    const u64 to = min(position + got, end);
+    memcpy((u8*)buffer + (from - _offset), (const u8*)bounce + (from - position), (size_t)(to - from));
+  }
 
   return true;
 }
 
+size_t DiskFile::DirectIOAlignment(void)
+{
+  CommandLine* cl = CommandLine::get();
+  return cl && cl->GetDirectIO() ? DIRECT_IO_ALIGNMENT : 0;
+}
+
+size_t DiskFile::DirectIOChunkSize(size_t chunksize)
+{
+  const size_t alignment = DirectIOAlignment();
+  return alignment && chunksize >= alignment ? chunksize & ~(alignment-1) : chunksize;
+}
+
+bool DiskFile::IsHole(u64 _offset, u64 length)
+{
+  assert(fd != -1);
+
+#ifdef SEEK_DATA
+  // Find the first data at or after _offset (moving the offset of the file
+  // descriptor does not matter, as pread() does not use it)
+  const off_t data = lseek(fd, (off_t)_offset, SEEK_DATA);
+  return data < 0 ? ENXIO == errno : (u64)data >= _offset + length;
+#else
+  return false;
+#endif
+}
+
 void DiskFile::Close(void)
 {
-  if (file != 0)
+  if (fd != -1)
   {
-    fclose(file);
-    file = 0;
+    close(fd);
+    fd = -1;
   }
+  direct = false;
+}
+
+const u8* DiskFile::Map(void)
+{
+#if HAVE_SYS_MMAN_H
+  if (mapping != 0)
+    return mapping;
+
+  CommandLine* cl = CommandLine::get();
+  if (!cl || !cl->GetMappedFiles())
+    return 0;
+
+  assert(fd != -1);
+  if (filesize == 0 || filesize > (u64)(size_t)-1)
+    return 0;
+
+  void *p = mmap(0, (size_t)filesize, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return 0;
+
+  // The data is mostly used in order, once
+  madvise(p, (size_t)filesize, MADV_SEQUENTIAL);
+
+  mapping = (const u8*)p;
+  mappinglength = (size_t)filesize;
+#endif
+  return mapping;
+}
+
+u8* DiskFile::MapForWrite(void)
+{
+#if HAVE_SYS_MMAN_H
+  if (mapping != 0)
+    return const_cast<u8*>(mapping);
+
+  CommandLine* cl = CommandLine::get();
+  if (!cl || !cl->GetMappedFiles())
+    return 0;
+
+  assert(fd != -1);
+  if (filesize == 0 || filesize > (u64)(size_t)-1)
+    return 0;
+
+#if HAVE_POSIX_FALLOCATE
+  // Allocate the whole file now, as running out of space when the data is stored
+  // in the mapping would kill the process rather than fail a write
+  if (0 != posix_fallocate(fd, 0, (OffsetType)filesize))
+    return 0;
+#endif
+
+  void *p = mmap(0, (size_t)filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return 0;
+
+  mapping = (const u8*)p;
+  mappinglength = (size_t)filesize;
+#endif
+  return const_cast<u8*>(mapping);
+}
+
+void DiskFile::Unmap(void)
+{
+#if HAVE_SYS_MMAN_H
+  if (mapping != 0)
+  {
+    munmap(const_cast<u8*>(mapping), mappinglength);
+    mapping = 0;
+    mappinglength = 0;
+  }
+#endif
+}
+
+void DiskFile::WillNeed(u64 _offset, u64 length) const
+{
+#if HAVE_SYS_MMAN_H
+  if (mapping == 0 || _offset >= mappinglength)
+    return;
+
+  // (the range has to start at a page boundary)
+  const u64 pagesize = (u64)sysconf(_SC_PAGESIZE);
+  const u64 start = _offset & ~(pagesize - 1);
+  const u64 end = min(_offset + length, (u64)mappinglength);
+  madvise(const_cast<u8*>(mapping) + start, (size_t)(end - start), MADV_WILLNEED);
+#endif
 }
 
 // Attempt to get the full pathname of the file
@@ -839,9 +1161,14 @@ bool DiskFile::Delete(void)
 #ifdef WIN32
   assert(hFile == INVALID_HANDLE_VALUE);
 #else
-  assert(file == 0);
+  assert(fd == -1);
 #endif
 
+  return Delete(filename);
+}
+
+bool DiskFile::Delete(string filename)
+{
   if (filename.size() > 0 && 0 == unlink(filename.c_str()))
   {
     return true;
@@ -1038,7 +1365,7 @@ bool DiskFile::Rename(string _filename)
 #ifdef WIN32
   assert(hFile == INVALID_HANDLE_VALUE);
 #else
-  assert(file == 0);
+  assert(fd == -1);
 #endif
 
   if (::rename(filename.c_str(), _filename.c_str()) == 0)
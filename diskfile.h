@@ -32,6 +32,10 @@
 class DiskFile
 {
 public:
+  // The alignment of transfers with direct I/O: a whole number of the logical
+  // blocks of any disk
+  enum { DIRECT_IO_ALIGNMENT = 4096 };
+
   DiskFile(void);
   ~DiskFile(void);
 
@@ -41,29 +45,72 @@ public:
   // Write some data to the file
   bool Write(u64 offset, const void *buffer, size_t length);
 
+  // Copy some data from another file without reading it into memory, if the
+  // OS can (a filesystem may then share the data between the files).
+  bool CopyFrom(DiskFile &source, u64 sourceoffset, u64 offset, u64 length);
+
 #if HAVE_ASYNC_IO
   bool ReadAsync(aiocb_type& cb, u64 offset, void *buffer, size_t length);
   bool WriteAsync(aiocb_type& cb, u64 offset, const void *buffer, size_t length);
 #endif
+#if HAVE_IO_ENGINE
+  // Start reading data which is not aligned for direct I/O (see NeedsBounce()) into
+  // bounce (an aligned buffer of at least BounceSize(length) bytes), along with the
+  // rest of the aligned units it lies in. Returns where in bounce the data will be,
+  // or NULL if the read could not be started.
+  const u8* ReadBouncedAsync(aiocb_type& cb, u64 offset, void *bounce, size_t length);
+  static size_t BounceSize(size_t length) {return length + 2*DIRECT_IO_ALIGNMENT;}
+#endif
 
   // Open the file
   bool Open(bool async = false);
   bool Open(string filename, bool async = false);
   bool Open(string filename, u64 filesize, bool async = false);
 
+  // Open an existing file for both reading and writing
+  bool OpenForWriting(string filename, bool async = false);
+
   // Check to see if the file is open
 #ifdef WIN32
   bool IsOpen(void) const {return hFile != INVALID_HANDLE_VALUE;}
 #else
-  bool IsOpen(void) const {return file != 0;}
+  bool IsOpen(void) const {return fd != -1;}
 #endif
 
   // Read some data from the file
   bool Read(u64 offset, void *buffer, size_t length);
 
-  // Close the file
+  // Whether a read has to go through a bounce buffer, as the file is open for
+  // direct I/O and the read is not aligned for it (Read() does this itself)
+  bool NeedsBounce(u64 offset, const void *buffer, size_t length) const;
+
+  // Whether a range of the file is a hole in a sparse file (so it reads as
+  // zeros without having to be read), where the filesystem can tell.
+  bool IsHole(u64 offset, u64 length);
+
+  // Make sure that everything written to the file is on the disk
+  bool Flush(void);
+
+  // Close the file (a mapping of it is kept until Unmap() is called)
   void Close(void);
 
+  // In the memory-mapped mode (-z), map the whole of the open file into
+  // memory, so that its data can be used where it lies rather than be read
+  // into a buffer. Returns NULL (and the data must be read) in the normal mode
+  // or if the file cannot be mapped.
+  const u8* Map(void);
+  // The same for a file that has been created, mapped to be written through the
+  // mapping (its space on disk is allocated first)
+  u8* MapForWrite(void);
+  void Unmap(void);
+
+  // The mapping of the file, or NULL if it is not mapped
+  const u8* Mapping(void) const {return mapping;}
+  size_t MappingLength(void) const {return mappinglength;}
+
+  // Ask for a range of the mapped file to be read in before it is needed
+  void WillNeed(u64 offset, u64 length) const;
+
   // Get the size of the file
   u64 FileSize(void) const {return filesize;}
 
@@ -79,6 +126,7 @@ public:
 
   // Delete the file
   bool Delete(void);
+  static bool Delete(string filename);
 
   u32  GetBlockCount(void) const { return blockcount; }
   void SetBlockCount(u32 bc) { blockcount = bc; }
@@ -92,6 +140,13 @@ public:
   static bool FileExists(string filename);
   static u64 GetFileSize(string filename);
 
+  // In the direct I/O mode (--direct-io), the alignment that buffers should
+  // have (DIRECT_IO_ALIGNMENT), otherwise 0
+  static size_t DirectIOAlignment(void);
+  // Round a chunk size down to a whole number of DIRECT_IO_ALIGNMENT in the
+  // direct I/O mode, so that the chunks of an aligned block are aligned too
+  static size_t DirectIOChunkSize(size_t chunksize);
+
   // Search the specified path for files which match the specified wildcard
   // and return their names in a list.
   static list<string>* FindFiles(string path, string wildcard);
@@ -100,24 +155,30 @@ protected:
   string filename;
   u64    filesize;
 
-  // OS file handle
+  // OS file handle (which is read and written at a given offset, rather
+  // than at its current one, so that threads can share it)
 #ifdef WIN32
   HANDLE hFile;
 #else
-  FILE *file;
+  int    fd;
 #endif
 
-  // Current offset within the file
-  u64    offset;
-
   // Does the file exist
   bool   exists;
 
   u32    blockcount;
 
+  bool   direct;  // whether the file is open for direct I/O
+  bool   directrefused; // whether it could not be opened for direct I/O before
+
+  const u8 *mapping;
+  size_t     mappinglength; // (the file may have changed size since it was mapped)
+
 protected:
 #ifdef WIN32
   static string ErrorMessage(DWORD error);
+#else
+  bool ReadBounced(u64 offset, void *buffer, size_t length);
 #endif
 };
 
@@ -39,6 +39,7 @@ FileCheckSummer::FileCheckSummer(DiskFile   *_diskfile,
 , windowmask(_windowmask)
 {
   buffer = new char[(size_t)blocksize*2];
+  window = buffer;
 
   filesize = diskfile->FileSize();
 
@@ -47,6 +48,8 @@ FileCheckSummer::FileCheckSummer(DiskFile   *_diskfile,
 
 FileCheckSummer::~FileCheckSummer(void)
 {
+  diskfile->Unmap();
+
   delete [] buffer;
 }
 
@@ -55,15 +58,21 @@ bool FileCheckSummer::Start(void)
 {
   currentoffset = readoffset = 0;
 
-  tailpointer = outpointer = buffer;
-  inpointer = &buffer[blocksize];
+  // In the mapped read mode, the window is slid along the mapping of the file
+  // (rather than the data being read into the buffer) for as long as it fits
+  window = buffer;
+  if (diskfile->Map() != 0 && diskfile->MappingLength() == filesize && filesize >= 2*blocksize)
+    window = (char*)diskfile->Mapping(); // (which is only ever read)
+
+  tailpointer = outpointer = window;
+  inpointer = &window[blocksize];
 
   // Fill the buffer with new data
   if (!Fill())
     return false;
 
   // Compute the checksum for the block
-  checksum = ~0 ^ CRCUpdateBlock(~0, (size_t)blocksize, buffer);
+  checksum = ~0 ^ CRCUpdateBlock(~0, (size_t)blocksize, outpointer);
 
   return true;
 }
@@ -91,7 +100,7 @@ bool FileCheckSummer::Jump(u64 distance)
   if (currentoffset >= filesize)
   {
     currentoffset = filesize;
-    tailpointer = outpointer = buffer;
+    tailpointer = outpointer = window = buffer;
     memset(buffer, 0, (size_t)blocksize);
     checksum = 0;
 
@@ -102,27 +111,35 @@ bool FileCheckSummer::Jump(u64 distance)
   outpointer += distance;
   assert(outpointer <= tailpointer);
 
-  // Is there any data left in the buffer that we are keeping
-  size_t keep = tailpointer - outpointer;
-  if (keep > 0)
+  if (window != buffer)
   {
-    // Move it back to the start of the buffer
-    memmove(buffer, outpointer, keep);
-    tailpointer = &buffer[keep];
+    // The window just moves along the mapping of the file
+    window = outpointer;
   }
   else
   {
-    tailpointer = buffer;
-  }
+    // Is there any data left in the buffer that we are keeping
+    size_t keep = tailpointer - outpointer;
+    if (keep > 0)
+    {
+      // Move it back to the start of the buffer
+      memmove(buffer, outpointer, keep);
+      tailpointer = &buffer[keep];
+    }
+    else
+    {
+      tailpointer = buffer;
+    }
 
-  outpointer = buffer;
-  inpointer = &buffer[blocksize];
+    outpointer = buffer;
+  }
+  inpointer = &window[blocksize];
 
   if (!Fill())
     return false;
 
   // Compute the checksum for the block
-  checksum = ~0 ^ CRCUpdateBlock(~0, (size_t)blocksize, buffer);
+  checksum = ~0 ^ CRCUpdateBlock(~0, (size_t)blocksize, outpointer);
 
   return true;
 }
@@ -131,6 +148,33 @@ bool FileCheckSummer::Jump(u64 distance)
 
 bool FileCheckSummer::Fill(void)
 {
+  if (window != buffer)
+  {
+    // Does the window still lie wholly within the mapping of the file
+    const u64 windowoffset = (u64)(window - (const char*)diskfile->Mapping());
+    if (windowoffset + 2*blocksize <= filesize)
+    {
+      // Then the data need not be read, just hashed
+      size_t want = &window[2*blocksize] - tailpointer;
+      UpdateHashes(readoffset, tailpointer, want);
+      readoffset += want;
+      tailpointer += want;
+
+      // and ask for the data after it to be read in
+      diskfile->WillNeed(readoffset, 2*blocksize);
+
+      return true;
+    }
+
+    // Otherwise copy the data in the window to the buffer and continue from there
+    size_t keep = tailpointer - outpointer;
+    memcpy(buffer, outpointer, keep);
+    memset(&buffer[keep], 0, (size_t)(2*blocksize) - keep);
+    outpointer = window = buffer;
+    inpointer = &buffer[blocksize];
+    tailpointer = &buffer[keep];
+  }
+
   // Have we already reached the end of the file
   if (readoffset >= filesize)
     return true;
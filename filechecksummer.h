@@ -84,6 +84,8 @@ protected:
 
   u64         currentoffset; // file offset for current window position
   char       *buffer;        // buffer for reading from the file
+  char       *window;        // buffer, or where the window lies in the
+                             // mapping of the file in the mapped read mode
   char       *outpointer;    // position in buffer of scan window
   char       *inpointer;     // &outpointer[blocksize];
   char       *tailpointer;   // after last valid data in buffer
@@ -144,7 +146,7 @@ inline bool FileCheckSummer::Step(void)
   if (++currentoffset >= filesize)
   {
     currentoffset = filesize;
-    tailpointer = outpointer = buffer;
+    tailpointer = outpointer = window = buffer;
     memset(buffer, 0, (size_t)blocksize);
     checksum = 0;
 
@@ -159,16 +161,24 @@ inline bool FileCheckSummer::Step(void)
   checksum = windowmask ^ CRCSlideChar(windowmask ^ checksum, inch, outch, windowtable);
 
   // Can the window slide further
-  if (outpointer < &buffer[blocksize])
+  if (outpointer < &window[blocksize])
     return true;
 
-  assert(outpointer == &buffer[blocksize]);
+  assert(outpointer == &window[blocksize]);
 
-  // Copy the data back to the beginning of the buffer
-  memmove(buffer, outpointer, (size_t)blocksize);
-  inpointer = outpointer;
-  outpointer = buffer;
-  tailpointer -= blocksize;
+  if (window != buffer)
+  {
+    // The window just moves along the mapping of the file
+    window = outpointer;
+  }
+  else
+  {
+    // Copy the data back to the beginning of the buffer
+    memmove(buffer, outpointer, (size_t)blocksize);
+    inpointer = outpointer;
+    outpointer = buffer;
+    tailpointer -= blocksize;
+  }
 
   // Fill the rest of the buffer
   return Fill();
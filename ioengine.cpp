@@ -0,0 +1,417 @@
+//  This file is part of par2cmdline (a PAR 2.0 compatible file verification and
+//  repair tool). See http://parchive.sourceforge.net for details of PAR 2.0.
+//
+//  par2cmdline is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  par2cmdline is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#include "par2cmdline.h"
+
+#if HAVE_IO_ENGINE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// The io_uring system calls are made directly, so liburing is not needed
+// (their numbers are the same on every architecture but alpha).
+#ifndef __NR_io_uring_setup
+  #define __NR_io_uring_setup    425
+  #define __NR_io_uring_enter    426
+  #define __NR_io_uring_register 427
+#endif
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool aiocb_type::rw(int fildes, size_t sz, const void* buf, off_t off, bool want_write, size_t slack) {
+  assert(PENDING != state_);
+
+  fildes_ = fildes;
+  buf_ = static_cast<u8*> (const_cast<void*> (buf));
+  len_ = sz;
+  slack_ = slack;
+  off_ = off;
+  write_ = want_write;
+
+  if (0 == sz) {
+    state_ = DONE;
+    return true;
+  }
+
+  state_ = PENDING;
+  if (!io_engine::get().submit(this)) {
+    state_ = IDLE;
+    return false;
+  }
+  return true;
+}
+
+void aiocb_type::suspend_until_completed(void) const {
+  if (PENDING == state_)
+    io_engine::get().wait(this);
+}
+
+io_engine& io_engine::get(void) {
+  static io_engine engine;
+  return engine;
+}
+
+io_engine::io_engine(void) :
+  ringfd_(-1), sqring_(MAP_FAILED), sqringsize_(0), cqring_(MAP_FAILED), cqringsize_(0),
+  sqes_(MAP_FAILED), sqessize_(0), sqentries_(0), cqentries_(0), sqhead_(NULL), sqtail_(NULL),
+  sqmask_(0), sqarray_(NULL), cqhead_(NULL), cqtail_(NULL), cqmask_(0), cqes_(NULL), queued_(0) {
+  stopping_ = 0;
+  inflight_ = 0;
+  waiters_ = 0;
+  pthread_mutex_init(&donemutex_, NULL);
+  pthread_cond_init(&donecond_, NULL);
+
+  if (setup_ring()) {
+    threads_.push_back(new tbb::tbb_thread(thread_body(this, true)));
+  } else {
+    sem_init(&pendingsem_, 0, 0);
+    for (unsigned i = 0; i != POOL_THREADS; ++i)
+      threads_.push_back(new tbb::tbb_thread(thread_body(this, false)));
+  }
+}
+
+io_engine::~io_engine(void) {
+  stopping_ = 1;
+
+  if (-1 != ringfd_) {
+    // a no-op request wakes the reaper, which stops once every request has been reaped
+    tbb::mutex::scoped_lock l(mutex_);
+    ++inflight_;
+    queue_locked(NULL);
+    submit_locked();
+  } else {
+    for (size_t i = 0; i != threads_.size(); ++i)
+      sem_post(&pendingsem_);
+  }
+
+  for (size_t i = 0; i != threads_.size(); ++i) {
+    threads_[i]->join();
+    delete threads_[i];
+  }
+
+  if (-1 != ringfd_) {
+    unmap_ring();
+    close(ringfd_);
+  } else {
+    sem_destroy(&pendingsem_);
+  }
+
+  pthread_cond_destroy(&donecond_);
+  pthread_mutex_destroy(&donemutex_);
+}
+
+bool io_engine::setup_ring(void) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  int fd = io_uring_setup(RING_ENTRIES, &p);
+  if (fd < 0)
+    return false;
+
+  // IORING_OP_READ and IORING_OP_WRITE are supported from Linux 5.6 on, which
+  // is when IORING_FEAT_RW_CUR_POS appeared
+#ifdef IORING_FEAT_RW_CUR_POS
+  if (0 == (p.features & IORING_FEAT_RW_CUR_POS))
+#endif
+  {
+    close(fd);
+    return false;
+  }
+
+  sqringsize_ = p.sq_off.array + p.sq_entries * sizeof(u32);
+  cqringsize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single = 0 != (p.features & IORING_FEAT_SINGLE_MMAP);
+  if (single)
+    sqringsize_ = cqringsize_ = max(sqringsize_, cqringsize_);
+  sqessize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  sqring_ = mmap(NULL, sqringsize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  cqring_ = single ? sqring_ :
+            mmap(NULL, cqringsize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  sqes_ = mmap(NULL, sqessize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (MAP_FAILED == sqring_ || MAP_FAILED == cqring_ || MAP_FAILED == sqes_) {
+    unmap_ring();
+    close(fd);
+    return false;
+  }
+
+  u8* sq = static_cast<u8*> (sqring_);
+  sqentries_ = p.sq_entries;
+  sqhead_ = reinterpret_cast<volatile u32*> (sq + p.sq_off.head);
+  sqtail_ = reinterpret_cast<volatile u32*> (sq + p.sq_off.tail);
+  sqmask_ = *reinterpret_cast<u32*> (sq + p.sq_off.ring_mask);
+  sqarray_ = reinterpret_cast<u32*> (sq + p.sq_off.array);
+
+  u8* cq = static_cast<u8*> (cqring_);
+  cqentries_ = p.cq_entries;
+  cqhead_ = reinterpret_cast<volatile u32*> (cq + p.cq_off.head);
+  cqtail_ = reinterpret_cast<volatile u32*> (cq + p.cq_off.tail);
+  cqmask_ = *reinterpret_cast<u32*> (cq + p.cq_off.ring_mask);
+  cqes_ = cq + p.cq_off.cqes;
+
+  ringfd_ = fd;
+  return true;
+}
+
+void io_engine::unmap_ring(void) {
+  if (MAP_FAILED != sqes_)
+    munmap(sqes_, sqessize_);
+  if (MAP_FAILED != cqring_ && cqring_ != sqring_)
+    munmap(cqring_, cqringsize_);
+  if (MAP_FAILED != sqring_)
+    munmap(sqring_, sqringsize_);
+  sqes_ = cqring_ = sqring_ = MAP_FAILED;
+}
+
+bool io_engine::submit(aiocb_type* cb) {
+  if (-1 == ringfd_) {
+    {
+      tbb::mutex::scoped_lock l(mutex_);
+      pending_.push_back(cb);
+    }
+    sem_post(&pendingsem_);
+    return true;
+  }
+
+  tbb::mutex::scoped_lock l(mutex_);
+
+  // With no more requests in flight than the submission ring has entries, neither
+  // it nor the (larger) completion ring can overflow.
+  while (inflight_ >= sqentries_) {
+    submit_locked();
+    l.release();
+    tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.0001) );
+    l.acquire(mutex_);
+  }
+
+  ++inflight_;
+  queue_locked(cb);
+  if (queued_ >= SUBMIT_BATCH)
+    submit_locked();
+  return true;
+}
+
+void io_engine::flush(void) {
+  if (-1 == ringfd_)
+    return;
+
+  tbb::mutex::scoped_lock l(mutex_);
+  submit_locked();
+}
+
+void io_engine::wait(const aiocb_type* cb) {
+  // the request may still be queued, waiting for others to be submitted with it
+  flush();
+
+  // The waiter is counted before the request's state is checked, and complete() sets
+  // the state before it counts the waiters, each with a full fence in between: so
+  // either the state is seen to have changed, or the waiter is woken.
+  ++waiters_;
+  pthread_mutex_lock(&donemutex_);
+  while (aiocb_type::PENDING == cb->state_) {
+    // In case the kernel was too busy to take the request before, it is submitted
+    // again if it has not completed after a while.
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ++ts.tv_sec;
+      ts.tv_nsec -= 1000000000;
+    }
+    if (ETIMEDOUT == pthread_cond_timedwait(&donecond_, &donemutex_, &ts)) {
+      pthread_mutex_unlock(&donemutex_);
+      flush();
+      pthread_mutex_lock(&donemutex_);
+    }
+  }
+  pthread_mutex_unlock(&donemutex_);
+  --waiters_;
+}
+
+// Add a request (or, if cb is NULL, a no-op) to the submission ring.
+void io_engine::queue_locked(aiocb_type* cb) {
+  const u32 tail = *sqtail_;
+  const u32 index = tail & sqmask_;
+  struct io_uring_sqe* sqe = &static_cast<struct io_uring_sqe*> (sqes_)[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  if (NULL == cb) {
+    sqe->opcode = IORING_OP_NOP;
+  } else {
+    sqe->opcode = cb->write_ ? IORING_OP_WRITE : IORING_OP_READ;
+    for (size_t i = 0; i != fixed_.size(); ++i) {
+      if (cb->buf_ >= fixed_[i].first && cb->buf_ + cb->len_ <= fixed_[i].first + fixed_[i].second) {
+        sqe->opcode = cb->write_ ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (u16) i;
+        break;
+      }
+    }
+    sqe->fd = cb->fildes_;
+    sqe->off = (u64) cb->off_;
+    sqe->addr = (u64) (uintptr_t) cb->buf_;
+    sqe->len = (u32) min(cb->len_, (size_t) 0x7ffff000); // (the most that one read() transfers)
+    sqe->user_data = (u64) (uintptr_t) cb;
+  }
+  sqarray_[index] = index;
+
+  __atomic_store_n(sqtail_, tail + 1, __ATOMIC_RELEASE);
+  ++queued_;
+}
+
+void io_engine::submit_locked(void) {
+  while (0 != queued_) {
+    int res = io_uring_enter(ringfd_, queued_, 0, 0);
+    if (res > 0)
+      queued_ -= (u32) res;
+    else if (res < 0 && EINTR == errno)
+      continue;
+    else
+      break; // (EAGAIN or EBUSY: the queued requests are submitted by a later call)
+  }
+}
+
+// Run by the reaper thread: wait for requests to complete and mark them as completed.
+void io_engine::reap(void) {
+  const struct io_uring_cqe* cqes = static_cast<const struct io_uring_cqe*> (cqes_);
+
+  for (;;) {
+    u32 head = *cqhead_;
+    const u32 tail = __atomic_load_n(cqtail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if (stopping_ && 0 == inflight_)
+        return;
+      if (io_uring_enter(ringfd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && EINTR != errno)
+        tbb::this_tbb_thread::sleep( tbb::tick_count::interval_t(0.001) );
+      continue;
+    }
+
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe& cqe = cqes[head & cqmask_];
+      aiocb_type* cb = reinterpret_cast<aiocb_type*> ((uintptr_t) cqe.user_data);
+      if (NULL == cb || complete(cb, cqe.res)) {
+        --inflight_;
+      } else {
+        tbb::mutex::scoped_lock l(mutex_);
+        queue_locked(cb);
+        submit_locked();
+      }
+    }
+    __atomic_store_n(cqhead_, head, __ATOMIC_RELEASE);
+  }
+}
+
+// Run by each thread of the pool: carry out the queued requests one at a time.
+void io_engine::work(void) {
+  for (;;) {
+    while (0 != sem_wait(&pendingsem_) && EINTR == errno)
+      ;
+
+    aiocb_type* cb = NULL;
+    {
+      tbb::mutex::scoped_lock l(mutex_);
+      if (!pending_.empty()) {
+        cb = pending_.front();
+        pending_.pop_front();
+      }
+    }
+
+    if (NULL != cb)
+      transfer(cb);
+    else if (stopping_)
+      return;
+  }
+}
+
+void io_engine::transfer(aiocb_type* cb) {
+  for (;;) {
+    ssize_t res = cb->write_ ? pwrite(cb->fildes_, cb->buf_, cb->len_, cb->off_) :
+                               pread(cb->fildes_, cb->buf_, cb->len_, cb->off_);
+    if (complete(cb, res < 0 ? -errno : res))
+      return;
+  }
+}
+
+bool io_engine::complete(aiocb_type* cb, ssize_t res) {
+  if (-EINTR == res || -EAGAIN == res)
+    return false; // try again
+
+  if (res > 0 && (size_t) res < cb->len_ && cb->len_ - res > cb->slack_) {
+    // carry on with the rest of a short transfer
+    cb->buf_ += res;
+    cb->off_ += res;
+    cb->len_ -= res;
+    return false;
+  }
+
+  // (nothing being transferred means the file ended first, which only a read with
+  // slack may do, once what is left of it is within the slack)
+  // (the exchange is a full fence: the state must be set before the waiters are
+  // counted, or one which has just started waiting could be missed)
+  cb->state_.fetch_and_store(res > 0 || (0 == res && cb->len_ <= cb->slack_) ? aiocb_type::DONE : aiocb_type::FAILED);
+
+  if (0 != waiters_) {
+    pthread_mutex_lock(&donemutex_);
+    pthread_cond_broadcast(&donecond_);
+    pthread_mutex_unlock(&donemutex_);
+  }
+  return true;
+}
+
+void io_engine::register_buffers(u8* const* buffers, size_t count, size_t size) {
+  if (-1 == ringfd_ || 0 == count)
+    return;
+
+  tbb::mutex::scoped_lock l(mutex_);
+  if (!fixed_.empty())
+    return; // (one set of buffers is registered at a time)
+
+  std::vector<struct iovec> iov(count);
+  for (size_t i = 0; i != count; ++i) {
+    iov[i].iov_base = buffers[i];
+    iov[i].iov_len = size;
+  }
+  if (0 == io_uring_register(ringfd_, IORING_REGISTER_BUFFERS, &iov[0], (unsigned) count)) {
+    for (size_t i = 0; i != count; ++i)
+      fixed_.push_back(make_pair(buffers[i], size));
+  }
+}
+
+void io_engine::unregister_buffers(void) {
+  if (-1 == ringfd_)
+    return;
+
+  tbb::mutex::scoped_lock l(mutex_);
+  if (fixed_.empty())
+    return;
+
+  io_uring_register(ringfd_, IORING_UNREGISTER_BUFFERS, NULL, 0);
+  fixed_.clear();
+}
+
+#endif // HAVE_IO_ENGINE
@@ -0,0 +1,166 @@
+//  This file is part of par2cmdline (a PAR 2.0 compatible file verification and
+//  repair tool). See http://parchive.sourceforge.net for details of PAR 2.0.
+//
+//  par2cmdline is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  par2cmdline is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef __IOENGINE_H__
+#define __IOENGINE_H__
+
+// On Linux, the async reads and writes of DiskFile::ReadAsync() and
+// DiskFile::WriteAsync() are carried out by the io_engine: an io_uring if the
+// kernel provides one, otherwise a few threads which call pread() and pwrite().
+// Requests are queued and submitted together, either once enough of them are
+// queued or when one of them is waited for. Completions are reaped by a thread
+// of the engine's own, so no TBB worker ever blocks in the kernel for them.
+
+#if HAVE_IO_ENGINE
+
+  class io_engine;
+
+  struct aiocb_type {
+    enum { IDLE, PENDING, DONE, FAILED };
+
+  private:
+    friend class io_engine;
+
+    int              fildes_;
+    u8*              buf_;    // where the rest of the transfer is to or from
+    size_t           len_;    // how much of the transfer is still to be done
+    size_t           slack_;  // how much of the end of a read the file may end before
+    off_t            off_;
+    bool             write_;
+    tbb::atomic<int> state_;
+
+    bool rw(int fildes, size_t sz, const void* buf, off_t off, bool want_write, size_t slack);
+
+  public:
+    aiocb_type(void) : fildes_(-1), buf_(NULL), len_(0), slack_(0), off_(0), write_(false) { state_ = IDLE; }
+
+    bool read(int fildes, size_t sz, void* buf, off_t off) {
+      return rw(fildes, sz, buf, off, false, 0);
+    }
+
+    // A read which succeeds if the file ends after at least minsz of the sz bytes
+    // (eg, one rounded up to whole units for direct I/O)
+    bool read(int fildes, size_t sz, void* buf, off_t off, size_t minsz) {
+      assert(minsz <= sz);
+      return rw(fildes, sz, buf, off, false, sz - minsz);
+    }
+
+    bool write(int fildes, size_t sz, const void* buf, off_t off) {
+      return rw(fildes, sz, buf, off, true, 0);
+    }
+
+    void suspend_until_completed(void) const;
+
+    bool has_completed(void) const { return DONE == state_ || FAILED == state_; }
+
+    bool completedOK(void) const {
+      assert(has_completed());
+      return DONE == state_;
+    }
+  };
+
+  class io_engine {
+  public:
+    static io_engine& get(void);
+
+    // "io_uring" or "threads"
+    const char* name(void) const { return ringfd_ != -1 ? "io_uring" : "threads"; }
+
+    // Queue a request, which is submitted along with the next few
+    bool submit(aiocb_type* cb);
+    // Submit the queued requests now
+    void flush(void);
+    // Block until a submitted request has completed
+    void wait(const aiocb_type* cb);
+
+    // The buffers through which most transfers are made can be registered with
+    // the kernel, so that it need not map them for each transfer. Registration
+    // can fail (eg, if too much memory would be locked), in which case the
+    // transfers are still made, just without the buffers registered.
+    void register_buffers(u8* const* buffers, size_t count, size_t size);
+    void unregister_buffers(void);
+
+  private:
+    io_engine(void);
+    ~io_engine(void);
+    io_engine(const io_engine&);            // copying disallowed
+    io_engine& operator=(const io_engine&); // assignment disallowed
+
+    enum { RING_ENTRIES = 128, SUBMIT_BATCH = 8, POOL_THREADS = 4 };
+
+    // io_uring
+    bool setup_ring(void);
+    void unmap_ring(void);
+    void queue_locked(aiocb_type* cb);
+    void submit_locked(void);
+    void reap(void);
+
+    // thread pool
+    void work(void);
+    void transfer(aiocb_type* cb);
+
+    // the rest of a short transfer is requeued; true once it is all done (and
+    // then any threads waiting for a request are woken)
+    bool complete(aiocb_type* cb, ssize_t res);
+
+    class thread_body {
+      io_engine* e_;
+      bool       reaper_;
+    public:
+      thread_body(io_engine* e, bool reaper) : e_(e), reaper_(reaper) {}
+      void operator()(void) { if (reaper_) e_->reap(); else e_->work(); }
+    };
+
+    tbb::mutex                    mutex_;     // locks the submission queue and the registered buffers
+    tbb::atomic<int>              stopping_;
+    tbb::atomic<u32>              inflight_;  // requests submitted to the ring and not yet reaped
+    std::vector<tbb::tbb_thread*> threads_;
+
+    int                           ringfd_;
+    void*                         sqring_;
+    size_t                        sqringsize_;
+    void*                         cqring_;
+    size_t                        cqringsize_;
+    void*                         sqes_;
+    size_t                        sqessize_;
+    u32                           sqentries_;
+    u32                           cqentries_;
+    volatile u32*                 sqhead_;
+    volatile u32*                 sqtail_;
+    u32                           sqmask_;
+    u32*                          sqarray_;
+    volatile u32*                 cqhead_;
+    volatile u32*                 cqtail_;
+    u32                           cqmask_;
+    void*                         cqes_;
+    u32                           queued_;    // requests in the ring that have yet to be submitted
+
+    std::vector< pair<u8*, size_t> > fixed_;  // the registered buffers
+
+    // the thread pool's queue
+    std::deque<aiocb_type*>       pending_;
+    sem_t                         pendingsem_;
+
+    // signalled whenever a request completes while a thread is waiting in wait()
+    pthread_mutex_t               donemutex_;
+    pthread_cond_t                donecond_;
+    tbb::atomic<u32>              waiters_;
+  };
+
+#endif // HAVE_IO_ENGINE
+
+#endif // __IOENGINE_H__
@@ -19,6 +19,24 @@
 
 #include "par2cmdline.h"
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // PAR 1.0 repair does not copy any blocks to the target files, so the input
+  // buffers are only read and then processed into every output block.
+  class par1_repair_filter_read : public filter_read_base<par1_repair_filter_read, pipeline_buffer> {
+  public:
+    par1_repair_filter_read(pipeline_state<pipeline_buffer>& s) : filter_read_base<par1_repair_filter_read, pipeline_buffer>(s) {}
+
+    void on_mutex_held(pipeline_buffer* ib) {}
+    bool on_inputbuffer_read(pipeline_buffer* ib) { return true; }
+  };
+
+  class par1_repair_filter_process : public filter_process_base<par1_repair_filter_process, pipeline_buffer, Par1Repairer> {
+  public:
+    par1_repair_filter_process(Par1Repairer& delegate, pipeline_state<pipeline_buffer>& s) :
+      filter_process_base<par1_repair_filter_process, pipeline_buffer, Par1Repairer>(delegate, s) {}
+  };
+#endif
+
 #ifdef _MSC_VER
 #ifdef _DEBUG
 #undef THIS_FILE
@@ -45,6 +63,12 @@ Par1Repairer::Par1Repairer(void)
   outputbuffer = 0;
 
   noiselevel = CommandLine::nlNormal;
+
+#if WANT_CONCURRENT
+  concurrent_processing_level = ALL_CONCURRENT;
+  cout_in_use = 0;
+  last_cout = tbb::tick_count::now();
+#endif
 }
 
 Par1Repairer::~Par1Repairer(void)
@@ -82,6 +106,10 @@ Result Par1Repairer::Process(const CommandLine &commandline, bool dorepair)
   // How noisy should we be
   noiselevel = commandline.GetNoiseLevel();
 
+#if WANT_CONCURRENT
+  concurrent_processing_level = commandline.GetConcurrentProcessingLevel();
+#endif
+
   // Get filesnames from the command line
   string par1filename = commandline.GetParFilename();
   const list<CommandLine::ExtraFile> &extrafiles = commandline.GetExtraFiles();
@@ -1139,11 +1167,13 @@ bool Par1Repairer::ComputeRSmatrix(void)
     // Was this block found
     if (sourceblock->IsSet())
     {
+#if !(WANT_CONCURRENT && CONCURRENT_PIPELINE)
       // Open the file the block was found in.
       if (!sourceblock->Open())
       {
         return false;
       }
+#endif
 
       // Record that the block was found
       *pres = true;
@@ -1183,11 +1213,13 @@ bool Par1Repairer::ComputeRSmatrix(void)
     u32        exponent      = recoveryiterator->first;
     DataBlock *recoveryblock = recoveryiterator->second;
 
+#if !(WANT_CONCURRENT && CONCURRENT_PIPELINE)
     // Make sure the file is open
     if (!recoveryblock->Open())
     {
       return false;
     }
+#endif
     // Add the recovery block to the list of blocks that will be read
     *inputblock = recoveryblock;
 
@@ -1202,12 +1234,27 @@ bool Par1Repairer::ComputeRSmatrix(void)
     ++recoveryiterator;
   }
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // The pipeline in ProcessData() opens each file when it reads the first of its
+  // blocks and closes it after the last one, so it needs to know how many there are.
+  for (inputblock = inputblocks.begin(); inputblock != inputblocks.end(); ++inputblock)
+    (*inputblock)->GetDiskFile()->SetBlockCount(0);
+  for (inputblock = inputblocks.begin(); inputblock != inputblocks.end(); ++inputblock)
+  {
+    DiskFile *diskfile = (*inputblock)->GetDiskFile();
+    diskfile->SetBlockCount(diskfile->GetBlockCount() + 1);
+  }
+#endif
+
   // If we need to, compute and solve the RS matrix
   if (verifylist.size() == 0)
   {
     return true;
   }
 
+#if WANT_CONCURRENT
+  rs.SetConcurrent(ALL_SERIAL != concurrent_processing_level);
+#endif
   bool success = rs.Compute(noiselevel);
   return success;
 }
@@ -1218,45 +1265,188 @@ bool Par1Repairer::AllocateBuffers(size_t memorylimit)
   // Would single pass processing use too much memory
   if (blocksize * verifylist.size() > memorylimit)
   {
-    // Pick a size that is small enough
-    chunksize = ~3 & (memorylimit / verifylist.size());
+    // Pick a size that is small enough (and, for direct I/O, keeps the reads aligned)
+    chunksize = DiskFile::DirectIOChunkSize(~3 & (memorylimit / verifylist.size()));
   }
   else
   {
     chunksize = (size_t)blocksize;
   }
 
-  // Allocate the two buffers
+  // Allocate the two buffers (the pipeline allocates its own input buffers)
   inputbuffersize = (size_t)chunksize;
+#if !(WANT_CONCURRENT && CONCURRENT_PIPELINE)
   if (!inputbuffer.alloc(inputbuffersize))
     return false;
+#endif
 //inputbuffer = new u8[inputbuffersize];
   outputbufferalignment = (inputbuffersize + sizeof(u32)-1) & ~(sizeof(u32)-1);
   outputbuffersize = outputbufferalignment * verifylist.size();
   outputbuffer = new u8[outputbuffersize];
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  outputbuffer_element_initialised_.resize(verifylist.size());
+#endif
+
   if ( /* inputbuffer == NULL || */ outputbuffer == NULL)
   {
     cerr << "Could not allocate buffer memory." << endl;
     return false;
   }
 
+#if WANT_CONCURRENT
+  // Each band of output blocks is processed in one call, so where each output block
+  // lies is looked up here once rather than for every batch of input blocks
+  outputindexes_.resize(verifylist.size());
+  outputbuffers_.resize(verifylist.size());
+  for (u32 i = 0; i != verifylist.size(); ++i) {
+    outputindexes_[i] = i;
+    outputbuffers_[i] = OutputBufferAt(i);
+  }
+#endif
+
   return true;
 }
 
+#if WANT_CONCURRENT
+
+void* Par1Repairer::OutputBufferAt(u32 outputindex) {
+  // Select the appropriate part of the output buffer
+  return &outputbuffer[outputbufferalignment * outputindex];
+}
+
+// Process the input blocks into the output blocks outputindex..outputendindex-1 using
+// one pass over the output. (In the pipeline, the batches are processed one at a time
+// and each band of output blocks by one task, so their buffers and flags need no lock.)
+void Par1Repairer::ProcessDataForOutputIndex(u32 outputindex, u32 outputendindex, size_t blocklength, size_t datalength,
+                                             u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers) {
+    const u32 count = outputendindex - outputindex;
+    if (0 == count)
+      return;
+
+    // (the buffers of the output blocks were looked up by AllocateBuffers())
+    void * const *outbufs = &outputbuffers_[outputindex];
+
+  #if CONCURRENT_PIPELINE
+    // the output buffer is not cleared before processing: the first input block
+    // processed into each output block overwrites it
+    u8 *initialised = &outputbuffer_element_initialised_[outputindex];
+
+    // Only the first datalength bytes of the inputs are processed, so the rest of
+    // an output block which is about to be overwritten must be cleared
+    if (datalength < blocklength)
+      for (u32 i = 0; i != count; ++i)
+        if (!initialised[i])
+          memset((u8*) outbufs[i] + datalength, 0, blocklength - datalength);
+
+    // Process the data
+    rs.ProcessMultiple(datalength, inputcount, inputindexes, inputbuffers, count, &outputindexes_[outputindex], outbufs, initialised);
+  #else
+    // Process the data
+    rs.ProcessMultiple(datalength, inputcount, inputindexes, inputbuffers, count, &outputindexes_[outputindex], outbufs, NULL);
+  #endif
+
+    if (noiselevel > CommandLine::nlQuiet) {
+      tbb::tick_count now = tbb::tick_count::now();
+      if ((now - last_cout).seconds() >= 0.1) { // only update every 0.1 seconds
+        // Update a progress indicator
+        u64 oldfraction = (u64)(1000 * progress / totaldata);
+        progress += (u64) blocklength * count * inputcount;
+        u64 newfraction = (u64)(1000 * progress / totaldata);
+
+        if (oldfraction != newfraction) {
+          if (0 == cout_in_use.compare_and_swap(outputendindex, 0)) { // <= this version doesn't block - only need 1 thread to write to cout
+            last_cout = now;
+            cout << "Repairing: " << newfraction/10 << '.' << newfraction%10 << "%\r" << flush;
+            cout_in_use = 0;
+          }
+        }
+      } else
+        progress += (u64) blocklength * count * inputcount;
+    }
+}
+
+class ApplyPar1RepairerRSProcess {
+public:
+  ApplyPar1RepairerRSProcess(Par1Repairer* obj, size_t blocklength, u32 inputcount, const u32 *inputindexes,
+                             buffer * const *inputbuffers) :
+    _obj(obj), _blocklength(blocklength), _inputcount(inputcount), _inputindexes(inputindexes),
+    _inputbuffers(inputbuffers) {}
+  void operator()(const tbb::blocked_range<u32>& r) const {
+    _obj->ProcessDataForOutputIndex(r.begin(), r.end(), _blocklength, _blocklength, _inputcount, _inputindexes, _inputbuffers);
+  }
+private:
+  Par1Repairer*   _obj;
+  size_t          _blocklength;
+  u32             _inputcount;
+  const u32      *_inputindexes;
+  buffer * const *_inputbuffers;
+};
+
+// Process inputcount input blocks (inputindexes[i] is in inputbuffers[i]) into every output block.
+void Par1Repairer::ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputindexes,
+                                           buffer * const *inputbuffers)
+{
+  const u32 outputcount = (u32) verifylist.size();
+  if (ALL_SERIAL != concurrent_processing_level) {
+    static tbb::affinity_partitioner ap;
+    tbb::parallel_for(tbb::blocked_range<u32>(0, outputcount),
+      ::ApplyPar1RepairerRSProcess(this, blocklength, inputcount, inputindexes, inputbuffers), ap);
+  } else
+    ProcessDataForOutputIndex(0, outputcount, blocklength, blocklength, inputcount, inputindexes, inputbuffers);
+}
+
+#endif
+
 // Read source data, process it through the RS matrix and write it to disk.
 bool Par1Repairer::ProcessData(u64 blockoffset, size_t blocklength)
 {
   u64 totalwritten = 0;
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // The output buffer is not cleared: instead each output block is overwritten
+  // by the first input block processed into it (see ProcessDataForOutputIndex)
+  for (size_t i = 0; i != verifylist.size(); ++i)
+    outputbuffer_element_initialised_[i] = 0;
+#else
   // Clear the output buffer
   memset(outputbuffer, 0, outputbuffersize);
-
-  vector<DataBlock*>::iterator inputblock = inputblocks.begin();
-  u32                          inputindex = 0;
+#endif
 
   // Are there any blocks which need to be reconstructed
   if (verifylist.size() > 0)
   {
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+    const u32 outputcount = (u32) verifylist.size();
+    const size_t max_tokens = ALL_SERIAL == concurrent_processing_level ? 1 : tbb::task_scheduler_init::default_num_threads();
+    // Each extra input buffer costs as much memory as an output block, so don't
+    // batch more input blocks than there are output blocks.
+    const size_t batchsize = min((size_t) ReedSolomon<Galois8>::ProcessMultipleInputCount, (size_t) outputcount);
+    pipeline_state<pipeline_buffer> s(max_tokens, batchsize, chunksize, outputcount, blocklength, blockoffset, inputblocks);
+
+    tbb::pipeline p;
+    par1_repair_filter_read rfr(s);
+    p.add_filter(rfr);
+    par1_repair_filter_process rfp(*this, s);
+    p.add_filter(rfp);
+    p.add_filter(rfp.batch_stage());
+
+    p.run(max_tokens);
+    rfp.flush();
+    p.clear();
+
+    // Clear any output block which no input block contributed to
+    for (u32 i = 0; i != outputcount; ++i)
+      if (!outputbuffer_element_initialised_[i])
+        memset(OutputBufferAt(i), 0, outputbufferalignment);
+
+    if (!s.is_ok()) {
+      cerr << "Repair of data file(s) has failed." << endl;
+      return false;
+    }
+#else
+    vector<DataBlock*>::iterator inputblock = inputblocks.begin();
+    u32                          inputindex = 0;
+
     // For each input block
     while (inputblock != inputblocks.end())       
     {
@@ -1264,6 +1454,10 @@ bool Par1Repairer::ProcessData(u64 blockoffset, size_t blocklength)
       if (!(*inputblock)->ReadData(blockoffset, blocklength, inputbuffer.get()))
         return false;
 
+  #if WANT_CONCURRENT
+      buffer *pinputbuffer = &inputbuffer;
+      ProcessDataConcurrently(blocklength, 1, &inputindex, &pinputbuffer);
+  #else
       // For each output block
       for (u32 outputindex=0; outputindex<verifylist.size(); outputindex++)
       {
@@ -1286,10 +1480,12 @@ bool Par1Repairer::ProcessData(u64 blockoffset, size_t blocklength)
           }
         }
       }
+  #endif
 
       ++inputblock;
       ++inputindex;
     }
+#endif
   }
 
   if (noiselevel > CommandLine::nlQuiet)
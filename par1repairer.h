@@ -28,6 +28,16 @@ public:
 
   Result Process(const CommandLine &commandline, bool dorepair);
 
+#if WANT_CONCURRENT
+public:
+  void ProcessDataForOutputIndex(u32 outputstartindex, u32 outputendindex, size_t blocklength, size_t datalength,
+                                 u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers);
+  void ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers);
+  const ReedSolomon<Galois8>& GetReedSolomon(void) const { return rs; }
+protected:
+  void* OutputBufferAt(u32 outputindex);
+#endif
+
 protected:
   // Load the main PAR file
   bool LoadRecoveryFile(string filename);
@@ -105,16 +115,43 @@ protected:
 
   ReedSolomon<Galois8>      rs;                      // The Reed Solomon matrix.
 
+#if WANT_CONCURRENT
+  // 32-bit PowerPC does not support tbb::atomic<u64> because it requires the ldarx
+  // instruction which is only available for 64-bit PowerPC CPUs, so...
+  #if __GNUC__ &&  __ppc__
+  // this won't cause any data corruption - it will only cause (possibly) incorrect progress values to be printed
   u64                       progress;                // How much data has been processed.
+  #else
+  tbb::atomic<u64>          progress;                // How much data has been processed.
+  #endif
+#else
+  u64                       progress;                // How much data has been processed.
+#endif
   u64                       totaldata;               // Total amount of data to be processed.
 
   size_t                    inputbuffersize;
+#if !(WANT_CONCURRENT && CONCURRENT_PIPELINE)
   buffer                    inputbuffer;
 //u8                       *inputbuffer;             // Buffer for reading DataBlocks (chunksize)
+#endif
   size_t                    outputbufferalignment;
   size_t                    outputbuffersize;
   u8                       *outputbuffer;            // Buffer for writing DataBlocks (chunksize * missingblockcount)
   bool                      ignore16kfilehash;       // The 16k file hash values may be invalid
+
+#if WANT_CONCURRENT
+  std::vector<u32>         outputindexes_;                    // the index of each output block (0, 1, 2, ...)
+  std::vector<void*>       outputbuffers_;                    // where each output block is processed into
+  #if CONCURRENT_PIPELINE
+  std::vector<u8>          outputbuffer_element_initialised_; // whether each entry of outputbuffer contains data yet
+                                                              // (in the pipeline, only accessed by the task which
+                                                              // processes the entry's band)
+  #endif
+
+  unsigned                  concurrent_processing_level;
+  tbb::atomic<u32>          cout_in_use;             // when repairing, this is used to display % done w/o blocking a thread
+  tbb::tick_count           last_cout;   // when cout was used for output
+#endif
 };
 
 #endif // __PAR1REPAIRER_H__
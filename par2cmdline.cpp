@@ -110,6 +110,21 @@ int main(int argc, char *argv[])
       init.initialize();
 #endif
 
+    // Which Galois16 kernel to use for creating/repairing
+    const string &kernelname = commandline->GetKernelName();
+    if (!kernelname.empty() && !SelectGalois16Kernel(kernelname))
+    {
+      cerr << "Kernel not supported on this computer: " << kernelname << endl
+           << "Available kernels: auto " << AvailableGalois16Kernels() << endl;
+      return eInvalidCommandLineArguments;
+    }
+    if (commandline->GetNoiseLevel() > CommandLine::nlNormal)
+      cout << "Galois16 kernel: " << Galois16KernelName() << endl;
+#if HAVE_IO_ENGINE
+    if (commandline->GetNoiseLevel() > CommandLine::nlNormal)
+      cout << "Async I/O engine: " << io_engine::get().name() << endl;
+#endif
+
     // Which operation was selected
     switch (commandline->GetOperation())
     {
@@ -217,6 +217,12 @@ typedef unsigned long long u64;
 #  include <unistd.h>
 #endif
 
+#include <fcntl.h>
+
+#if HAVE_ERRNO_H
+#  include <errno.h>
+#endif
+
 #define _MAX_PATH 255
 
 #if HAVE_ENDIAN_H
@@ -242,8 +248,20 @@ typedef unsigned long long u64;
 #  endif
 #endif
 
+#if HAVE_LINUX_IO_URING_H && HAVE_ERRNO_H
+#  include <errno.h>
+#  include <assert.h>
+#  include <pthread.h>
+#  include <semaphore.h>
+#  include <deque>
+
+  #define HAVE_ASYNC_IO 1
+
+  // aiocb_type is implemented by the io_engine (see ioengine.h)
+  #define HAVE_IO_ENGINE 1
+
 // Using async I/O on FreeBSD causes a crash. Cause unknown.
-#if HAVE_AIO_H && HAVE_ERRNO_H && !defined(PLATFORM_FREEBSD)
+#elif HAVE_AIO_H && HAVE_ERRNO_H && !defined(PLATFORM_FREEBSD)
 #  include <errno.h>
 #  include <aio.h>
 #  include <assert.h>
@@ -432,6 +450,7 @@ typedef enum Result
 #include <ctype.h>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 
 #include <cassert>
 
@@ -458,11 +477,13 @@ using namespace std;
   #include "tbb/atomic.h"
   #include "tbb/concurrent_hash_map.h"
   #include "tbb/concurrent_vector.h"
+  #include "tbb/enumerable_thread_specific.h"
   #include "tbb/tick_count.h"
   #include "tbb/blocked_range.h"
   #include "tbb/parallel_for.h"
   #include "tbb/mutex.h"
   #include "tbb/pipeline.h"
+  #include "tbb/tbb_thread.h"
 
   class CTimeInterval {
   public:
@@ -496,6 +517,10 @@ using namespace std;
     #define CONCURRENT_PIPELINE 1
   #endif
 
+  #if HAVE_IO_ENGINE
+    #include "ioengine.h"
+  #endif
+
   enum { ALL_SERIAL, CHECKSUM_SERIALLY_BUT_PROCESS_CONCURRENTLY, ALL_CONCURRENT };
 #endif
 
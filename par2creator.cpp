@@ -76,6 +76,7 @@ record_type record_;
     public:
       create_pipeline_state(
         size_t                                     max_tokens,
+        size_t                                     batchsize,
         u64                                        chunksize,
         u32                                        missingblockcount,
         size_t                                     blocklength,
@@ -83,7 +84,7 @@ record_type record_;
         vector<DataBlock*>&                        inputblocks,
         vector<Par2CreatorSourceFile*>&            sourcefiles,
         bool                                       deferhashcomputation) :
-        pipeline_state<create_buffer>(max_tokens, chunksize, missingblockcount, blocklength, blockoffset, inputblocks),
+        pipeline_state<create_buffer>(max_tokens, batchsize, chunksize, missingblockcount, blocklength, blockoffset, inputblocks),
         sourcefiles_(sourcefiles), sourcefile_(sourcefiles.begin()), sourceindex_(0),
         deferhashcomputation_(deferhashcomputation) {}
 
@@ -120,7 +121,7 @@ record_type record_;
         if (a->second.first == ib->sourceindex_) {
 //printf("immed\n");
           for (bool ib_needs_releasing = false; ; ) {
-            ib->sourcefile_->UpdateHashes(ib->sourceindex_, ib->get(), blocklength());
+            ib->sourcefile_->UpdateHashes(ib->sourceindex_, ib->data(), blocklength());
 #ifndef NDEBUG
 {
 record_type::accessor ra;
@@ -262,6 +263,7 @@ Par2Creator::Par2Creator(void)
 
 #if WANT_CONCURRENT
 , concurrent_processing_level(ALL_CONCURRENT)
+, splitplanes(false)
 , last_cout(tbb::tick_count::now())
 #endif
 , create_dummy_par_files(false)
@@ -315,6 +317,7 @@ Result Par2Creator::Process(const CommandLine &commandline)
 
 #if WANT_CONCURRENT
   concurrent_processing_level = commandline.GetConcurrentProcessingLevel();
+  splitplanes = commandline.GetSplitPlanes();
   if (noiselevel > CommandLine::nlQuiet) {
     cout << "Processing ";
     if (ALL_SERIAL == concurrent_processing_level)
@@ -650,8 +653,8 @@ bool Par2Creator::CalculateProcessBlockSize(size_t memorylimit)
     // Would single pass processing use too much memory
     if (blocksize * recoveryblockcount > memorylimit)
     {
-      // Pick a size that is small enough
-      chunksize = ~3 & (memorylimit / recoveryblockcount);
+      // Pick a size that is small enough (and, for direct I/O, keeps the reads aligned)
+      chunksize = DiskFile::DirectIOChunkSize(~3 & (memorylimit / recoveryblockcount));
 
       deferhashcomputation = false;
     }
@@ -1258,8 +1261,13 @@ bool Par2Creator::AllocateBuffers(void)
   typedef __TBB_TypeWithAlignmentAtLeastAsStrict(u8) element_type;
   const size_t aligned_chunksize = (sizeof(u8)*(size_t)chunksize+sizeof(element_type)-1)/sizeof(element_type);
   aligned_chunksize_ = aligned_chunksize;
-  size_t sz = aligned_chunksize * recoveryblockcount;
-  outputbuffer = tbb::cache_aligned_allocator<u8>().allocate(sz);//new u8[sz];
+  // If all of the recovery data is computed in one pass, it can be computed straight
+  // into the recovery files rather than into a buffer from which it is written to them
+  if (chunksize != blocksize || !MapRecoveryPackets())
+  {
+    size_t sz = aligned_chunksize * recoveryblockcount;
+    outputbuffer = tbb::cache_aligned_allocator<u8>().allocate(sz);//new u8[sz];
+  }
 #else
   if (!inputbuffer.alloc(chunksize))
     return false;
@@ -1267,12 +1275,12 @@ bool Par2Creator::AllocateBuffers(void)
   outputbuffer = new u8[chunksize * recoveryblockcount];
 #endif
 
-#if (WANT_CONCURRENT && CONCURRENT_PIPELINE) || DSTOUT
-  outputbuffer_element_state_.resize(recoveryblockcount);
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  outputbuffer_element_initialised_.resize(recoveryblockcount);
 #endif
 
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE
-  if (outputbuffer == NULL)
+  if (outputbuffer == NULL && mappedoutput_.empty())
 #else
   if (/* inputbuffer == NULL || */ outputbuffer == NULL)
 #endif
@@ -1281,6 +1289,17 @@ bool Par2Creator::AllocateBuffers(void)
     return false;
   }
 
+#if WANT_CONCURRENT
+  // Each band of output blocks is processed in one call, so where each output block
+  // lies is looked up here once rather than for every batch of input blocks
+  outputindexes_.resize(recoveryblockcount);
+  outputbuffers_.resize(recoveryblockcount);
+  for (u32 i = 0; i != recoveryblockcount; ++i) {
+    outputindexes_[i] = i;
+    outputbuffers_[i] = OutputBufferAt(i);
+  }
+#endif
+
   return true;
 }
 
@@ -1298,6 +1317,9 @@ bool Par2Creator::ComputeRSMatrix(void)
     return false;
 
   // Compute the RS matrix
+#if WANT_CONCURRENT
+  rs.SetConcurrent(ALL_SERIAL != concurrent_processing_level);
+#endif
   if (!rs.Compute(noiselevel))
     return false;
 
@@ -1307,8 +1329,37 @@ bool Par2Creator::ComputeRSMatrix(void)
 
 #if WANT_CONCURRENT
 
+  #if CONCURRENT_PIPELINE
+bool Par2Creator::MapRecoveryPackets(void)
+{
+  std::vector<u8*> mappedoutput(recoveryblockcount);
+  for (u32 i = 0; i != recoveryblockcount; ++i)
+  {
+    DataBlock *datablock = recoverypackets[i].GetDataBlock();
+    u8 *mapping = datablock->GetDiskFile()->MapForWrite();
+    if (mapping == 0)
+    {
+      // (not in the mapped mode, or a file could not be mapped)
+      for (vector<DiskFile>::iterator recoveryfile = recoveryfiles.begin();
+           recoveryfile != recoveryfiles.end();
+           ++recoveryfile)
+        recoveryfile->Unmap();
+      return false;
+    }
+    mappedoutput[i] = &mapping[datablock->GetOffset()];
+  }
+
+  mappedoutput_.swap(mappedoutput);
+  return true;
+}
+  #endif
+
 void* Par2Creator::OutputBufferAt(u32 outputindex) {
   #if CONCURRENT_PIPELINE
+  // The recovery packet itself, if it is mapped
+  if (!mappedoutput_.empty())
+    return mappedoutput_[outputindex];
+
   // Select the appropriate part of the output buffer
   return &((u8*)outputbuffer)[aligned_chunksize_ * outputindex];
   #else
@@ -1317,31 +1368,37 @@ void* Par2Creator::OutputBufferAt(u32 outputindex) {
   #endif
 }
 
-bool Par2Creator::ProcessDataForOutputIndex_(u32 outputblock, u32 outputendblock, size_t blocklength,
-                                             u32 inputblock, buffer& inputbuffer)
+// Process the input blocks into the output blocks outputblock..outputendblock-1 using
+// one pass over the output. ProcessMultiple() keeps each tile of the input in the cache
+// for all of them. (In the pipeline, the batches are processed one at a time and each
+// band of output blocks by one task, so their buffers and flags need no lock.)
+void Par2Creator::ProcessDataForOutputIndex(u32 outputblock, u32 outputendblock, size_t blocklength, size_t datalength,
+                                            u32 inputcount, const u32 *inputblocks, buffer * const *inputbuffers)
 {
+    const u32 count = outputendblock - outputblock;
+    if (0 == count)
+      return;
+
+    // (the buffers of the output blocks were looked up by AllocateBuffers())
+    void * const *outbufs = &outputbuffers_[outputblock];
+
   #if CONCURRENT_PIPELINE
-    int val = (outputbuffer_element_state_[outputblock] -= 2); // 0 -> -2, 1 -> -1
-    if (val < -2) { // index is already in use: defer its processing
-      outputbuffer_element_state_[outputblock] += 2; // undo my changes
-//printf("deferring %u\n", outputblock);
-      return false;
-    }
-    assert(val == -2 || val == -1); // ie, hold lock
+    // the output buffer is not cleared before processing: the first input block
+    // processed into each output block overwrites it
+    u8 *initialised = &outputbuffer_element_initialised_[outputblock];
 
-    // Select the appropriate part of the output buffer
-    void *outbuf = OutputBufferAt(outputblock);//&((u8*)outputbuffer)[aligned_chunksize_ * outputblock];
-  #else
-    // Select the appropriate part of the output buffer
-    void *outbuf = OutputBufferAt(outputblock);//&((u8*)outputbuffer)[chunksize * outputblock];
-  #endif
+    // Only the first datalength bytes of the inputs are processed, so the rest of
+    // an output block which is about to be overwritten must be cleared
+    if (datalength < blocklength)
+      for (u32 i = 0; i != count; ++i)
+        if (!initialised[i])
+          memset((u8*) outbufs[i] + datalength, 0, blocklength - datalength);
 
     // Process the data through the RS matrix
-    rs.Process(blocklength, inputblock, inputbuffer, outputblock, outbuf);
-
-  #if CONCURRENT_PIPELINE
-    assert(val < 0);
-    outputbuffer_element_state_[outputblock] += 2; // undo my changes, ie, release lock
+    rs.ProcessMultiple(datalength, inputcount, inputblocks, inputbuffers, count, &outputindexes_[outputblock], outbufs, initialised);
+  #else
+    // Process the data through the RS matrix
+    rs.ProcessMultiple(datalength, inputcount, inputblocks, inputbuffers, count, &outputindexes_[outputblock], outbufs, NULL);
   #endif
 
     if (noiselevel > CommandLine::nlQuiet) {
@@ -1351,7 +1408,7 @@ bool Par2Creator::ProcessDataForOutputIndex_(u32 outputblock, u32 outputendblock
 // I believe it's a compiler codegen bug, but this work-around (using u64 instead of u32) is "good enough".
         // Update a progress indicator
         u64 oldfraction = (u64)(1000 * progress / totaldata);
-        progress += blocklength;
+        progress += (u64) blocklength * count * inputcount;
         u64 newfraction = (u64)(1000 * progress / totaldata);
 
         if (oldfraction != newfraction) {
@@ -1367,57 +1424,37 @@ bool Par2Creator::ProcessDataForOutputIndex_(u32 outputblock, u32 outputendblock
           }
         }
       } else
-        progress += blocklength;
-    }
-    return true;
-}
-
-void Par2Creator::ProcessDataForOutputIndex(u32 outputblock, u32 outputendblock, size_t blocklength,
-                                            u32 inputblock, buffer& inputbuffer)
-{
-  std::vector<u32> v; // which indexes need deferred processing
-  v.reserve(outputendblock - outputblock);
-
-  for( ; outputblock != outputendblock; ++outputblock )
-    if (!ProcessDataForOutputIndex_(outputblock, outputendblock, blocklength, inputblock, inputbuffer))
-      v.push_back(outputblock);
-
-  // try to process all deferred indexes
-  std::vector<u32> d;
-  do {
-    for (std::vector<u32>::const_iterator vit = v.begin(); vit != v.end(); ++vit) { // which indexes need deferred processing
-      const u32 oi = *vit;
-//printf("trying to process deferred %u\n", oi);
-      if (!ProcessDataForOutputIndex_(oi, outputendblock, blocklength, inputblock, inputbuffer)) {
-        d.push_back(oi); // failed -> try again
-      }
+        progress += (u64) blocklength * count * inputcount;
     }
-    v = d; d.clear();
-  } while (!v.empty());
 }
 
 class ApplyPar2CreatorRSProcess {
 public:
-  ApplyPar2CreatorRSProcess(Par2Creator* obj, size_t blocklength, u32 inputblock, buffer& inputbuffer) :
-    _obj(obj), _blocklength(blocklength), _inputblock(inputblock), _inputbuffer(inputbuffer) {}
+  ApplyPar2CreatorRSProcess(Par2Creator* obj, size_t blocklength, u32 inputcount, const u32 *inputblocks,
+                            buffer * const *inputbuffers) :
+    _obj(obj), _blocklength(blocklength), _inputcount(inputcount), _inputblocks(inputblocks),
+    _inputbuffers(inputbuffers) {}
   void operator()(const tbb::blocked_range<u32>& r) const {
-    _obj->ProcessDataForOutputIndex(r.begin(), r.end(), _blocklength, _inputblock, _inputbuffer);
+    _obj->ProcessDataForOutputIndex(r.begin(), r.end(), _blocklength, _blocklength, _inputcount, _inputblocks, _inputbuffers);
   }
 private:
-  Par2Creator* _obj;
-  size_t       _blocklength;
-  u32          _inputblock;
-  buffer&      _inputbuffer;
+  Par2Creator*    _obj;
+  size_t          _blocklength;
+  u32             _inputcount;
+  const u32      *_inputblocks;
+  buffer * const *_inputbuffers;
 };
 
-void Par2Creator::ProcessDataConcurrently(size_t blocklength, u32 inputblock, buffer& inputbuffer)
+// Process inputcount input blocks (inputblocks[i] is in inputbuffers[i]) into every output block.
+void Par2Creator::ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputblocks,
+                                          buffer * const *inputbuffers)
 {
   if (ALL_SERIAL != concurrent_processing_level) {
     static tbb::affinity_partitioner ap;
     tbb::parallel_for(tbb::blocked_range<u32>(0, recoveryblockcount),
-      ::ApplyPar2CreatorRSProcess(this, blocklength, inputblock, inputbuffer), ap);
+      ::ApplyPar2CreatorRSProcess(this, blocklength, inputcount, inputblocks, inputbuffers), ap);
   } else
-    ProcessDataForOutputIndex(0, recoveryblockcount, blocklength, inputblock, inputbuffer);
+    ProcessDataForOutputIndex(0, recoveryblockcount, blocklength, blocklength, inputcount, inputblocks, inputbuffers);
 }
 
 #endif
@@ -1429,14 +1466,10 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength)
 //CTimeInterval  ti_pdlo("ProcessDataLoopOuter");
 
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE
-  // Clear the output buffer
-  memset(outputbuffer, 0, aligned_chunksize_ * recoveryblockcount);
-
-  for (size_t i = 0; i != recoveryblockcount; ++i) {
-    // when outputbuffer_element_state_ contains tbb::atomic<> objects,
-    // they must be manually initialized to zero:
-    outputbuffer_element_state_[i] = 0;
-  }
+  // The output buffer is not cleared: instead each output block is overwritten by
+  // the first input block processed into it (see ProcessDataForOutputIndex)
+  for (size_t i = 0; i != recoveryblockcount; ++i)
+    outputbuffer_element_initialised_[i] = 0;
 
 //cout << "Creating using async I/O." << endl;
     assert(sourceblocks.size() == sourceblockcount);
@@ -1446,18 +1479,37 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength)
       sourceblocks_[i] = &sourceblocks[i];
 
     const size_t max_tokens = ALL_SERIAL == concurrent_processing_level ? 1 : tbb::task_scheduler_init::default_num_threads();
-    create_pipeline_state s(max_tokens, chunksize, recoveryblockcount, blocklength, blockoffset,
+    // Each extra input buffer costs as much memory as an output block, so don't
+    // batch more input blocks than there are output blocks.
+    const size_t batchsize = min((size_t) ReedSolomon<Galois16>::ProcessMultipleInputCount,
+                                 max((size_t) recoveryblockcount, (size_t) 1));
+    create_pipeline_state s(max_tokens, batchsize, chunksize, recoveryblockcount, blocklength, blockoffset,
                             sourceblocks_, sourcefiles, deferhashcomputation);
 
+    // Each input block is split into byte planes once, after it is read, unless its
+    // hashes have yet to be computed (which might happen after it has been split).
+    rs.SetSplitPlanes(splitplanes && !deferhashcomputation);
+
     tbb::pipeline p;
     create_filter_read cfr(s);
     p.add_filter(cfr);
     create_filter_process cfp(*this, s);
     p.add_filter(cfp);
+    p.add_filter(cfp.batch_stage());
     //create_filter_write cfw(*this, s);
     //p.add_filter(cfw);
 
     p.run(max_tokens);
+    cfp.flush();
+
+    // Clear any output block which no input block contributed to, and
+    // put the others back into the normal layout to be written out
+    for (u32 i = 0; i != recoveryblockcount; ++i)
+      if (!outputbuffer_element_initialised_[i])
+        memset(OutputBufferAt(i), 0, blocklength);
+      else
+        rs.FromSplitPlanes(OutputBufferAt(i), blocklength);
+    rs.SetSplitPlanes(false);
 
   #if GPGPU_CUDA
     if (rs.has_gpu()) {
@@ -1554,7 +1606,8 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength)
 
 //CTimeInterval  ti_pdli("ProcessDataLoopInner");
   #if WANT_CONCURRENT
-      ProcessDataConcurrently(blocklength, inputblock, inputbuffer);
+      buffer *pinputbuffer = &inputbuffer;
+      ProcessDataConcurrently(blocklength, 1, &inputblock, &pinputbuffer);
   #else
       // For each output block
       for (u32 outputblock=0; outputblock<recoveryblockcount; outputblock++)
@@ -1599,6 +1652,12 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength)
 
 //ti_pdlo.emit();
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // Mapped recovery packets already hold their data
+  if (!mappedoutput_.empty())
+    return true;
+#endif
+
   if (noiselevel > CommandLine::nlQuiet)
     cout << "Writing recovery packets\r";
 
@@ -1623,9 +1682,37 @@ bool Par2Creator::ProcessData(u64 blockoffset, size_t blocklength)
   return true;
 }
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+class ApplyRecoveryPacketUpdateHash {
+public:
+  ApplyRecoveryPacketUpdateHash(vector<RecoveryPacket>& recoverypackets, const vector<u8*>& data) :
+    _recoverypackets(recoverypackets), _data(data) {}
+  void operator()(const tbb::blocked_range<u32>& r) const {
+    for (u32 i = r.begin(); i != r.end(); ++i)
+      _recoverypackets[i].UpdateHash(_data[i], (size_t) _recoverypackets[i].BlockSize());
+  }
+private:
+  vector<RecoveryPacket>& _recoverypackets;
+  const vector<u8*>&      _data;
+};
+#endif
+
 // Finish computation of the recovery packets and write the headers to disk.
 bool Par2Creator::WriteRecoveryPacketHeaders(void)
 {
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // The hashes of mapped recovery packets have yet to include their data, which
+  // is hashed where it lies (for each packet independently of the others)
+  if (!mappedoutput_.empty())
+  {
+    if (ALL_SERIAL != concurrent_processing_level)
+      tbb::parallel_for(tbb::blocked_range<u32>(0, recoveryblockcount),
+        ::ApplyRecoveryPacketUpdateHash(recoverypackets, mappedoutput_));
+    else
+      ::ApplyRecoveryPacketUpdateHash(recoverypackets, mappedoutput_)(tbb::blocked_range<u32>(0, recoveryblockcount));
+  }
+#endif
+
   // For each recovery packet
   for (vector<RecoveryPacket>::iterator recoverypacket = recoverypackets.begin();
        recoverypacket != recoverypackets.end();
@@ -1711,6 +1798,7 @@ bool Par2Creator::CloseFiles(void)
        recoveryfile != recoveryfiles.end();
        ++recoveryfile)
   {
+    recoveryfile->Unmap();
     recoveryfile->Close();
   }
 
@@ -50,14 +50,20 @@ protected:
 
 #if WANT_CONCURRENT
 public:
-  void ProcessDataForOutputIndex(u32 outputstartindex, u32 outputendindex, size_t blocklength, u32 inputblock, buffer& ib);
-  void ProcessDataConcurrently(size_t blocklength, u32 inputblock, buffer& ib);
+  void ProcessDataForOutputIndex(u32 outputstartindex, u32 outputendindex, size_t blocklength, size_t datalength,
+                                 u32 inputcount, const u32 *inputblocks, buffer * const *inputbuffers);
+  void ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputblocks, buffer * const *inputbuffers);
+  const ReedSolomon<Galois16>& GetReedSolomon(void) const { return rs; }
   #if WANT_CONCURRENT_PAR2_FILE_OPENING
   Par2CreatorSourceFile* OpenSourceFile(const CommandLine::ExtraFile &extrafile);
   #endif
 protected:
   void* OutputBufferAt(u32 outputindex);
-  bool ProcessDataForOutputIndex_(u32 outputblock, u32 outputendblock, size_t blocklength, u32 inputblock, buffer& ib);
+  #if CONCURRENT_PIPELINE
+  // In the mapped mode, map the recovery files so that the recovery data can be
+  // computed where it lies in their recovery packets
+  bool MapRecoveryPackets(void);
+  #endif
 #endif
 
   // Compute block size from block count or vice versa depending on which was
@@ -157,11 +163,15 @@ protected:
   ReedSolomon<Galois16> rs;   // The Reed Solomon matrix.
 
 #if WANT_CONCURRENT
+  std::vector<u32>         outputindexes_;                    // the index of each output block (0, 1, 2, ...)
+  std::vector<void*>       outputbuffers_;                    // where each output block is processed into
   #if CONCURRENT_PIPELINE
-  // low bit: which half of each entry in outputbuffer contains valid data (if DSTOUT is 1)
-  // high bit: whether entry in outputbuffer is in use (0 = available, 1 = in-use)
-  std::vector< tbb::atomic<int> > outputbuffer_element_state_; // state of each entry of outputbuffer
+  std::vector<u8>          outputbuffer_element_initialised_; // whether each entry of outputbuffer contains data yet
+                                                              // (in the pipeline, only accessed by the task which
+                                                              // processes the entry's band)
   size_t                   aligned_chunksize_;
+  std::vector<u8*>         mappedoutput_; // if not empty then where the data of each recovery packet
+                                          // lies in the mapping of its file (used instead of outputbuffer)
   #else
   buffer                    inputbuffer;
 //void                     *inputbuffer;             // Buffer for reading DataBlocks (chunksize)
@@ -193,6 +203,7 @@ protected:
 
 #if WANT_CONCURRENT
   unsigned                  concurrent_processing_level;
+  bool                      splitplanes; // whether to process the data in the split-plane layout
   tbb::mutex                cout_mutex;
   tbb::atomic<u32>          cout_in_use; // this is used to display % done w/o blocking a thread
   tbb::tick_count           last_cout;   // when cout was used for output
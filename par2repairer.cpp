@@ -42,6 +42,7 @@
       friend class repair_filter_read;
       vector<DataBlock*>::iterator copyblock_;
       bool                         copyblock_not_at_end_;
+      bool                         copyblock_copied_;
     };
 
     class repair_pipeline_state : public pipeline_state<repair_buffer> {
@@ -49,36 +50,42 @@
       friend class repair_filter_read;
       vector<DataBlock*>&                          copyblocks_;
       vector<DataBlock*>::iterator                 copyblock_;
+      vector<DataBlock*>::iterator                 copied_;     // end of the blocks copied while solving
     public:
       repair_pipeline_state(
         size_t                                     max_tokens,
+        size_t                                     batchsize,
         u64                                        chunksize,
         u32                                        missingblockcount,
         size_t                                     blocklength,
         u64                                        blockoffset,
         vector<DataBlock*>&                        inputblocks,
-        vector<DataBlock*>&                        copyblocks) :
-        pipeline_state<repair_buffer>(max_tokens, chunksize, missingblockcount, blocklength, blockoffset, inputblocks),
-        copyblocks_(copyblocks), copyblock_(copyblocks.begin()) {}
+        vector<DataBlock*>&                        copyblocks,
+        u32                                        copiedblockcount) :
+        pipeline_state<repair_buffer>(max_tokens, batchsize, chunksize, missingblockcount, blocklength, blockoffset, inputblocks),
+        copyblocks_(copyblocks), copyblock_(copyblocks.begin()), copied_(copyblocks.begin() + copiedblockcount) {}
     };
 
     class repair_filter_read : public filter_read_base<repair_filter_read, repair_buffer> {
     public:
-      repair_filter_read(repair_pipeline_state& s) : filter_read_base<repair_filter_read, repair_buffer>(s) {}
+      repair_filter_read(repair_pipeline_state& s, Par2Repairer& obj) :
+        filter_read_base<repair_filter_read, repair_buffer>(s), obj_(obj) {}
 
       void on_mutex_held(repair_buffer* ib) {
         repair_pipeline_state& s = static_cast<repair_pipeline_state&> (state_);
         ib->copyblock_ = s.copyblock_; //copyblock_ = s.copyblock_;
         ib->copyblock_not_at_end_ = s.copyblock_ != s.copyblocks_.end(); //copyblock_not_at_end_ = copyblock_ != s.copyblocks_.end();
+        ib->copyblock_copied_ = s.copyblock_ < s.copied_;
         if (ib->copyblock_not_at_end_)
           ++s.copyblock_;
       }
 
       bool on_inputbuffer_read(repair_buffer* ib) {
-        // Have we reached the last source data block
-        if (ib->copyblock_not_at_end_) {
-          // Does this block need to be copied to the target file
-          if ((*ib->copyblock_)->IsSet()) {
+        // Have we reached the last source data block (or was this one copied already)
+        if (ib->copyblock_not_at_end_ && !ib->copyblock_copied_) {
+          // Does this block need to be copied to the target file (a short block at the
+          // end of a file has nothing to copy in the later chunks of a multi-pass repair)
+          if ((*ib->copyblock_)->IsSet() && state_.blockoffset() < (*ib->copyblock_)->GetLength()) {
 //DiskFile* df = (*copyblock)->GetDiskFile();
 //printf("%p: start async write to %s\n", pthread_self(), df->FileName().c_str());
             // Write the block back to disk in the new target file
@@ -91,7 +98,7 @@
 printf("writing off=%llu len=%lu\n", (*ib->copyblock_)->GetOffset() + state_.blockoffset(), state_.blocklength());
 if (102388 == (*ib->copyblock_)->GetOffset()) {
   for (unsigned i = 0; i != state_.blocklength(); ++i)
-    printf("%02x ", ((const unsigned char*) ib->get())[i]);
+    printf("%02x ", ((const unsigned char*) ib->data())[i]);
   printf("\n");
 }
 #endif
@@ -99,22 +106,26 @@ if (102388 == (*ib->copyblock_)->GetOffset()) {
 #if 0
 // used to debug the problem where the last byte of the file was not being written to - the bug fix is
 // in diskfile.cpp: DiskFile::Create()
-            if (!(*ib->copyblock_)->WriteData(state_.blockoffset(), state_.blocklength(), ib->get(), wrote))
+            if (!(*ib->copyblock_)->WriteData(state_.blockoffset(), state_.blocklength(), ib->data(), wrote))
               return false;
 #else
             if (!(*ib->copyblock_)->WriteDataAsync(ib->get_aiocb(), state_.blockoffset(),
-                                                   state_.blocklength(), ib->get(), wrote)) {
+                                                   state_.blocklength(), ib->data(), wrote)) {
               return false;
             }
 
             ib->set_write_status(pipeline_buffer::ASYNC_WRITE);
 #endif
+            obj_.StreamTargetData(*ib->copyblock_, state_.blockoffset(), ib->data(), wrote);
             state_.add_to_totalwritten(wrote);
           }
           //++copyblock;
         }
         return true;
       }
+
+    private:
+      Par2Repairer& obj_;
     };
 
     class repair_filter_process : public filter_process_base<repair_filter_process, repair_buffer, Par2Repairer> {
@@ -147,6 +158,10 @@ Par2Repairer::Par2Repairer(void)
 
   availableblockcount = 0;
   missingblockcount = 0;
+  copiedblockcount = 0;
+  outputblockcount = 0;
+
+  inplace = false;
 
   completefilecount = 0;
   renamedfilecount = 0;
@@ -163,13 +178,22 @@ Par2Repairer::Par2Repairer(void)
 
 #if WANT_CONCURRENT
   concurrent_processing_level = ALL_CONCURRENT;
+  numthreads = 0;
+  splitplanes = false;
   cout_in_use = 0;
   last_cout = tbb::tick_count::now();
+  rssolver = 0;
+  rssolvestate = 0;
 #endif
 }
 
 Par2Repairer::~Par2Repairer(void)
 {
+  WaitForRSmatrix();
+
+  for (map<Par2RepairerSourceFile*,DiskFile*>::iterator pf = patchfiles.begin(); pf != patchfiles.end(); ++pf)
+    delete pf->second;
+
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
   cuda::DeallocateResources();
 #endif
@@ -214,8 +238,13 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
   // What noiselevel are we using
   noiselevel = commandline.GetNoiseLevel();
 
+  matrixcachedir = commandline.GetMatrixCacheDirectory();
+  inplace = commandline.GetInPlaceRepair();
+
 #if WANT_CONCURRENT
   concurrent_processing_level = commandline.GetConcurrentProcessingLevel();
+  numthreads = (int) commandline.GetNumThreads();
+  splitplanes = commandline.GetSplitPlanes();
   if (noiselevel > CommandLine::nlQuiet) {
     cout << "Processing ";
     if (ALL_SERIAL == concurrent_processing_level)
@@ -267,6 +296,15 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
   if (!AllocateSourceBlocks())
     return eLogicError;
 
+  // Find the files which are to be repaired, if not all of them
+  if (!SelectOnlyFiles(commandline.GetOnlyFiles()))
+    return eInvalidCommandLineArguments;
+
+  // Put back the data of any file whose in-place repair was interrupted,
+  // so that it is verified as it was before
+  if (dorepair && !RollbackJournals())
+    return eFileIOError;
+
   // Create a verification hash table for all files for which we have not
   // found a complete version of the file and for which we have
   // a verification packet
@@ -323,40 +361,50 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
       if (!RenameTargetFiles())
         return eFileIOError;
 
-      // Are we still missing any files
-      if (completefilecount<mainpacket->RecoverableFileCount())
+      // Are we still missing any files (that are to be repaired)
+      if (!TargetFilesComplete())
       {
-        // Work out which files are being repaired, create them, and allocate
-        // target DataBlocks to them, and remember them for later verification.
-        if (!CreateTargetFiles())
-          return eFileIOError;
-
         // Work out which data blocks are available, which need to be copied
         // directly to the output, and which need to be recreated, and compute
-        // the appropriate Reed Solomon matrix.
+        // the appropriate Reed Solomon matrix (which does not need the target
+        // files, so when processing concurrently they are created, and intact
+        // blocks copied to them, while it is being computed).
         if (!ComputeRSmatrix())
+          return eFileIOError;
+
+        // Work out which files are being repaired, create them, and allocate
+        // target DataBlocks to them, and remember them for later verification.
+        if (!CreateTargetFiles())
         {
-          // Delete all of the partly reconstructed files
-          DeleteIncompleteTargetFiles();
+          WaitForRSmatrix();
           return eFileIOError;
         }
 
-        if (noiselevel > CommandLine::nlSilent)
-          cout << endl;
-
         // Allocate memory buffers for reading and writing data to disk.
         if (!AllocateBuffers(commandline.GetMemoryLimit()))
         {
+          WaitForRSmatrix();
           // Delete all of the partly reconstructed files
           DeleteIncompleteTargetFiles();
           return eMemoryError;
         }
 
+        if (!CopyBlocksWhileSolving() || !WaitForRSmatrix())
+        {
+          WaitForRSmatrix();
+          // Delete all of the partly reconstructed files
+          DeleteIncompleteTargetFiles();
+          return eFileIOError;
+        }
+
+        if (noiselevel > CommandLine::nlSilent)
+          cout << endl;
+
 //CTimeInterval  ti_repair("Repair");
 
         // Set the total amount of data to be processed.
         progress = 0;
-        totaldata = blocksize * sourceblockcount * (missingblockcount > 0 ? missingblockcount : 1);
+        totaldata = blocksize * sourceblockcount * (outputblockcount > 0 ? outputblockcount : 1);
 //gti = 0;
         // Start at an offset of 0 within a block.
         u64 blockoffset = 0;
@@ -398,7 +446,7 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
       }
 
       // Are all of the target files now complete?
-      if (completefilecount<mainpacket->RecoverableFileCount())
+      if (!TargetFilesComplete())
       {
         cerr << "Repair Failed." << endl;
         return eRepairFailed;
@@ -406,7 +454,12 @@ Result Par2Repairer::Process(const CommandLine &commandline, bool dorepair)
       else
       {
         if (noiselevel > CommandLine::nlSilent)
+        {
           cout << endl << "Repair complete." << endl;
+          if (completefilecount<mainpacket->RecoverableFileCount())
+            cout << mainpacket->RecoverableFileCount() - completefilecount
+                 << " other file(s) were not repaired." << endl;
+        }
       }
     }
     else
@@ -2374,6 +2427,69 @@ bool Par2Repairer::CheckVerificationResults(void)
   return true;
 }
 
+// Find the source files which are the only ones to be repaired
+bool Par2Repairer::SelectOnlyFiles(const list<string> &filenames)
+{
+  for (list<string>::const_iterator fn = filenames.begin(); fn != filenames.end(); ++fn)
+  {
+    Par2RepairerSourceFile *sourcefile = 0;
+
+    u32 filenumber = 0;
+    vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin();
+
+    // Only the recoverable files can be repaired
+    while (sf != sourcefiles.end() && filenumber < mainpacket->RecoverableFileCount())
+    {
+#if defined(WIN32) || defined(__APPLE__)
+      if (*sf && 0 == stricmp((*sf)->TargetFileName().c_str(), fn->c_str()))
+#else
+      if (*sf && (*sf)->TargetFileName() == *fn)
+#endif
+      {
+        sourcefile = *sf;
+        break;
+      }
+
+      ++sf;
+      ++filenumber;
+    }
+
+    if (sourcefile == 0)
+    {
+      cerr << "Not a recoverable file of the recovery set: "
+           << utf8_string_to_cout_parameter(CommandLine::FileOrPathForCout(*fn)) << endl;
+      return false;
+    }
+
+    if (find(onlyfiles.begin(), onlyfiles.end(), sourcefile) == onlyfiles.end())
+      onlyfiles.push_back(sourcefile);
+  }
+
+  return true;
+}
+
+// Whether the source file is to be repaired (if it is damaged or missing)
+bool Par2Repairer::IsRepairTarget(Par2RepairerSourceFile *sourcefile) const
+{
+  return onlyfiles.empty() || find(onlyfiles.begin(), onlyfiles.end(), sourcefile) != onlyfiles.end();
+}
+
+// Whether all of the files which are to be repaired are complete
+bool Par2Repairer::TargetFilesComplete(void)
+{
+  if (onlyfiles.empty())
+    return completefilecount >= mainpacket->RecoverableFileCount();
+
+  for (vector<Par2RepairerSourceFile*>::const_iterator sf = onlyfiles.begin(); sf != onlyfiles.end(); ++sf)
+  {
+    // Is there a complete version of the file, with the right name
+    if ((*sf)->GetCompleteFile() == 0 || (*sf)->GetCompleteFile() != (*sf)->GetTargetFile())
+      return false;
+  }
+
+  return true;
+}
+
 // Rename any damaged or missnamed target files.
 bool Par2Repairer::RenameTargetFiles(void)
 {
@@ -2386,11 +2502,23 @@ bool Par2Repairer::RenameTargetFiles(void)
     Par2RepairerSourceFile *sourcefile = *sf;
 
     // If the target file exists but is not a complete version of the file
+    // (and it is to be repaired)
     if (sourcefile->GetTargetExists() && 
-        sourcefile->GetTargetFile() != sourcefile->GetCompleteFile())
+        sourcefile->GetTargetFile() != sourcefile->GetCompleteFile() &&
+        IsRepairTarget(sourcefile))
     {
       DiskFile *targetfile = sourcefile->GetTargetFile();
 
+      // Leave it where it is if only its damaged blocks are to be written
+      if (CanRepairInPlace(sourcefile))
+      {
+        patchfiles[sourcefile] = 0;
+
+        ++sf;
+        ++filenumber;
+        continue;
+      }
+
       // Rename it
       diskFileMap.Remove(targetfile);
 
@@ -2455,6 +2583,295 @@ bool Par2Repairer::RenameTargetFiles(void)
   return true;
 }
 
+// Whether the damaged target file of the source file can be repaired in place,
+// by writing just the blocks which were not found where they belong in it.
+bool Par2Repairer::CanRepairInPlace(Par2RepairerSourceFile *sourcefile)
+{
+  if (!inplace || sourcefile->BlockCount() == 0)
+    return false;
+
+  // The file must have the right length
+  DiskFile *targetfile = sourcefile->GetTargetFile();
+  if (targetfile->FileSize() != sourcefile->GetDescriptionPacket()->FileSize())
+    return false;
+
+  // and every block found in it must be where it belongs (otherwise writing
+  // the other blocks might overwrite one before it has been read)
+  const u32 first = (u32)(sourcefile->SourceBlocks() - sourceblocks.begin());
+  for (u32 blocknumber=0; blocknumber<sourceblockcount; blocknumber++)
+  {
+    const DataBlock &sourceblock = sourceblocks[blocknumber];
+
+    if (sourceblock.IsSet() && sourceblock.GetDiskFile() == targetfile &&
+        (blocknumber < first || blocknumber >= first + sourcefile->BlockCount() ||
+         sourceblock.GetOffset() != (u64)(blocknumber - first) * blocksize))
+      return false;
+  }
+
+  return true;
+}
+
+// The header of a repair journal, which is followed by the ranges of the file
+// which are overwritten, and then by the original data of each range.
+struct REPAIR_JOURNAL_HEADER
+{
+  u8      magic[8];  // "PAR2JNL\0"
+  u64     filesize;  // Size of the file being repaired
+  u64     size;      // Size of what follows the header
+  u32     count;     // Number of ranges
+  u32     reserved;
+  MD5Hash hash;      // MD5 hash of what follows the header
+};
+
+struct REPAIR_JOURNAL_RANGE
+{
+  u64     offset;
+  u64     length;
+};
+
+static const u8 repair_journal_magic[8] = {'P', 'A', 'R', '2', 'J', 'N', 'L', '\0'};
+
+// How much of the journal is copied at a time
+static const size_t repair_journal_chunksize = 1048576;
+
+string Par2Repairer::JournalFileName(const string &filename)
+{
+  return filename + ".par2journal";
+}
+
+// Save the data which repairing a file in place will overwrite (the target
+// DataBlocks of the file which have been allocated) to a journal. The journal
+// is on the disk before the file is changed, so if the repair is interrupted
+// the file can always be put back as it was.
+bool Par2Repairer::WriteJournal(Par2RepairerSourceFile *sourcefile)
+{
+  const string filename = sourcefile->TargetFileName();
+
+  // The ranges of the file which will be written
+  vector<REPAIR_JOURNAL_RANGE> ranges;
+  u64 datasize = 0;
+
+  vector<DataBlock>::iterator tb = sourcefile->TargetBlocks();
+  for (u32 blocknumber=0; blocknumber<sourcefile->BlockCount(); ++blocknumber, ++tb)
+  {
+    if (tb->IsSet())
+    {
+      REPAIR_JOURNAL_RANGE range = {tb->GetOffset(), tb->GetLength()};
+      ranges.push_back(range);
+      datasize += range.length;
+    }
+  }
+
+  const size_t rangesize = ranges.size() * sizeof(REPAIR_JOURNAL_RANGE);
+
+  REPAIR_JOURNAL_HEADER header;
+  memcpy(header.magic, repair_journal_magic, sizeof(header.magic));
+  header.filesize = sourcefile->GetTargetFile()->FileSize();
+  header.size = rangesize + datasize;
+  header.count = (u32)ranges.size();
+  header.reserved = 0;
+
+  string journalname = JournalFileName(filename);
+  DiskFile journal;
+  if (!journal.Create(journalname, sizeof(header) + header.size))
+    return false;
+
+  MD5Context context;
+  bool success = true;
+  if (rangesize > 0)
+  {
+    context.Update(&ranges[0], rangesize);
+    success = journal.Write(sizeof(header), &ranges[0], rangesize);
+  }
+
+  // Copy the original data of each range
+  DiskFile original;
+  success = success && original.Open(filename);
+
+  vector<u8> data((size_t)min(blocksize, (u64)repair_journal_chunksize));
+  u64 position = sizeof(header) + rangesize;
+
+  for (vector<REPAIR_JOURNAL_RANGE>::const_iterator range = ranges.begin();
+       success && range != ranges.end();
+       ++range)
+  {
+    for (u64 done = 0; success && done < range->length; )
+    {
+      size_t length = (size_t)min((u64)data.size(), range->length - done);
+
+      success = original.Read(range->offset + done, &data[0], length) &&
+                journal.Write(position, &data[0], length);
+      context.Update(&data[0], length);
+
+      position += length;
+      done += length;
+    }
+  }
+  original.Close();
+
+  // The header is written last, so that the journal is only valid once all of it is there
+  context.Final(header.hash);
+  success = success &&
+            journal.Write(0, &header, sizeof(header)) &&
+            journal.Flush();
+  journal.Close();
+
+  if (!success)
+  {
+    journal.Delete();
+    cerr << "Could not write the repair journal: " << journalname << endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Put the data which an in-place repair of the file overwrote back from its
+// journal, and delete the journal.
+bool Par2Repairer::RollbackJournal(const string &filename)
+{
+  string journalname = JournalFileName(filename);
+  DiskFile journal;
+  if (!journal.Open(journalname))
+  {
+    cerr << "Could not open the repair journal: " << journalname << endl;
+    return false;
+  }
+
+  REPAIR_JOURNAL_HEADER header;
+  vector<REPAIR_JOURNAL_RANGE> ranges;
+  bool valid = journal.FileSize() >= sizeof(header) &&
+               journal.Read(0, &header, sizeof(header)) &&
+               0 == memcmp(header.magic, repair_journal_magic, sizeof(header.magic)) &&
+               header.size == journal.FileSize() - sizeof(header) &&
+               (u64)header.count * sizeof(REPAIR_JOURNAL_RANGE) <= header.size;
+
+  const size_t rangesize = valid ? header.count * sizeof(REPAIR_JOURNAL_RANGE) : 0;
+  if (valid && rangesize > 0)
+  {
+    ranges.resize(header.count);
+    valid = journal.Read(sizeof(header), &ranges[0], rangesize);
+  }
+
+  // Check that all of the journal was written (if it was not, then the
+  // file was not changed either)
+  vector<u8> data(repair_journal_chunksize);
+  if (valid)
+  {
+    MD5Context context;
+    if (rangesize > 0)
+      context.Update(&ranges[0], rangesize);
+
+    for (u64 position = sizeof(header) + rangesize; valid && position < journal.FileSize(); )
+    {
+      size_t length = (size_t)min((u64)data.size(), journal.FileSize() - position);
+
+      valid = journal.Read(position, &data[0], length);
+      context.Update(&data[0], length);
+
+      position += length;
+    }
+
+    MD5Hash hash;
+    context.Final(hash);
+    valid = valid && hash == header.hash;
+  }
+
+  // and that the ranges are those of the file
+  u64 datasize = 0;
+  for (vector<REPAIR_JOURNAL_RANGE>::const_iterator range = ranges.begin(); valid && range != ranges.end(); ++range)
+  {
+    valid = range->offset <= header.filesize && range->length <= header.filesize - range->offset;
+    datasize += range->length;
+  }
+  valid = valid && rangesize + datasize == header.size;
+
+  if (!valid)
+  {
+    journal.Close();
+
+    if (noiselevel > CommandLine::nlSilent)
+      cout << "Deleting an incomplete repair journal: " << journalname << endl;
+
+    return journal.Delete();
+  }
+
+  // Put the original data back
+  DiskFile target;
+  if (!target.OpenForWriting(filename))
+  {
+    journal.Close();
+    return false;
+  }
+  if (target.FileSize() != header.filesize)
+  {
+    target.Close();
+    journal.Close();
+
+    cerr << "The size of " << filename << " does not match its repair journal: " << journalname << endl;
+    return false;
+  }
+
+  bool success = true;
+  u64 position = sizeof(header) + rangesize;
+
+  for (vector<REPAIR_JOURNAL_RANGE>::const_iterator range = ranges.begin();
+       success && range != ranges.end();
+       ++range)
+  {
+    for (u64 done = 0; success && done < range->length; )
+    {
+      size_t length = (size_t)min((u64)data.size(), range->length - done);
+
+      success = journal.Read(position, &data[0], length) &&
+                target.Write(range->offset + done, &data[0], length);
+
+      position += length;
+      done += length;
+    }
+  }
+
+  success = success && target.Flush();
+  target.Close();
+  journal.Close();
+
+  if (!success)
+  {
+    cerr << "Could not put back the original data of " << filename << " from its repair journal." << endl;
+    return false;
+  }
+
+  if (noiselevel > CommandLine::nlSilent)
+  {
+    string name(utf8_string_to_cout_parameter(CommandLine::FileOrPathForCout(filename)));
+    cout << "Put back " << datasize << " bytes of \"" << name << "\" from its repair journal." << endl;
+  }
+
+  return journal.Delete();
+}
+
+// Put back the data of any file whose in-place repair was interrupted.
+bool Par2Repairer::RollbackJournals(void)
+{
+  u32 filenumber = 0;
+  vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin();
+
+  while (sf != sourcefiles.end() && filenumber < mainpacket->RecoverableFileCount())
+  {
+    Par2RepairerSourceFile *sourcefile = *sf;
+
+    if (sourcefile &&
+        DiskFile::FileExists(JournalFileName(sourcefile->TargetFileName())) &&
+        !RollbackJournal(sourcefile->TargetFileName()))
+      return false;
+
+    ++sf;
+    ++filenumber;
+  }
+
+  return true;
+}
+
 // Work out which files are being repaired, create them, and allocate
 // target DataBlocks to them, and remember them for later verification.
 bool Par2Repairer::CreateTargetFiles(void)
@@ -2462,13 +2879,17 @@ bool Par2Repairer::CreateTargetFiles(void)
   u32 filenumber = 0;
   vector<Par2RepairerSourceFile*>::iterator sf = sourcefiles.begin();
 
+  // Nothing has been written to any of the target DataBlocks yet
+  targetblockcontexts.assign(targetblocks.size(), MD5Context());
+  targetblockcrcs.assign(targetblocks.size(), 0);
+
   // Create any missing target files
   while (sf != sourcefiles.end() && filenumber < mainpacket->TotalFileCount())
   {
     Par2RepairerSourceFile *sourcefile = *sf;
 
-    // If the file does not exist
-    if (!sourcefile->GetTargetExists())
+    // If the file does not exist (and it is to be repaired)
+    if (!sourcefile->GetTargetExists() && IsRepairTarget(sourcefile))
     {
       DiskFile *targetfile = new DiskFile;
       string filename = sourcefile->TargetFileName();
@@ -2512,6 +2933,9 @@ bool Par2Repairer::CreateTargetFiles(void)
         ++tb;
       }
 
+      // Hash the data written to it, in case it is written in order
+      targetfilecontexts.insert(make_pair(targetfile, MD5Context()));
+
       // Add the file to the list of those that will need to be verified
       // once the repair has completed.
       verifylist.push_back(sourcefile);
@@ -2521,9 +2945,83 @@ bool Par2Repairer::CreateTargetFiles(void)
     ++filenumber;
   }
 
+  // Allocate the target DataBlocks of the files which are repaired in place
+  // to those parts of them which have to be written, save the data there to
+  // a journal, and then open them for writing
+  for (map<Par2RepairerSourceFile*,DiskFile*>::iterator pf = patchfiles.begin(); pf != patchfiles.end(); ++pf)
+  {
+    Par2RepairerSourceFile *sourcefile = pf->first;
+    DiskFile *targetfile = sourcefile->GetTargetFile();
+    DiskFile *patchfile = pf->second = new DiskFile;
+    u64 filesize = sourcefile->GetDescriptionPacket()->FileSize();
+
+    u64 offset = 0;
+    vector<DataBlock>::iterator sb = sourcefile->SourceBlocks();
+    vector<DataBlock>::iterator tb = sourcefile->TargetBlocks();
+
+    while (offset < filesize)
+    {
+      // Was this block not found where it belongs
+      if (!sb->IsSet() || sb->GetDiskFile() != targetfile)
+      {
+        tb->SetLocation(patchfile, offset);
+        tb->SetLength(min(blocksize, filesize-offset));
+      }
+
+      offset += blocksize;
+      ++sb;
+      ++tb;
+    }
+
+    if (!WriteJournal(sourcefile))
+      return false;
+
+    // Add the file to the list of those that will need to be verified
+    // (or put back as they were) once the repair has completed.
+    verifylist.push_back(sourcefile);
+
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+    if (!patchfile->OpenForWriting(targetfile->FileName(), true))
+#else
+    if (!patchfile->OpenForWriting(targetfile->FileName()))
+#endif
+      return false;
+
+    if (noiselevel > CommandLine::nlQuiet)
+    {
+      string name(utf8_string_to_cout_parameter(CommandLine::FileOrPathForCout(targetfile->FileName())));
+      cout << "Repairing \"" << name << "\" in place." << endl;
+    }
+  }
+
   return true;
 }
 
+#if WANT_CONCURRENT
+class RSmatrixSolver {
+public:
+  RSmatrixSolver(Par2Repairer* obj) : _obj(obj) {}
+  void operator()() const { _obj->SolveRSmatrix(); }
+private:
+  Par2Repairer* _obj;
+};
+
+void Par2Repairer::SolveRSmatrix(void)
+{
+  // A thread started with tbb_thread has no task scheduler of its own (and TBB 2.1
+  // does not create one for it), so create one with the number of threads the main
+  // thread uses, for the parallel_for calls in Compute().
+  tbb::task_scheduler_init init(numthreads > 0 ? numthreads : tbb::task_scheduler_init::automatic);
+
+  // The main thread prints while the matrix is being solved, so what this thread
+  // would print is kept for WaitForRSmatrix() to print instead (without the progress
+  // of the solve, which Compute() only shows when printing to cout).
+  rssolvestate = rs.Compute(noiselevel, rssolveoutput, rssolveerrors) ? 1 : -1;
+  if (rssolvestate > 0)
+    SaveRSmatrix(rssolveoutput);
+}
+#endif
+
 // Work out which data blocks are available, which need to be copied
 // directly to the output, and which need to be recreated, and compute
 // the appropriate Reed Solomon matrix.
@@ -2531,16 +3029,31 @@ bool Par2Repairer::ComputeRSmatrix(void)
 {
   inputblocks.resize(sourceblockcount);   // The DataBlocks that will read from disk
   copyblocks.resize(availableblockcount); // Those DataBlocks which need to be copied
-  outputblocks.resize(missingblockcount); // Those DataBlocks that will re recalculated
+  outputblocks.clear();                   // Those DataBlocks that will re recalculated
+  outputrows.clear();
 
   vector<DataBlock*>::iterator inputblock  = inputblocks.begin();
   vector<DataBlock*>::iterator copyblock   = copyblocks.begin();
-  vector<DataBlock*>::iterator outputblock = outputblocks.begin();
 
   // Build an array listing which source data blocks are present and which are missing
   vector<bool> present;
   present.resize(sourceblockcount);
 
+  // and which of the missing ones are to be recalculated (only those of the
+  // files which are to be repaired: the RS matrix has a row for each of them
+  // all the same, but the other rows are not used)
+  vector<bool> wanted(sourceblockcount, onlyfiles.empty());
+  for (vector<Par2RepairerSourceFile*>::const_iterator sf = onlyfiles.begin(); sf != onlyfiles.end(); ++sf)
+  {
+    if ((*sf)->BlockCount() > 0)
+    {
+      vector<bool>::iterator w = wanted.begin() + ((*sf)->TargetBlocks() - targetblocks.begin());
+      fill(w, w + (*sf)->BlockCount(), true);
+    }
+  }
+  vector<bool>::iterator want = wanted.begin();
+  u32 outputrow = 0;
+
   vector<DataBlock>::iterator sourceblock  = sourceblocks.begin();
   vector<DataBlock>::iterator targetblock  = targetblocks.begin();
   vector<bool>::iterator              pres = present.begin();
@@ -2572,31 +3085,48 @@ bool Par2Repairer::ComputeRSmatrix(void)
       *pres = false;
 
       // Add the block to the list of those to be written
-      *outputblock = &*targetblock;
-      ++outputblock;
+      if (*want)
+      {
+        outputblocks.push_back(&*targetblock);
+        outputrows.push_back(outputrow);
+      }
+      ++outputrow;
     }
 
     ++sourceblock;
     ++targetblock;
     ++pres;
+    ++want;
   }
+  outputblockcount = (u32) outputblocks.size();
 
   // Set the number of source blocks and which of them are present
   if (!rs.SetInput(present))
     return false;
 
-  // Start iterating through the available recovery packets
-#if WANT_CONCURRENT
-  tbb::concurrent_hash_map<u32, RecoveryPacket*, u32_hasher>::iterator rp = recoverypacketmap.begin();
-#else
-  map<u32,RecoveryPacket*>::iterator rp = recoverypacketmap.begin();
-#endif
+  // Start iterating through the recovery packets that will be used (in order
+  // of exponent, so that ReedSolomon can use the Vandermonde structure of
+  // the matrix whenever they form an arithmetic progression)
+  map<u32,RecoveryPacket*> selectedrecoverypackets;
+  u32 recoveryfilecount = SelectRecoveryPackets(selectedrecoverypackets);
+  map<u32,RecoveryPacket*>::iterator rp = selectedrecoverypackets.begin();
+
+  if (missingblockcount > 0 && noiselevel > CommandLine::nlQuiet)
+    cout << "Using " << missingblockcount << " recovery blocks from " 
+         << recoveryfilecount << " recovery file(s)." << endl;
+  if (outputblockcount < missingblockcount && noiselevel > CommandLine::nlQuiet)
+    cout << "Recalculating " << outputblockcount << " of the " << missingblockcount
+         << " missing blocks." << endl;
+
+  // The exponents used, for the matrix cache
+  vector<u16> exponents;
 
   // Continue to fill the remaining list of data blocks to be read
   while (inputblock != inputblocks.end())
   {
     // Get the next available recovery packet
     u32 exponent = rp->first;
+    exponents.push_back((u16)exponent);
     RecoveryPacket* recoverypacket = rp->second;
 
     // Get the DataBlock from the recovery packet
@@ -2618,21 +3148,336 @@ bool Par2Repairer::ComputeRSmatrix(void)
     ++rp;
   }
 
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  // The pipeline in ProcessData() opens each file when it reads the first of its
+  // blocks and closes it after the last one, so it needs to know how many there
+  // are (exactly, as the blocks of a file can be read by several threads at once).
+  for (inputblock = inputblocks.begin(); inputblock != inputblocks.end(); ++inputblock)
+    (*inputblock)->GetDiskFile()->SetBlockCount(0);
+  for (inputblock = inputblocks.begin(); inputblock != inputblocks.end(); ++inputblock)
+  {
+    DiskFile *diskfile = (*inputblock)->GetDiskFile();
+    diskfile->SetBlockCount(diskfile->GetBlockCount() + 1);
+  }
+#endif
+
   // If we need to, compute and solve the RS matrix
-  if (missingblockcount == 0)
+  if (outputblockcount == 0)
     return true;
 
-  return rs.Compute(noiselevel);  
+  if (!matrixcachedir.empty())
+  {
+    // The matrix only depends on which blocks are present and which
+    // recovery blocks are used in its place.
+    MD5Context context;
+    context.Update(&setid, sizeof(setid));
+    context.Update(&sourceblockcount, sizeof(sourceblockcount));
+    vector<u8> presentbits((sourceblockcount + 7) / 8, 0);
+    for (u32 i=0; i<sourceblockcount; i++)
+    {
+      if (present[i])
+        presentbits[i / 8] |= (u8)(1 << (i % 8));
+    }
+    context.Update(&presentbits[0], presentbits.size());
+    context.Update(&exponents[0], exponents.size() * sizeof(u16));
+    context.Final(rsmatrixkey);
+
+    if (LoadRSmatrix())
+      return true;
+  }
+
+#if WANT_CONCURRENT
+  rs.SetConcurrent(ALL_SERIAL != concurrent_processing_level);
+  rssolvestate = 0;
+  rssolver = new tbb::tbb_thread(RSmatrixSolver(this));
+  return true;
+#else
+  if (!rs.Compute(noiselevel))
+    return false;
+  SaveRSmatrix();
+  return true;
+#endif
+}
+
+// Choose missingblockcount of the available recovery packets, reading from
+// as few recovery files as possible: the files with the most packets are
+// used first, and only one end of the last file is needed, so each file is
+// read from one contiguous range. Returns the number of files.
+u32 Par2Repairer::SelectRecoveryPackets(map<u32,RecoveryPacket*> &selected) const
+{
+  // The available packets in each file, in the order they are stored
+  map<DiskFile*, map<u64, RecoveryPacket*> > filepackets;
+#if WANT_CONCURRENT
+  for (tbb::concurrent_hash_map<u32,RecoveryPacket*,u32_hasher>::const_iterator rp = recoverypacketmap.begin();
+#else
+  for (map<u32,RecoveryPacket*>::const_iterator rp = recoverypacketmap.begin();
+#endif
+       rp != recoverypacketmap.end(); ++rp)
+  {
+    DataBlock *recoveryblock = rp->second->GetDataBlock();
+    filepackets[recoveryblock->GetDiskFile()][recoveryblock->GetOffset()] = rp->second;
+  }
+
+  // Sort the files by the number of packets in them (ties are broken by the
+  // lowest exponent, which keeps the choice the same as with an exponent order
+  // when the recovery files are all the same size)
+  multimap<pair<u32,u32>, map<u64, RecoveryPacket*>*> files;
+  for (map<DiskFile*, map<u64, RecoveryPacket*> >::iterator f = filepackets.begin();
+       f != filepackets.end(); ++f)
+  {
+    u32 lowest = 0xffffffff;
+    for (map<u64, RecoveryPacket*>::const_iterator p = f->second.begin(); p != f->second.end(); ++p)
+      lowest = min(lowest, p->second->Exponent());
+    files.insert(make_pair(make_pair(0xffffffff - (u32)f->second.size(), lowest), &f->second));
+  }
+
+  u32 filecount = 0;
+  for (multimap<pair<u32,u32>, map<u64, RecoveryPacket*>*>::const_iterator f = files.begin();
+       f != files.end() && selected.size() < missingblockcount; ++f)
+  {
+    ++filecount;
+    if (!selected.empty() && f->first.second < selected.begin()->first)
+    {
+      // Use the end of a file below the exponents chosen so far, so that
+      // they stay consecutive.
+      for (map<u64, RecoveryPacket*>::const_reverse_iterator p = f->second->rbegin();
+           p != f->second->rend() && selected.size() < missingblockcount; ++p)
+      {
+        selected[p->second->Exponent()] = p->second;
+      }
+    }
+    else
+    {
+      for (map<u64, RecoveryPacket*>::const_iterator p = f->second->begin();
+           p != f->second->end() && selected.size() < missingblockcount; ++p)
+      {
+        selected[p->second->Exponent()] = p->second;
+      }
+    }
+  }
+
+  return filecount;
+}
+
+// The header of a file in the matrix cache, which is followed by the matrix.
+struct RSMATRIX_CACHE_HEADER
+{
+  u8      magic[8];  // "PAR2RSM\0"
+  u32     byteorder; // 0x01020304 (in the byte order of the matrix)
+  u32     size;      // Size of the matrix in bytes
+  MD5Hash key;       // rsmatrixkey
+  MD5Hash hash;      // MD5 hash of the matrix
+};
+
+static const u8 rsmatrix_cache_magic[8] = {'P', 'A', 'R', '2', 'R', 'S', 'M', '\0'};
+
+string Par2Repairer::RSmatrixCacheFile(void) const
+{
+  return matrixcachedir + rsmatrixkey.print() + ".rsm";
+}
+
+// Use the matrix in the cache, if there is a valid one.
+bool Par2Repairer::LoadRSmatrix(void)
+{
+  string filename = RSmatrixCacheFile();
+  if (!DiskFile::FileExists(filename))
+    return false;
+
+  DiskFile file;
+  if (!file.Open(filename))
+    return false;
+
+  RSMATRIX_CACHE_HEADER header;
+  const size_t size = rs.MatrixSize();
+  vector<u8> matrix;
+  bool valid = file.FileSize() == sizeof(header) + size &&
+               file.Read(0, &header, sizeof(header)) &&
+               0 == memcmp(header.magic, rsmatrix_cache_magic, sizeof(header.magic)) &&
+               header.byteorder == 0x01020304 &&
+               header.size == size &&
+               header.key == rsmatrixkey;
+  if (valid)
+  {
+    matrix.resize(size);
+    valid = file.Read(sizeof(header), &matrix[0], size);
+  }
+  file.Close();
+
+  if (valid)
+  {
+    MD5Hash hash;
+    MD5Context context;
+    context.Update(&matrix[0], size);
+    context.Final(hash);
+    valid = hash == header.hash && rs.SetMatrix(&matrix[0], size);
+  }
+
+  if (noiselevel > CommandLine::nlQuiet)
+  {
+    if (valid)
+      cout << "Using the solved Reed Solomon matrix in the matrix cache." << endl;
+    else
+      cout << "Ignoring an invalid matrix in the matrix cache: " << filename << endl;
+  }
+
+  return valid;
+}
+
+// Add the matrix which has just been computed to the cache (failing to do
+// so is not an error: the matrix will simply be computed again next time).
+void Par2Repairer::SaveRSmatrix(ostream &out)
+{
+  if (matrixcachedir.empty())
+    return;
+
+  RSMATRIX_CACHE_HEADER header;
+  memcpy(header.magic, rsmatrix_cache_magic, sizeof(header.magic));
+  header.byteorder = 0x01020304;
+  header.size = (u32)rs.MatrixSize();
+  header.key = rsmatrixkey;
+
+  MD5Context context;
+  context.Update(rs.GetMatrix(), rs.MatrixSize());
+  context.Final(header.hash);
+
+  string filename = RSmatrixCacheFile();
+  DiskFile file;
+  if (!file.Create(filename, sizeof(header) + rs.MatrixSize()))
+    return;
+
+  if (!file.Write(0, &header, sizeof(header)) ||
+      !file.Write(sizeof(header), rs.GetMatrix(), rs.MatrixSize()))
+  {
+    file.Close();
+    file.Delete();
+    return;
+  }
+  file.Close();
+
+  if (noiselevel > CommandLine::nlNormal)
+    out << "Saved the solved Reed Solomon matrix to " << filename << endl;
+}
+
+// Until the RS matrix has been computed, copy the blocks which are intact to
+// the target files (so that ProcessData() then only has to read them). Blocks
+// which the OS can copy without them being read into memory are copied even
+// once it has been computed.
+bool Par2Repairer::CopyBlocksWhileSolving(void)
+{
+#if WANT_CONCURRENT
+  buffer copybuffer;
+  if (rssolver != 0 && !copybuffer.alloc((size_t)chunksize))
+    return true; // ProcessData() will copy them instead
+
+  DiskFile *lastopenfile = NULL;
+  bool success = true;
+
+  while (success && copiedblockcount < copyblocks.size())
+  {
+    DataBlock *inputblock = inputblocks[copiedblockcount];
+    DataBlock *copyblock = copyblocks[copiedblockcount];
+
+    // Does this block need to be copied
+    if (copyblock->IsSet())
+    {
+      // Are we reading from a new file?
+      if (lastopenfile != inputblock->GetDiskFile())
+      {
+        // Close the last file
+        if (lastopenfile != NULL)
+        {
+          lastopenfile->Close();
+        }
+
+        // Open the new file
+        lastopenfile = inputblock->GetDiskFile();
+        if (!lastopenfile->Open())
+        {
+          lastopenfile = NULL;
+          success = false;
+          break;
+        }
+      }
+
+      // Have the OS copy the whole block, if it can
+      const u64 length = copyblock->GetLength();
+      size_t wrote;
+      if (length != (size_t)length || !copyblock->CopyData(0, (size_t)length, *inputblock, wrote))
+      {
+        // Otherwise copy it one chunk at a time, but only while the RS matrix
+        // is being computed (the rest are copied as ProcessData() reads them)
+        if (rssolver == 0 || 0 != rssolvestate)
+          break;
+
+        for (u64 blockoffset = 0; success && blockoffset < length; blockoffset += chunksize)
+        {
+          size_t blocklength = (size_t)min((u64)chunksize, length-blockoffset);
+
+          success = inputblock->ReadData(blockoffset, blocklength, copybuffer.get());
+  #if defined(WIN32) && CONCURRENT_PIPELINE
+          // on Windows, once a file is opened for async I/O, its handle must always be used for writing using async I/O
+          aiocb_type cb;
+          success = success && copyblock->WriteDataAsync(cb, blockoffset, blocklength, copybuffer.get(), wrote);
+          if (success)
+          {
+            cb.suspend_until_completed();
+            success = cb.completedOK();
+          }
+  #else
+          success = success && copyblock->WriteData(blockoffset, blocklength, copybuffer.get(), wrote);
+  #endif
+          if (success)
+            StreamTargetData(copyblock, blockoffset, copybuffer.get(), wrote);
+        }
+      }
+    }
+
+    if (success)
+      ++copiedblockcount;
+  }
+
+  // Close the last file
+  if (lastopenfile != NULL)
+  {
+    lastopenfile->Close();
+  }
+
+  return success;
+#else
+  return true;
+#endif
+}
+
+// Wait for the RS matrix to be computed.
+bool Par2Repairer::WaitForRSmatrix(void)
+{
+#if WANT_CONCURRENT
+  if (rssolver != 0)
+  {
+    rssolver->join();
+    delete rssolver;
+    rssolver = 0;
+
+    cout << rssolveoutput.str() << flush;
+    cerr << rssolveerrors.str() << flush;
+    rssolveoutput.str(string());
+    rssolveerrors.str(string());
+  }
+
+  return rssolvestate >= 0;
+#else
+  return true;
+#endif
 }
 
 // Allocate memory buffers for reading and writing data to disk.
 bool Par2Repairer::AllocateBuffers(size_t memorylimit)
 {
   // Would single pass processing use too much memory
-  if (blocksize * missingblockcount > memorylimit)
+  if (blocksize * outputblockcount > memorylimit)
   {
-    // Pick a size that is small enough
-    chunksize = ~3 & (memorylimit / missingblockcount);
+    // Pick a size that is small enough (and, for direct I/O, keeps the reads aligned)
+    chunksize = DiskFile::DirectIOChunkSize(~3 & (memorylimit / outputblockcount));
   }
   else
   {
@@ -2640,8 +3485,10 @@ bool Par2Repairer::AllocateBuffers(size_t memorylimit)
   }
 
 #if GPGPU_CUDA
-  // allocate the GPU output buffers
-  if (rs.has_gpu() && 0 == cuda::AllocateResources(missingblockcount, (size_t) chunksize))
+  // allocate the GPU output buffers (which are indexed by the row of the RS
+  // matrix, so they can only be used when every row is recalculated)
+  if (rs.has_gpu() && (outputblockcount != missingblockcount ||
+                       0 == cuda::AllocateResources(outputblockcount, (size_t) chunksize)))
     rs.set_has_gpu(false);
 #endif
 
@@ -2650,17 +3497,20 @@ bool Par2Repairer::AllocateBuffers(size_t memorylimit)
   typedef __TBB_TypeWithAlignmentAtLeastAsStrict(u8) element_type;
   const size_t aligned_chunksize = (sizeof(u8)*(size_t)chunksize+sizeof(element_type)-1)/sizeof(element_type);
   aligned_chunksize_ = aligned_chunksize;
-  size_t sz = aligned_chunksize * missingblockcount * (DSTOUT?2:1);
+  size_t sz = aligned_chunksize * outputblockcount * (DSTOUT?2:1);
   outputbuffer = tbb::cache_aligned_allocator<u8>().allocate(sz);//new u8[sz];
 #else
   if (!inputbuffer.alloc((size_t)chunksize))
     return false;
 //inputbuffer = new u8[(size_t)chunksize];
-  outputbuffer = new u8[(size_t)chunksize * missingblockcount * (DSTOUT?2:1)];
+  outputbuffer = new u8[(size_t)chunksize * outputblockcount * (DSTOUT?2:1)];
 #endif
 
-#if (WANT_CONCURRENT && CONCURRENT_PIPELINE) || DSTOUT
-  outputbuffer_element_state_.resize(missingblockcount);
+#if DSTOUT
+  outputbuffer_element_state_.resize(outputblockcount);
+#endif
+#if WANT_CONCURRENT && CONCURRENT_PIPELINE
+  outputbuffer_element_initialised_.resize(outputblockcount);
 #endif
 
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE
@@ -2672,7 +3522,15 @@ bool Par2Repairer::AllocateBuffers(size_t memorylimit)
     cerr << "Could not allocate buffer memory." << endl;
     return false;
   }
-  
+
+#if WANT_CONCURRENT
+  // Each band of output blocks is processed in one call, so where each output block
+  // lies is looked up here once rather than for every batch of input blocks
+  outputbuffers_.resize(outputblockcount);
+  for (u32 i = 0; i != outputblockcount; ++i)
+    outputbuffers_[i] = OutputBufferAt(i);
+#endif
+
   return true;
 }
 
@@ -2689,51 +3547,60 @@ void* Par2Repairer::OutputBufferAt(u32 outputindex) {
   #endif
 }
 
-bool Par2Repairer::ProcessDataForOutputIndex_(u32 outputindex, u32 outputendindex, size_t blocklength,
-                                              u32 inputindex, buffer& inputbuffer) {
-  #if CONCURRENT_PIPELINE
-    int val = (outputbuffer_element_state_[outputindex] -= 2); // 0 -> -2, 1 -> -1
-    if (val < -2) { // index is already in use: defer its processing
-      outputbuffer_element_state_[outputindex] += 2; // undo my changes
-//printf("deferring %u\n", outputindex);
-      return false;
-    }
-    assert(val == -2 || val == -1); // ie, hold lock
-
-    // Select the appropriate part of the output buffer
-    void *outbuf = OutputBufferAt(outputindex);//&((u8*)outputbuffer)[aligned_chunksize_ * outputindex * (DSTOUT?2:1)];
-  #else
-    // Select the appropriate part of the output buffer
-    void *outbuf = OutputBufferAt(outputindex);//&((u8*)outputbuffer)[chunksize * outputindex * (DSTOUT?2:1)];
-    #if DSTOUT
-    int val = outputbuffer_element_state_[outputindex];
-    #endif
-  #endif
+// Process the input blocks into the output blocks outputindex..outputendindex-1 using
+// one pass over the output. (In the pipeline, the batches are processed one at a time
+// and each band of output blocks by one task, so their buffers and flags need no lock.)
+void Par2Repairer::ProcessDataForOutputIndex(u32 outputindex, u32 outputendindex, size_t blocklength, size_t datalength,
+                                             u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers) {
+    const u32 count = outputendindex - outputindex;
+    if (0 == count)
+      return;
 
   #if DSTOUT
-    void *outbuf2 = outbuf;
-    if (val & 1)
-      (u8*&) outbuf += chunksize;
-    else
-      (u8*&) outbuf2 += chunksize;
+    for (u32 i = 0; i != count * inputcount; ++i) {
+      const u32 outputi = outputindex + i / inputcount;
+      const u32 inputindex = inputindexes[i % inputcount];
+      buffer& inputbuffer = *inputbuffers[i % inputcount];
+      int val = outputbuffer_element_state_[outputi];
+
+      // Select the appropriate part of the output buffer
+      void *outbuf = OutputBufferAt(outputi);
+      void *outbuf2 = outbuf;
+      if (val & 1)
+        (u8*&) outbuf += chunksize;
+      else
+        (u8*&) outbuf2 += chunksize;
 //tbb::tick_count s = tbb::tick_count::now();
-    // Process the data
-    rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf, outbuf2);
-    if (val & 1) { // can't use "outputbuffer_element_state_[outputindex] ^= 1" because there is no tbb::atomic<>::operator^=
-      val = (outputbuffer_element_state_[outputindex] -= 1); // flip buffers
-      assert(0 == (val & 1));
-    } else {
-      val = (outputbuffer_element_state_[outputindex] += 1); // flip buffers
-      assert(1 == (val & 1));
+      // Process the data
+      rs.Process(blocklength, inputindex, inputbuffer, outputrows[outputi], outbuf, outbuf2);
+      outputbuffer_element_state_[outputi] ^= 1; // flip buffers
     }
   #else
-    rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf);
-  #endif
+    // (the buffers of the output blocks were looked up by AllocateBuffers(), and the
+    // rows of the RS matrix are those of outputrows)
+    void * const *outbufs = &outputbuffers_[outputindex];
+    const u32 *rows = &outputrows[outputindex];
+
+    #if CONCURRENT_PIPELINE
+    // the output buffer is not cleared before processing: the first input block
+    // processed into each output block overwrites it
+    u8 *initialised = &outputbuffer_element_initialised_[outputindex];
+
+    // Only the first datalength bytes of the inputs are processed, so the rest of
+    // an output block which is about to be overwritten must be cleared
+    if (datalength < blocklength)
+      for (u32 i = 0; i != count; ++i)
+        if (!initialised[i])
+          memset((u8*) outbufs[i] + datalength, 0, blocklength - datalength);
 
-  #if CONCURRENT_PIPELINE
-    assert(val < 0);
-    outputbuffer_element_state_[outputindex] += 2; // undo my changes, ie, release lock
+    // Process the data
+    rs.ProcessMultiple(datalength, inputcount, inputindexes, inputbuffers, count, rows, outbufs, initialised);
+    #else
+    // Process the data
+    rs.ProcessMultiple(datalength, inputcount, inputindexes, inputbuffers, count, rows, outbufs, NULL);
+    #endif
   #endif
+
 //tbb::tick_count e = tbb::tick_count::now();
 //gti += (unsigned) (1000000.0 * (e-s).seconds());
 
@@ -2744,7 +3611,7 @@ bool Par2Repairer::ProcessDataForOutputIndex_(u32 outputindex, u32 outputendinde
 // I believe it's a compiler codegen bug, but this work-around (using u64 instead of u32) is "good enough".
         // Update a progress indicator
         u64 oldfraction = (u64)(1000 * progress / totaldata);
-        progress += blocklength;
+        progress += (u64) blocklength * count * inputcount;
         u64 newfraction = (u64)(1000 * progress / totaldata);
 
         if (oldfraction != newfraction) {
@@ -2756,57 +3623,37 @@ bool Par2Repairer::ProcessDataForOutputIndex_(u32 outputindex, u32 outputendinde
           }
         }
       } else
-        progress += blocklength;
+        progress += (u64) blocklength * count * inputcount;
     }
-    return true;
-}
-
-void Par2Repairer::ProcessDataForOutputIndex(u32 outputindex, u32 outputendindex, size_t blocklength,
-                                             u32 inputindex, buffer& inputbuffer)
-{
-  std::vector<u32> v; // which indexes need deferred processing
-  v.reserve(outputendindex - outputindex);
-
-  for( ; outputindex != outputendindex; ++outputindex )
-    if (!ProcessDataForOutputIndex_(outputindex, outputendindex, blocklength, inputindex, inputbuffer))
-      v.push_back(outputindex);
-
-  // try to process all deferred indexes
-  std::vector<u32> d;
-  do {
-    for (std::vector<u32>::const_iterator vit = v.begin(); vit != v.end(); ++vit) { // which indexes need deferred processing
-      const u32 oi = *vit;
-//printf("trying to process deferred %u\n", oi);
-      if (!ProcessDataForOutputIndex_(oi, outputendindex, blocklength, inputindex, inputbuffer)) {
-        d.push_back(oi); // failed -> try again
-      }
-    }
-    v = d; d.clear();
-  } while (!v.empty());
 }
 
 class ApplyPar2RepairerRSProcess {
 public:
-  ApplyPar2RepairerRSProcess(Par2Repairer* obj, size_t blocklength, u32 inputindex, buffer& inputbuffer) :
-    _obj(obj), _blocklength(blocklength), _inputindex(inputindex), _inputbuffer(inputbuffer) {}
+  ApplyPar2RepairerRSProcess(Par2Repairer* obj, size_t blocklength, u32 inputcount, const u32 *inputindexes,
+                             buffer * const *inputbuffers) :
+    _obj(obj), _blocklength(blocklength), _inputcount(inputcount), _inputindexes(inputindexes),
+    _inputbuffers(inputbuffers) {}
   void operator()(const tbb::blocked_range<u32>& r) const {
-    _obj->ProcessDataForOutputIndex(r.begin(), r.end(), _blocklength, _inputindex, _inputbuffer);
+    _obj->ProcessDataForOutputIndex(r.begin(), r.end(), _blocklength, _blocklength, _inputcount, _inputindexes, _inputbuffers);
   }
 private:
-  Par2Repairer* _obj;
-  size_t        _blocklength;
-  u32           _inputindex;
-  buffer&       _inputbuffer;
+  Par2Repairer*   _obj;
+  size_t          _blocklength;
+  u32             _inputcount;
+  const u32      *_inputindexes;
+  buffer * const *_inputbuffers;
 };
 
-void Par2Repairer::ProcessDataConcurrently(size_t blocklength, u32 inputindex, buffer& inputbuffer)
+// Process inputcount input blocks (inputindexes[i] is in inputbuffers[i]) into every output block.
+void Par2Repairer::ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputindexes,
+                                           buffer * const *inputbuffers)
 {
   if (ALL_SERIAL != concurrent_processing_level) {
     static tbb::affinity_partitioner ap;
-    tbb::parallel_for(tbb::blocked_range<u32>(0, missingblockcount),
-      ::ApplyPar2RepairerRSProcess(this, blocklength, inputindex, inputbuffer), ap);
+    tbb::parallel_for(tbb::blocked_range<u32>(0, outputblockcount),
+      ::ApplyPar2RepairerRSProcess(this, blocklength, inputcount, inputindexes, inputbuffers), ap);
   } else
-    ProcessDataForOutputIndex(0, missingblockcount, blocklength, inputindex, inputbuffer);
+    ProcessDataForOutputIndex(0, outputblockcount, blocklength, blocklength, inputcount, inputindexes, inputbuffers);
 }
 
 #endif
@@ -2818,17 +3665,22 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
   u64 totalwritten = 0;
 
 #if (WANT_CONCURRENT && CONCURRENT_PIPELINE) // || DSTOUT
+  #if DSTOUT
   // Clear the output buffer
-  memset(outputbuffer, 0, aligned_chunksize_ * missingblockcount * (DSTOUT?2:1));
+  memset(outputbuffer, 0, aligned_chunksize_ * outputblockcount * (DSTOUT?2:1));
+  #endif
+  // Otherwise the output buffer is not cleared: instead each output block is
+  // overwritten by the first input block processed into it (see ProcessDataForOutputIndex)
 
-  for (size_t i = 0; i != missingblockcount; ++i) {
-    // when outputbuffer_element_state_ contains tbb::atomic<> objects,
-    // they must be manually initialized to zero:
+  for (size_t i = 0; i != outputblockcount; ++i) {
+  #if DSTOUT
     outputbuffer_element_state_[i] = 0;
+  #endif
+    outputbuffer_element_initialised_[i] = 0;
   }
 #else
   // Clear the output buffer
-  memset(outputbuffer, 0, (size_t)chunksize * missingblockcount * (DSTOUT?2:1));
+  memset(outputbuffer, 0, (size_t)chunksize * outputblockcount * (DSTOUT?2:1));
 #endif
 
   vector<DataBlock*>::iterator inputblock = inputblocks.begin();
@@ -2836,18 +3688,28 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
   DiskFile *lastopenfile = NULL;
 
   // Are there any blocks which need to be reconstructed
-  if (missingblockcount > 0)
+  if (outputblockcount > 0)
   {
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE
 //cout << "Repairing using async I/O." << endl;
     const size_t max_tokens = ALL_SERIAL == concurrent_processing_level ? 1 : tbb::task_scheduler_init::default_num_threads();
-    repair_pipeline_state s(max_tokens, chunksize, missingblockcount, blocklength, blockoffset, inputblocks, copyblocks);
+    // Each extra input buffer costs as much memory as an output block, so don't
+    // batch more input blocks than there are output blocks.
+    const size_t batchsize = min((size_t) ReedSolomon<Galois16>::ProcessMultipleInputCount, (size_t) outputblockcount);
+    repair_pipeline_state s(max_tokens, batchsize, chunksize, outputblockcount, blocklength, blockoffset, inputblocks, copyblocks,
+                            copiedblockcount);
+
+  #if !DSTOUT
+    // Each input block is split into byte planes once, after it is read
+    rs.SetSplitPlanes(splitplanes);
+  #endif
 
     tbb::pipeline p;
-    repair_filter_read rfr(s);
+    repair_filter_read rfr(s, *this);
     p.add_filter(rfr);
     repair_filter_process rfp(*this, s);
     p.add_filter(rfp);
+    p.add_filter(rfp.batch_stage());
     //repair_filter_write rfw(*this, s);
     //p.add_filter(rfw);
 
@@ -2855,6 +3717,18 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
     // If too many tokens are used then the async I/O gets deferred until the end of the
     // repair phase, which nullifies any time advantage gained over using synchronous I/O.
 	p.run(max_tokens);
+    rfp.flush();
+
+  #if !DSTOUT
+    // Clear any output block which no input block contributed to, and
+    // put the others back into the normal layout to be written out
+    for (u32 i = 0; i != outputblockcount; ++i)
+      if (!outputbuffer_element_initialised_[i])
+        memset(OutputBufferAt(i), 0, aligned_chunksize_);
+      else
+        rs.FromSplitPlanes(OutputBufferAt(i), blocklength);
+    rs.SetSplitPlanes(false);
+  #endif
 
   #if GPGPU_CUDA
     if (rs.has_gpu()) {
@@ -2887,9 +3761,9 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
       if (0 == pc)
         cout << "The GPU was not used for processing." << endl;
       else {
-        u64 fraction = (1000 * (u64) pc) / ((u64) sourceblockcount * (u64) missingblockcount);
+        u64 fraction = (1000 * (u64) pc) / ((u64) sourceblockcount * (u64) outputblockcount);
         cout << "The GPU was used for " << fraction/10 << '.' << fraction%10 << "% of the processing (" <<
-          pc << " out of " << ((u64) sourceblockcount * (u64) missingblockcount) << " processing blocks)." << endl;
+          pc << " out of " << ((u64) sourceblockcount * (u64) outputblockcount) << " processing blocks)." << endl;
       }
     }
   #endif
@@ -2936,8 +3810,9 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
       // Have we reached the last source data block
       if (copyblock != copyblocks.end())
       {
-        // Does this block need to be copied to the target file
-        if ((*copyblock)->IsSet())
+        // Does this block need to be copied to the target file (and was
+        // it not copied while the RS matrix was being computed)
+        if ((*copyblock)->IsSet() && copyblock >= copyblocks.begin() + copiedblockcount)
         {
           size_t wrote;
 
@@ -2945,6 +3820,7 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
           if (!(*copyblock)->WriteData(blockoffset, blocklength, inputbuffer.get(), wrote))
             return false;
 
+          StreamTargetData(*copyblock, blockoffset, inputbuffer.get(), wrote);
           totalwritten += wrote;
         }
         ++copyblock;
@@ -2952,10 +3828,11 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
 
 //CTimeInterval  ti_pdl("ProcessDataLoop");
   #if WANT_CONCURRENT
-      ProcessDataConcurrently(blocklength, inputindex, inputbuffer);
+      buffer *pinputbuffer = &inputbuffer;
+      ProcessDataConcurrently(blocklength, 1, &inputindex, &pinputbuffer);
   #else
       // For each output block
-      for (u32 outputindex=0; outputindex<missingblockcount; outputindex++)
+      for (u32 outputindex=0; outputindex<outputblockcount; outputindex++)
       {
         // Select the appropriate part of the output buffer
         void *outbuf = &((u8*)outputbuffer)[chunksize * outputindex * (DSTOUT?2:1)];
@@ -2967,11 +3844,11 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
           (u8*&) outbuf2 += chunksize;
 
         // Process the data
-        rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf, outbuf2);
+        rs.Process(blocklength, inputindex, inputbuffer, outputrows[outputindex], outbuf, outbuf2);
         outputbuffer_element_state_[outputindex] ^= 1;
     #else
         // Process the data
-        rs.Process(blocklength, inputindex, inputbuffer, outputindex, outbuf);
+        rs.Process(blocklength, inputindex, inputbuffer, outputrows[outputindex], outbuf);
     #endif
         if (noiselevel > CommandLine::nlQuiet)
         {
@@ -3006,8 +3883,8 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
     // For each block that might need to be copied
     while (copyblock != copyblocks.end())
     {
-      // Does this block need to be copied
-      if ((*copyblock)->IsSet())
+      // Does this block need to be copied (and was it not copied already)
+      if ((*copyblock)->IsSet() && copyblock >= copyblocks.begin() + copiedblockcount)
       {
         // Are we reading from a new file?
         if (lastopenfile != (*inputblock)->GetDiskFile())
@@ -3026,13 +3903,20 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
           }
         }
 
-        // Read data from the current input block
-        if (!(*inputblock)->ReadData(blockoffset, blocklength, inputbuffer.get()))
-          return false;
-
         size_t wrote;
-        if (!(*copyblock)->WriteData(blockoffset, blocklength, inputbuffer.get(), wrote))
-          return false;
+
+        // Have the OS copy it if it can, otherwise read data from the
+        // current input block and write it
+        if (!(*copyblock)->CopyData(blockoffset, blocklength, **inputblock, wrote))
+        {
+          if (!(*inputblock)->ReadData(blockoffset, blocklength, inputbuffer.get()))
+            return false;
+
+          if (!(*copyblock)->WriteData(blockoffset, blocklength, inputbuffer.get(), wrote))
+            return false;
+
+          StreamTargetData(*copyblock, blockoffset, inputbuffer.get(), wrote);
+        }
         totalwritten += wrote;
       }
 
@@ -3085,7 +3969,7 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
 #endif
   // For each output block that has been recomputed
   vector<DataBlock*>::iterator outputblock = outputblocks.begin();
-  for (u32 outputindex=0; outputindex<missingblockcount;outputindex++)
+  for (u32 outputindex=0; outputindex<outputblockcount;outputindex++)
   {
 #if WANT_CONCURRENT && CONCURRENT_PIPELINE
     // Select the appropriate part of the output buffer
@@ -3114,6 +3998,7 @@ bool Par2Repairer::ProcessData(u64 blockoffset, size_t blocklength)
     if (!(*outputblock)->WriteData(blockoffset, blocklength, outbuf, wrote))
       return false;
 #endif
+    StreamTargetData(*outputblock, blockoffset, outbuf, wrote);
     totalwritten += wrote;
 
 #ifdef DUMP_OUTPUT
@@ -3155,6 +4040,16 @@ bool Par2Repairer::VerifyTargetFiles(void)
     if (targetfile->IsOpen())
       targetfile->Close();
 
+    // and the DiskFile which wrote to it, if it was repaired in place (once the
+    // repaired data is on the disk, as the journal is deleted after this)
+    map<Par2RepairerSourceFile*,DiskFile*>::iterator pf = patchfiles.find(sourcefile);
+    bool flushed = true;
+    if (pf != patchfiles.end() && pf->second->IsOpen())
+    {
+      flushed = pf->second->Flush();
+      pf->second->Close();
+    }
+
     // Mark all data blocks for the file as unknown
     vector<DataBlock>::iterator sb = sourcefile->SourceBlocks();
     for (u32 blocknumber=0; blocknumber<sourcefile->BlockCount(); blocknumber++)
@@ -3173,13 +4068,33 @@ bool Par2Repairer::VerifyTargetFiles(void)
       continue;
     }
 
-    // Verify the file again
-    if (!VerifyDataFile(targetfile, sourcefile))
+    // Verify the file from what was written to it, or failing that, scan it again
+    if (!VerifyStreamedTargetFile(sourcefile, targetfile) &&
+        !VerifyDataFile(targetfile, sourcefile))
       finalresult = false;
 
     // Close the file again
     targetfile->Close();
 
+    // If it was repaired in place, the journal is no longer needed, unless
+    // the repair failed (in which case the file is put back as it was)
+    if (pf != patchfiles.end())
+    {
+      if (!flushed)
+      {
+        // (the journal is kept, so that the next repair puts the file back)
+        cerr << "The repaired data may not be on the disk, so the repair journal has been kept: "
+             << JournalFileName(targetfile->FileName()) << endl;
+        finalresult = false;
+      }
+      else if (sourcefile->GetCompleteFile() == targetfile)
+      {
+        DiskFile::Delete(JournalFileName(targetfile->FileName()));
+      }
+      else if (!RollbackJournal(targetfile->FileName()))
+        finalresult = false;
+    }
+
     // Find out how much data we have found
     UpdateVerificationResults();
   }
@@ -3187,6 +4102,129 @@ bool Par2Repairer::VerifyTargetFiles(void)
   return finalresult;
 }
 
+// Hash data which has just been written to a target DataBlock
+void Par2Repairer::StreamTargetData(DataBlock *targetblock, u64 position, const void *buffer, size_t length)
+{
+  size_t index = targetblock - &targetblocks[0];
+  assert(index < targetblockcontexts.size());
+
+  // Does it follow on from the data already written to the block
+  MD5Context &blockcontext = targetblockcontexts[index];
+  if (blockcontext.Bytes() == position)
+  {
+    blockcontext.Update(buffer, length);
+    targetblockcrcs[index] = ~0 ^ CRCUpdateBlock(~0 ^ targetblockcrcs[index], length, buffer);
+  }
+
+  // and from that already written to the file
+#if WANT_CONCURRENT
+  tbb::mutex::scoped_lock l(targetfilecontexts_mutex);
+#endif
+  map<DiskFile*,MD5Context>::iterator fc = targetfilecontexts.find(targetblock->GetDiskFile());
+  if (fc != targetfilecontexts.end() && fc->second.Bytes() == targetblock->GetOffset() + position)
+  {
+    fc->second.Update(buffer, length);
+  }
+}
+
+// Check the hash and CRC of each block written to the target file against
+// the verification packet, reading back only the data which was not hashed
+// as it was written (because it was written out of order, or copied by the
+// OS). The hash of the whole file is also checked if it was written in order.
+bool Par2Repairer::VerifyStreamedTargetFile(Par2RepairerSourceFile *sourcefile, DiskFile *targetfile)
+{
+  const VerificationPacket *verificationpacket = sourcefile->GetVerificationPacket();
+  u64 filesize = sourcefile->GetDescriptionPacket()->FileSize();
+
+  if (verificationpacket == 0 ||
+      targetblockcontexts.size() != targetblocks.size() ||
+      targetfile->FileSize() != filesize)
+    return false;
+
+  // If the file was repaired in place, only those blocks which were written need to be checked
+  // (the others were found where they belong when the file was scanned)
+  map<Par2RepairerSourceFile*,DiskFile*>::const_iterator pf = patchfiles.find(sourcefile);
+  DiskFile *patchfile = pf != patchfiles.end() ? pf->second : 0;
+
+  vector<char> buffer;
+  u64 reread = 0;
+
+  vector<DataBlock>::iterator tb = sourcefile->TargetBlocks();
+  for (u32 blocknumber=0; blocknumber<sourcefile->BlockCount(); ++blocknumber, ++tb)
+  {
+    DataBlock &datablock = *tb;
+
+    if (patchfile != 0 && datablock.GetDiskFile() != patchfile)
+      continue;
+
+    size_t index = &datablock - &targetblocks[0];
+    MD5Context context = targetblockcontexts[index];
+    u32 crc = targetblockcrcs[index];
+
+    // Read back the rest of the block
+    u64 position = context.Bytes();
+    while (position < datablock.GetLength())
+    {
+      if (buffer.empty())
+        buffer.resize((size_t)min(blocksize, (u64)1024*1024));
+
+      size_t want = (size_t)min((u64)buffer.size(), datablock.GetLength() - position);
+      if (!targetfile->Read(datablock.GetOffset() + position, &buffer[0], want))
+        return false;
+
+      context.Update(&buffer[0], want);
+      crc = ~0 ^ CRCUpdateBlock(~0 ^ crc, want, &buffer[0]);
+
+      position += want;
+      reread += want;
+    }
+
+    // The last block of the file is padded with zeros
+    size_t padding = (size_t)(blocksize - datablock.GetLength());
+    context.Update(padding);
+    crc = ~0 ^ CRCUpdateBlock(~0 ^ crc, padding);
+
+    MD5Hash hash;
+    context.Final(hash);
+
+    const FILEVERIFICATIONENTRY *entry = verificationpacket->VerificationEntry(blocknumber);
+    if (hash != entry->hash || crc != entry->crc)
+      return false;
+  }
+
+  map<DiskFile*,MD5Context>::const_iterator fc = targetfilecontexts.find(targetfile);
+  if (fc != targetfilecontexts.end() && fc->second.Bytes() == filesize)
+  {
+    MD5Context context = fc->second;
+    MD5Hash hashfull;
+    context.Final(hashfull);
+
+    if (hashfull != sourcefile->GetDescriptionPacket()->HashFull())
+      return false;
+  }
+
+  // Record that all of the data blocks are in the file
+  vector<DataBlock>::iterator sb = sourcefile->SourceBlocks();
+  for (u64 offset = 0; offset < filesize; offset += blocksize, ++sb)
+  {
+    sb->SetLocation(targetfile, offset);
+    sb->SetLength(min(blocksize, filesize-offset));
+  }
+
+  sourcefile->SetCompleteFile(targetfile);
+
+  if (noiselevel > CommandLine::nlSilent)
+  {
+    string name(utf8_string_to_cout_parameter(CommandLine::FileOrPathForCout(targetfile->FileName())));
+    cout << "Target: \"" << name << "\" - found." << endl;
+
+    if (noiselevel > CommandLine::nlNormal)
+      cout << "Verified from the data written to it (read back " << reread << " bytes)." << endl;
+  }
+
+  return true;
+}
+
 // Delete all of the partly reconstructed files
 bool Par2Repairer::DeleteIncompleteTargetFiles(void)
 {
@@ -3196,7 +4234,22 @@ bool Par2Repairer::DeleteIncompleteTargetFiles(void)
   while (sf != verifylist.end())
   {
     Par2RepairerSourceFile *sourcefile = *sf;
-    if (sourcefile->GetTargetExists())
+
+    // Put back the data of those being repaired in place (if not already done)
+    map<Par2RepairerSourceFile*,DiskFile*>::iterator pf = patchfiles.find(sourcefile);
+    if (pf != patchfiles.end())
+    {
+      if (pf->second->IsOpen())
+        pf->second->Close();
+
+      DiskFile *targetfile = sourcefile->GetTargetFile();
+      if (targetfile->IsOpen())
+        targetfile->Close();
+
+      if (DiskFile::FileExists(JournalFileName(targetfile->FileName())))
+        RollbackJournal(targetfile->FileName());
+    }
+    else if (sourcefile->GetTargetExists())
     {
       DiskFile *targetfile = sourcefile->GetTargetFile();
 
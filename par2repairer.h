@@ -109,6 +109,11 @@ public:
 
   Result Process(const CommandLine &commandline, bool dorepair);
 
+  // Hash data which has just been written to a target DataBlock, so that
+  // VerifyTargetFiles() need not read it back (several threads can call it
+  // at once, for different DataBlocks).
+  void StreamTargetData(DataBlock *targetblock, u64 position, const void *buffer, size_t length);
+
 protected:
   // Steps in verifying and repairing files:
 
@@ -117,17 +122,17 @@ public:
   #if WANT_CONCURRENT_SOURCE_VERIFICATION
   void VerifyOneSourceFile(Par2RepairerSourceFile *sourcefile, bool& finalresult);
   #endif
-  void ProcessDataForOutputIndex(u32 outputstartindex, u32 outputendindex, size_t blocklength,
-                                 u32 inputindex, buffer& inputbuffer);
-  void ProcessDataConcurrently(size_t blocklength, u32 inputindex, buffer& inputbuffer);
+  void ProcessDataForOutputIndex(u32 outputstartindex, u32 outputendindex, size_t blocklength, size_t datalength,
+                                 u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers);
+  void ProcessDataConcurrently(size_t blocklength, u32 inputcount, const u32 *inputindexes, buffer * const *inputbuffers);
+  const ReedSolomon<Galois16>& GetReedSolomon(void) const { return rs; }
+  void SolveRSmatrix(void); // (on the thread started by ComputeRSmatrix())
 #endif
   // Load packets from the specified file
   bool LoadPacketsFromFile(string filename);
 #if WANT_CONCURRENT
 protected:
   void* OutputBufferAt(u32 outputindex);
-  bool ProcessDataForOutputIndex_(u32 outputindex, u32 outputendindex, size_t blocklength,
-                                  u32 inputindex, buffer& inputbuffer);
 #endif
   // Finish loading a recovery packet
   bool LoadRecoveryPacket(DiskFile *diskfile, u64 offset, PACKET_HEADER &header);
@@ -192,18 +197,56 @@ protected:
   // Check the verification results and report the results 
   bool CheckVerificationResults(void);
 
+  // Find the source files which are the only ones to be repaired
+  bool SelectOnlyFiles(const list<string> &filenames);
+
+  // Whether the source file is to be repaired (if it is damaged or missing)
+  bool IsRepairTarget(Par2RepairerSourceFile *sourcefile) const;
+
+  // Whether all of the files which are to be repaired are complete
+  bool TargetFilesComplete(void);
+
   // Rename any damaged or missnamed target files.
   bool RenameTargetFiles(void);
 
+  // Whether the damaged target file of the source file can be repaired in place,
+  // by writing just the blocks which were not found where they belong in it.
+  bool CanRepairInPlace(Par2RepairerSourceFile *sourcefile);
+
+  // Save the data which repairing a file in place will overwrite to a journal,
+  // or put it back from the journal (if the repair did not succeed).
+  static string JournalFileName(const string &filename);
+  bool WriteJournal(Par2RepairerSourceFile *sourcefile);
+  bool RollbackJournal(const string &filename);
+
+  // Put back the data of any file whose in-place repair was interrupted.
+  bool RollbackJournals(void);
+
   // Work out which files are being repaired, create them, and allocate
   // target DataBlocks to them, and remember them for later verification.
   bool CreateTargetFiles(void);
 
   // Work out which data blocks are available, which need to be copied
   // directly to the output, and which need to be recreated, and compute
-  // the appropriate Reed Solomon matrix.
+  // the appropriate Reed Solomon matrix (in the background when processing
+  // concurrently: WaitForRSmatrix() must be called before it is used).
   bool ComputeRSmatrix(void);
 
+  // Choose which recovery packets to use in place of the missing data blocks.
+  u32 SelectRecoveryPackets(map<u32,RecoveryPacket*> &selected) const;
+
+  // Copy intact blocks to the target files for as long as the Reed Solomon
+  // matrix is still being computed.
+  bool CopyBlocksWhileSolving(void);
+
+  // Wait for ComputeRSmatrix() to finish, and return whether it succeeded.
+  bool WaitForRSmatrix(void);
+
+  // Load the solved RS matrix from, or save it to, the matrix cache folder.
+  string RSmatrixCacheFile(void) const;
+  bool LoadRSmatrix(void);
+  void SaveRSmatrix(ostream &out = cout);
+
   // Allocate memory buffers for reading and writing data to disk.
   bool AllocateBuffers(size_t memorylimit);
 
@@ -213,7 +256,12 @@ protected:
   // Verify that all of the reconstructed target files are now correct
   bool VerifyTargetFiles(void);
 
-  // Delete all of the partly reconstructed files
+  // Verify a reconstructed target file using the hashes of the data written
+  // to it, reading back only the blocks which were not written in order.
+  bool VerifyStreamedTargetFile(Par2RepairerSourceFile *sourcefile, DiskFile *targetfile);
+
+  // Delete all of the partly reconstructed files (and put back the
+  // data of those being repaired in place)
   bool DeleteIncompleteTargetFiles(void);
 
 protected:
@@ -240,6 +288,12 @@ protected:
   map<MD5Hash,Par2RepairerSourceFile*> sourcefilemap;// Map from FileId to SourceFile
   vector<Par2RepairerSourceFile*>      sourcefiles;  // The source files
   vector<Par2RepairerSourceFile*>      verifylist;   // Those source files that are being repaired
+  vector<Par2RepairerSourceFile*>      onlyfiles;    // If not empty, the only source files to repair
+
+  bool                                 inplace;      // Whether to repair damaged files in place if possible
+  map<Par2RepairerSourceFile*,DiskFile*> patchfiles; // Those being repaired in place, and the DiskFile
+                                                     // which writes to them (their target DiskFile is
+                                                     // closed when its blocks have been read)
 
   u64                       blocksize;               // The block size.
   u64                       chunksize;               // How much of a block can be processed.
@@ -250,6 +304,13 @@ protected:
   bool                      blocksallocated;         // Whether or not the DataBlocks have been allocated
   vector<DataBlock>         sourceblocks;            // The DataBlocks that will be read from disk
   vector<DataBlock>         targetblocks;            // The DataBlocks that will be written to disk
+  vector<MD5Context>        targetblockcontexts;     // The hash and CRC of the data written to each
+  vector<u32>               targetblockcrcs;         // target DataBlock (for as long as it is in order)
+  map<DiskFile*,MD5Context> targetfilecontexts;      // The hash of the data written to each created
+                                                     // target file (for as long as it is in order)
+#if WANT_CONCURRENT
+  tbb::mutex                targetfilecontexts_mutex;
+#endif
 
   u32                       windowtable[256];        // Table for sliding CRCs
   u32                       windowmask;              // Maks for sliding CRCs
@@ -265,17 +326,29 @@ protected:
 
   vector<DataBlock*>        inputblocks;             // Which DataBlocks will be read from disk
   vector<DataBlock*>        copyblocks;              // Which DataBlocks will copied back to disk
+  u32                       copiedblockcount;        // How many of them were copied by CopyBlocksWhileSolving()
   vector<DataBlock*>        outputblocks;            // Which DataBlocks have to calculated using RS
+  vector<u32>               outputrows;              // The row of the RS matrix for each of them
+  u32                       outputblockcount;        // How many of them there are (only the missing
+                                                     // blocks of onlyfiles, if it is not empty)
 
   ReedSolomon<Galois16>     rs;                      // The Reed Solomon matrix.
 
-  void                     *outputbuffer;            // Buffer for writing DataBlocks (chunksize * missingblockcount)
+  string                    matrixcachedir;          // Where solved RS matrices are kept (if not empty)
+  MD5Hash                   rsmatrixkey;             // Identifies the RS matrix in the cache
+
+  void                     *outputbuffer;            // Buffer for writing DataBlocks (chunksize * outputblockcount)
 
 #if WANT_CONCURRENT
+  std::vector<void*>       outputbuffers_;                    // where each output block is processed into
   #if CONCURRENT_PIPELINE
-  // low bit: which half of each entry in outputbuffer contains valid data (if DSTOUT is 1)
-  // high bit: whether entry in outputbuffer is in use (0 = available, 1 = in-use)
-  std::vector< tbb::atomic<int> > outputbuffer_element_state_; // state of each entry of outputbuffer
+  #if DSTOUT
+  // which half of each entry in outputbuffer contains valid data
+  std::vector<int>          outputbuffer_element_state_; // state of each entry of outputbuffer
+  #endif
+  std::vector<u8>          outputbuffer_element_initialised_; // whether each entry of outputbuffer contains data yet
+                                                              // (in the pipeline, only accessed by the task which
+                                                              // processes the entry's band)
   size_t                   aligned_chunksize_;
   #else
   buffer                    inputbuffer;
@@ -304,9 +377,16 @@ protected:
 
 #if WANT_CONCURRENT
   unsigned                  concurrent_processing_level;
+  int                       numthreads;              // from the command line (0 -> as many as the hardware has)
+  bool                      splitplanes; // whether to process the data in the split-plane layout
   tbb::mutex                cout_mutex;
   tbb::atomic<u32>          cout_in_use;             // when repairing, this is used to display % done w/o blocking a thread
   tbb::tick_count           last_cout;   // when cout was used for output
+
+  tbb::tbb_thread          *rssolver;                // Computes the RS matrix, if it is still running
+  tbb::atomic<int>          rssolvestate;            // 0 while it runs, then 1 if it succeeded or -1 if not
+  ostringstream             rssolveoutput;           // What it printed, and its errors (printed by
+  ostringstream             rssolveerrors;           // WaitForRSmatrix() once it has finished)
 #endif
 };
 
@@ -40,28 +40,54 @@
   class pipeline_buffer : public rcbuffer {
   public:
     enum WRITE_STATUS { NONE, ASYNC_WRITE };
-#ifdef DEBUG_ASYNC_WRITE
-    vector<DataBlock*>::iterator inputblock_;
-#endif
+    vector<DataBlock*>::iterator inputblock_; // the block read into the buffer
   private:
     aiocb_type aiocb_;
     u32 inputindex_;
+    size_t datalength_; // how much of the data might not be zero
     WRITE_STATUS write_status_;
+    bool reading_; // whether an async read into the buffer has yet to be waited for
+  #if HAVE_IO_ENGINE
+    buffer bounce_;   // where a read which is not aligned for direct I/O is made instead
+    bool bounced_;    // whether the buffer views the data read into bounce_
+  #endif
 
   public:
-    pipeline_buffer(void) : inputindex_(0), write_status_(NONE) {}
+  #if HAVE_IO_ENGINE
+    pipeline_buffer(void) : inputindex_(0), datalength_(0), write_status_(NONE), reading_(false), bounced_(false) {}
+  #else
+    pipeline_buffer(void) : inputindex_(0), datalength_(0), write_status_(NONE), reading_(false) {}
+  #endif
 
     aiocb_type& get_aiocb(void) { return aiocb_; }
 
     u32 get_inputindex(void) const { return inputindex_; }
     void set_inputindex(u32 ii) { inputindex_ = ii; }
 
+    size_t get_datalength(void) const { return datalength_; }
+    void set_datalength(size_t dl) { datalength_ = dl; }
+
     void set_write_status(WRITE_STATUS ws) { write_status_ = ws; }
     WRITE_STATUS get_write_status(void) const { return write_status_; }
+
+    void set_reading(bool r) { reading_ = r; }
+    bool is_reading(void) const { return reading_; }
+
+  #if HAVE_IO_ENGINE
+    buffer& get_bounce(void) { return bounce_; }
+    void set_bounced(bool b) { bounced_ = b; }
+    bool is_bounced(void) const { return bounced_; }
+  #endif
   };
 
   class pipeline_state_base {
   public:
+    // the most input buffers that the process stage will hand to its delegate at once
+    enum { MAX_BATCH_SIZE = 16 };
+
+    // the fewest blocks that the read stage keeps being read ahead of the process stage
+    enum { MIN_READ_AHEAD = 4 };
+
     // DiskFile* -> # of data-blocks in the DiskFile yet to be read in
     typedef tbb::concurrent_hash_map<DiskFile*, u32, intptr_hasher<DiskFile*> >  DiskFile_map_type;
 
@@ -108,7 +134,12 @@
       totalwritten_ = 0;
     }
 
-    ~pipeline_state_base(void) {}
+    ~pipeline_state_base(void) {
+      // the buffers may have viewed the mappings of the input files until now
+      for (vector<DataBlock*>::iterator it = inputblocks_.begin(); it != inputblocks_.end(); ++it)
+        if (NULL != (*it)->GetDiskFile())
+          (*it)->GetDiskFile()->Unmap();
+    }
 
     bool is_ok(void) const { return ok_; }
     void set_not_ok(void) { ok_ = false; }
@@ -118,6 +149,7 @@
 
     const size_t                                 blocklength(void) const { return blocklength_; }
     const u64                                    blockoffset(void) const { return blockoffset_; }
+    u32                                          outputcount(void) const { return missingblockcount_; }
 
     tbb::mutex&                                  inputblock_mutex(void) { return inputblock_mutex_; }
     vector<DataBlock*>::iterator                 inputblock(void) { return inputblock_; }
@@ -143,19 +175,47 @@
   private:
     std::vector< BUFFER, tbb::cache_aligned_allocator<BUFFER> > inputbuffers_;
     size_t                                                      inputbuffersidx_; // where to start searching for next buffer
+    const size_t                                                max_tokens_;
+
+    // The process stage collects batchsize_ buffers before processing them together, so
+    // that each output buffer is read and written once per batch instead of once per buffer.
+    const size_t                                                batchsize_;
+    std::vector<BUFFER*>                                        batch_;
+    tbb::mutex                                                  batch_mutex_; // locks batch_
+
+    const size_t                                                read_ahead_;
+
+    size_t take_batch_(BUFFER** out) {
+      const size_t n = batch_.size();
+      std::copy(batch_.begin(), batch_.end(), out);
+      batch_.clear();
+      return n;
+    }
 
   public:
     pipeline_state(
       size_t                                     max_tokens,
+      size_t                                     batchsize,
       u64                                        chunksize,
       u32                                        missingblockcount,
       size_t                                     blocklength,
       u64                                        blockoffset,
       vector<DataBlock*>&                        inputblocks) :
       pipeline_state_base(chunksize, missingblockcount, blocklength, blockoffset, inputblocks),
-      inputbuffersidx_(0) {
-      inputbuffers_.resize(max_tokens);
-      for (size_t i = 0; i != max_tokens; ++i) {
+      inputbuffersidx_(0), max_tokens_(max_tokens), batchsize_(batchsize),
+  #if HAVE_IO_ENGINE
+      read_ahead_(std::max(max_tokens, (size_t) MIN_READ_AHEAD)) {
+  #else
+      read_ahead_(0) {
+  #endif
+      assert(batchsize_ >= 1 && batchsize_ <= MAX_BATCH_SIZE);
+      batch_.reserve(batchsize_);
+
+      // every token in flight needs a buffer, as do the buffers waiting to be processed
+      // and those being read ahead
+      const size_t buffercount = max_tokens + batchsize_ - 1 + read_ahead_;
+      inputbuffers_.resize(buffercount);
+      for (size_t i = 0; i != buffercount; ++i) {
         if (!inputbuffers_[i].alloc((size_t)chunksize))
           throw 1;
 
@@ -163,6 +223,34 @@
         inputbuffers_[i].id_ = i;
   #endif
       }
+
+  #if HAVE_IO_ENGINE
+      std::vector<u8*> buffers(buffercount);
+      for (size_t i = 0; i != buffercount; ++i)
+        buffers[i] = inputbuffers_[i].get();
+      io_engine::get().register_buffers(&buffers[0], buffercount, (size_t)chunksize);
+  #endif
+    }
+
+  #if HAVE_IO_ENGINE
+    ~pipeline_state(void) {
+      io_engine::get().unregister_buffers();
+    }
+  #endif
+
+    size_t max_tokens(void) const { return max_tokens_; }
+    size_t buffer_count(void) const { return inputbuffers_.size(); }
+    size_t read_ahead(void) const { return read_ahead_; }
+
+    // Returns NULL rather than waiting if every buffer is in use.
+    BUFFER* try_available_buffer(void) {
+      size_t off = inputbuffersidx_;
+      for (size_t i = 0; i != inputbuffers_.size(); ++i) {
+        if (try_to_acquire(inputbuffers_[off]))
+          return &inputbuffers_[off];
+        if (inputbuffers_.size() == ++off) off = 0;
+      }
+      return NULL;
     }
 
     BUFFER* first_available_buffer(void) {
@@ -192,6 +280,20 @@ printf("pausing: off__=%u off=%u max_tokens=%u...\r", (unsigned) off__, (unsigne
       //return NULL;
     }
 
+    // Add b to the batch of buffers waiting to be processed. If that completes the batch
+    // then the batch is moved to out and its size is returned, otherwise 0 is returned.
+    size_t add_to_batch(BUFFER* b, BUFFER** out) {
+      tbb::mutex::scoped_lock l(batch_mutex_);
+      batch_.push_back(b);
+      return batch_.size() < batchsize_ ? 0 : take_batch_(out);
+    }
+
+    // Move the (incomplete) batch to out and return its size.
+    size_t take_batch(BUFFER** out) {
+      tbb::mutex::scoped_lock l(batch_mutex_);
+      return take_batch_(out);
+    }
+
     void release(BUFFER* b) {
       int rc = pipeline_state_base::release(*b);
   #if !defined(NDEBUG) && defined(DEBUG_BUFFERS)
@@ -210,31 +312,94 @@ printf("inputbuffersidx_ := %u\n", b - &inputbuffers_[0]);
   class filter_read_base : public tbb::filter {
   private:
     filter_read_base& operator=(const filter_read_base&); // assignment disallowed
+    bool start_read(BUFFER* inputbuffer);
+    bool finish_read(BUFFER* inputbuffer);
+  #if HAVE_IO_ENGINE
+    std::deque<BUFFER*> readahead_; // the buffers being read into, oldest first
+  #endif
   protected:
     typedef pipeline_state<BUFFER> state_type;
     state_type& state_;
   public:
+  #if HAVE_IO_ENGINE
+    // The reads are made asynchronously by the io_engine. This stage is serial: it keeps the
+    // next few blocks being read while the blocks before them are processed, so that the disks
+    // always have several requests to work on, and hands on each buffer once it has been read.
+    filter_read_base(state_type& s) :
+      tbb::filter(true /* tbb::filter::serial */), state_(s) {}
+    ~filter_read_base(void);
+  #else
     // Because async reads don't reliably work (the call to aio_suspend() sometimes never returns),
-    // reads are now done synchronously, and thus this stage is now serial (because reading from
-    // the same file from two or more threads at the same time is undefined behaviour).
+    // reads are done synchronously. DiskFile reads at a given offset (with pread() or an OVERLAPPED
+    // offset) rather than at a shared file position, so this stage is parallel: as many reads as
+    // there are tokens in flight can be outstanding at once, across files and devices.
     filter_read_base(state_type& s) :
-      tbb::filter(true /* tbb::filter::serial */ /* false tbb::filter::parallel */), state_(s) {}
+      tbb::filter(false /* tbb::filter::parallel */), state_(s) {}
+  #endif
     virtual void* operator()(void*);
   };
 
+  #if HAVE_IO_ENGINE
+  template <typename SUBCLASS, typename BUFFER>
+  filter_read_base<SUBCLASS, BUFFER>::~filter_read_base(void) {
+    // if the pipeline was aborted, reads may still be being made into the buffers
+    for (; !readahead_.empty(); readahead_.pop_front()) {
+      if (readahead_.front()->is_reading())
+        readahead_.front()->get_aiocb().suspend_until_completed();
+      state_.release(readahead_.front());
+    }
+  }
+  #endif
+
   template <typename SUBCLASS, typename BUFFER>
   //virtual
   void* filter_read_base<SUBCLASS, BUFFER>::operator()(void*) {
+  #if HAVE_IO_ENGINE
+    // keep the next few blocks being read (the io_engine submits the requests together)
+    while (state_.is_ok() && readahead_.size() < state_.read_ahead()) {
+      BUFFER* inputbuffer = readahead_.empty() ? state_.first_available_buffer() : state_.try_available_buffer();
+      if (NULL == inputbuffer)
+        break;
+      if (!start_read(inputbuffer)) {
+        state_.release(inputbuffer);
+        break;
+      }
+      readahead_.push_back(inputbuffer);
+    }
+
+    if (!state_.is_ok() || readahead_.empty())
+      return NULL; // abort or finished
+
+    BUFFER* inputbuffer = readahead_.front();
+    readahead_.pop_front();
+  #else
     if (!state_.is_ok())
         return NULL; // abort
 
-    vector<DataBlock*>::iterator inputblock;
-    BUFFER*                      inputbuffer;
-
     // try to acquire a buffer (this should always succeed)
-    inputbuffer = state_.first_available_buffer();
+    BUFFER* inputbuffer = state_.first_available_buffer();
     assert(NULL != inputbuffer);
 
+    if (!start_read(inputbuffer)) {
+      state_.release(inputbuffer);
+      return NULL; // finished or failed
+    }
+  #endif
+
+    if (!finish_read(inputbuffer)) {
+      state_.release(inputbuffer);
+      return NULL;
+    }
+
+    return inputbuffer;
+  }
+
+  // Take the next input block and read it into inputbuffer (or, with the io_engine, start
+  // reading it). Returns false once every block has been taken or if an error occurs.
+  template <typename SUBCLASS, typename BUFFER>
+  bool filter_read_base<SUBCLASS, BUFFER>::start_read(BUFFER* inputbuffer) {
+    vector<DataBlock*>::iterator inputblock;
+
     {
       u32 inputindex;
 
@@ -243,7 +408,7 @@ printf("inputbuffersidx_ := %u\n", b - &inputbuffers_[0]);
 
         inputblock = state_.inputblock();
         if (inputblock == state_.inputblocks_end())
-          return NULL; // finished
+          return false; // finished
 
         inputindex = state_.get_and_inc_inputindex();
 
@@ -253,6 +418,7 @@ printf("inputbuffersidx_ := %u\n", b - &inputbuffers_[0]);
 //printf("inputindex=%u\n", inputindex);
 
       inputbuffer->set_inputindex(inputindex);
+      inputbuffer->inputblock_ = inputblock;
     }
 
     // For each input block
@@ -282,8 +448,9 @@ printf("inputbuffersidx_ := %u\n", b - &inputbuffers_[0]);
   #endif
             cerr << "unable to open " << df->FileName() << endl;
             state_.set_not_ok();
-            return NULL;
+            return false;
           }
+          df->Map(); // (in the mapped read mode, otherwise its data is read)
           ia->second = df->GetBlockCount(); // how many blocks to read from the DiskFile
 
           // Release the accessor lock 'ia' and thus allow other threads to access the
@@ -297,94 +464,174 @@ printf("inputbuffersidx_ := %u\n", b - &inputbuffers_[0]);
       // (if the data were read asynchronously, 'fa' can be released)
     }
 
-    {
-      // Read data from the current input block
-  #if 1
-#ifdef DEBUG_ASYNC_WRITE
-printf("reading off=%llu len=%lu\n", (*inputblock)->GetOffset() + state_.blockoffset(), state_.blocklength());
-#endif
-      if (!(*inputblock)->ReadData(state_.blockoffset(), state_.blocklength(), inputbuffer->get()) ||
-          !static_cast<SUBCLASS*> (this)->on_inputbuffer_read(inputbuffer)) {
-        state_.set_not_ok();
-        state_.release(inputbuffer);
-        return NULL;
-      }
-  #else
-      // on Mac OS X 10.5.5, suspend_until_completed() does not return if async requests are made
-      // too frequently (it smells like an OS bug because when the requests occur further apart in
-      // time, the suspension does end), so this code block is disabled:
-      if (!(*inputblock)->ReadDataAsync(inputbuffer->get_aiocb(), state_.blockoffset(),
-                                        state_.blocklength(), inputbuffer->get())) {
-//printf("start reading DiskFile %s failed\n", (*inputblock)->GetDiskFile()->FileName().c_str());
+  #if !GPGPU_CUDA
+    // If the file is mapped, a whole chunk of the block is used where it lies in the mapping
+    // rather than read (a partial chunk at the end of the block is read as usual)
+    inputbuffer->view((*inputblock)->MappedData(state_.blockoffset(), state_.blocklength()));
+    if (inputbuffer->data() != inputbuffer->get()) {
+    #if HAVE_IO_ENGINE
+      inputbuffer->set_reading(false);
+    #else
+      inputbuffer->set_datalength((*inputblock)->DataLength(state_.blockoffset(), state_.blocklength(),
+                                                            inputbuffer->data()));
+    #endif
+      return true;
+    }
+  #endif
+
+    // Read data from the current input block
+  #if HAVE_IO_ENGINE
+    bool started;
+    #if GPGPU_CUDA
+    if (!(*inputblock)->ReadDataAsync(inputbuffer->get_aiocb(), state_.blockoffset(),
+                                      state_.blocklength(), inputbuffer->get(), started)) {
+    #else
+    // (with direct I/O, data which is not aligned for it is read into the buffer's bounce
+    // buffer, which the buffer then views)
+    const u8* data;
+    if (!(*inputblock)->ReadDataAsync(inputbuffer->get_aiocb(), state_.blockoffset(), state_.blocklength(),
+                                      inputbuffer->get(), started, inputbuffer->get_bounce(), data)) {
+    #endif
     #ifndef NDEBUG
 {int err = errno; fprintf(stderr, "\nerror %d: %s, # of open files = %u\n", err, strerror(err), (unsigned) state_.open_diskfile_count()); fflush(stderr);}
     #endif
-        cerr << "unable to request async read of " << (*inputblock)->GetDiskFile()->FileName() << endl;
-        state_.set_not_ok();
-        state_.release(inputbuffer);
-        return NULL;
-      }
+      cerr << "unable to request async read of " << (*inputblock)->GetDiskFile()->FileName() << endl;
+      state_.set_not_ok();
+      return false;
+    }
+    inputbuffer->set_reading(started);
+    #if !GPGPU_CUDA
+    inputbuffer->view(data);
+    inputbuffer->set_bounced(data != inputbuffer->get());
+    #endif
+  #else
+#ifdef DEBUG_ASYNC_WRITE
+printf("reading off=%llu len=%lu\n", (*inputblock)->GetOffset() + state_.blockoffset(), state_.blocklength());
+#endif
+    size_t datalength;
+    if (!(*inputblock)->ReadData(state_.blockoffset(), state_.blocklength(), inputbuffer->get(), datalength)) {
+      state_.set_not_ok();
+      return false;
+    }
+    inputbuffer->set_datalength(datalength);
+  #endif
 
-      // at this point, returning to caller is possible if another pipeline stage is inserted: it
-      // would allow another async read to be requested or other processing to occur.
-printf("%u suspending for read %lu bytes @ %llu\n", inputbuffer->id_, inputbuffer->get_aiocb().len_, inputbuffer->get_aiocb().off_);
+    return true;
+  }
+
+  // Once the input block has been read into inputbuffer, let the subclass have it, and close
+  // the block's DiskFile if it was the last of its blocks to be read.
+  template <typename SUBCLASS, typename BUFFER>
+  bool filter_read_base<SUBCLASS, BUFFER>::finish_read(BUFFER* inputbuffer) {
+    vector<DataBlock*>::iterator inputblock = inputbuffer->inputblock_;
+
+  #if HAVE_IO_ENGINE
+    if (inputbuffer->is_reading()) {
       inputbuffer->get_aiocb().suspend_until_completed();
-printf("%u suspending completed\n", inputbuffer->id_);
-      if (!inputbuffer->get_aiocb().completedOK() || !static_cast<SUBCLASS*> (this)->on_inputbuffer_read(inputbuffer)) {
-//printf("completion of reading DiskFile %s failed\n", (*inputblock)->GetDiskFile()->FileName().c_str());
-    #ifndef NDEBUG
-{int err = errno; fprintf(stderr, "error %d: %s, # of open files = %u\n", err, strerror(err), (unsigned) state_.open_diskfile_count()); fflush(stderr);}
-    #endif
+      inputbuffer->set_reading(false);
+      if (!inputbuffer->get_aiocb().completedOK()) {
         cerr << "unable to complete async read of " << (*inputblock)->GetDiskFile()->FileName() << endl;
         state_.set_not_ok();
-        state_.release(inputbuffer);
-        return NULL;
+        return false;
       }
+    }
+    if (inputbuffer->is_bounced()) {
+      // the units which the data was read with may go on past the end of the block
+      // (the buffer views its own bounce buffer)
+      const size_t length = (size_t) min((u64) state_.blocklength(), (*inputblock)->GetLength() - state_.blockoffset());
+      memset(const_cast<u8*> (inputbuffer->data()) + length, 0, state_.blocklength() - length);
+      inputbuffer->set_bounced(false);
+    }
+    inputbuffer->set_datalength((*inputblock)->DataLength(state_.blockoffset(), state_.blocklength(),
+                                                          inputbuffer->data()));
   #endif
 
-      { // decr block count
-        DiskFile* df = (*inputblock)->GetDiskFile();
-
-        // the count is currently stored in the DiskFile_map_type but it could also be in the DiskFile class;
-        // using an accessor here ensures mutual exclusion to the decrement; if moved to DiskFile, the count
-        // should be changed to a tbb::atomic<u32> instead of a bare u32.
-        typename state_type::DiskFile_map_type::accessor fa;
-        if (!state_.find_diskfile(fa, df)) {
-          cerr << "unable to decrement " << (*inputblock)->GetDiskFile()->FileName() << " (this should not occur)" << endl;
-          state_.set_not_ok();
-          state_.release(inputbuffer);
-          return NULL;
-        }
+    if (!static_cast<SUBCLASS*> (this)->on_inputbuffer_read(inputbuffer)) {
+      state_.set_not_ok();
+      return false;
+    }
+
+    { // decr block count
+      DiskFile* df = (*inputblock)->GetDiskFile();
+
+      // the count is currently stored in the DiskFile_map_type but it could also be in the DiskFile class;
+      // using an accessor here ensures mutual exclusion to the decrement; if moved to DiskFile, the count
+      // should be changed to a tbb::atomic<u32> instead of a bare u32.
+      typename state_type::DiskFile_map_type::accessor fa;
+      if (!state_.find_diskfile(fa, df)) {
+        cerr << "unable to decrement " << (*inputblock)->GetDiskFile()->FileName() << " (this should not occur)" << endl;
+        state_.set_not_ok();
+        return false;
+      }
 
 //printf("%s --bc => %u\n", df->FileName().c_str(), fa->second - 1);
-        if (0 == --fa->second) { // last block was just read in so file can be closed
-          df->Close();
+      if (0 == --fa->second) { // last block was just read in so file can be closed
+        df->Close();
 //printf("%s was closed\n", df->FileName().c_str());
-          state_.remove_diskfile(fa);
-        }
+        state_.remove_diskfile(fa);
       }
     }
 
-#ifdef DEBUG_ASYNC_WRITE
-    inputbuffer->inputblock_ = inputblock;
-#endif
-
-    return inputbuffer;
+    return true;
   }
 
+  // The process stage converts each input buffer in parallel, then passes it to a
+  // serial stage which collects the buffers into batches. The serial stage processes
+  // each batch into every output block with a parallel_for over band_count_ contiguous
+  // bands of them, so no two threads process into the same output block at once and
+  // they need no lock. The bands run on TBB's own worker threads, and the same
+  // affinity_partitioner is used for every batch, so that each band tends to stay with
+  // the worker (and cache) which processed it last time. (As the serial stage holds its
+  // token while it processes a batch, the pipeline's tokens still limit the buffers in use.)
   template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
   class filter_process_base : public tbb::filter {
     typedef DELEGATE delegate_type;
     delegate_type& delegate_;
+    void process_batch(BUFFER** batch, size_t n);
+    void process_band(BUFFER** batch, size_t n, u32 first, u32 last);
+    void wait_for_write(BUFFER* inputbuffer);
+    void finish_with(BUFFER* inputbuffer);
+
+    u32                            band_count_; // 1 -> batches are processed without a parallel_for
+    tbb::affinity_partitioner      ap_;
+
+    class batch_filter : public tbb::filter {
+      filter_process_base* f_;
+    public:
+      batch_filter(filter_process_base* f) : tbb::filter(true /* SERIAL */), f_(f) {}
+      virtual void* operator()(void* item);
+    };
+    batch_filter                   batch_filter_;
+
+    class band_processor {
+      filter_process_base* f_;
+      BUFFER**             batch_;
+      size_t               n_;
+    public:
+      band_processor(filter_process_base* f, BUFFER** batch, size_t n) : f_(f), batch_(batch), n_(n) {}
+      void operator()(const tbb::blocked_range<u32>& r) const;
+    };
   protected:
     typedef pipeline_state<BUFFER> state_type;
     state_type& state_;
   public:
-    filter_process_base(delegate_type& delegate, state_type& s) :
-      tbb::filter(false /* SERIAL tbb::filter::parallel */), delegate_(delegate), state_(s) {}
+    filter_process_base(delegate_type& delegate, state_type& s);
     virtual void* operator()(void*);
+
+    // The serial stage which processes the batches: add it to the pipeline after this one.
+    tbb::filter& batch_stage(void) { return batch_filter_; }
+
+    // Process the buffers of the last (incomplete) batch: call after the pipeline has run.
+    void flush(void);
   };
 
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  filter_process_base<SUBCLASS, BUFFER, DELEGATE>::filter_process_base(delegate_type& delegate, state_type& s) :
+    tbb::filter(false /* SERIAL tbb::filter::parallel */), delegate_(delegate), batch_filter_(this), state_(s) {
+    // one band per token in flight (ie, per hardware thread), but at least one output block per band
+    band_count_ = (u32) std::min((size_t) state_.outputcount(), state_.max_tokens());
+  }
+
   template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
   //virtual
   void* filter_process_base<SUBCLASS, BUFFER, DELEGATE>::operator()(void* item) {
@@ -392,9 +639,99 @@ printf("%u suspending completed\n", inputbuffer->id_);
     assert(NULL != inputbuffer);
 //printf("filter_process_base::operator()\n");
 
-//printf("inputbuffer->get_inputindex()=%u\n", inputbuffer->get_inputindex());
-    delegate_.ProcessDataConcurrently(state_.blocklength(), inputbuffer->get_inputindex(), *inputbuffer);
+    // A buffer which only contains zeros adds nothing to any output block
+    if (0 == inputbuffer->get_datalength()) {
+      finish_with(inputbuffer);
+      return NULL;
+    }
+
+    // Convert the data to the layout it is processed in now, rather than every time
+    // it is processed into an output block (but only once it has been written out).
+    // Data in a mapped file is converted into the buffer on its way, instead of copied.
+    if (delegate_.GetReedSolomon().SplitPlanes()) {
+      wait_for_write(inputbuffer);
+      const size_t length =
+        delegate_.GetReedSolomon().ProcessedLength(inputbuffer->get_datalength(), state_.blocklength());
+      if (inputbuffer->data() != inputbuffer->get()) {
+        // (the whole block is converted: the buffer may be processed in a batch with
+        // ones that have more data, and what it views is zero after its data)
+        delegate_.GetReedSolomon().ToSplitPlanes(inputbuffer->get(), inputbuffer->data(),
+          delegate_.GetReedSolomon().ProcessedLength(state_.blocklength(), state_.blocklength()));
+        inputbuffer->view(NULL);
+      } else
+        delegate_.GetReedSolomon().ToSplitPlanes(inputbuffer->get(), length);
+    }
+
+    // the buffer is processed by the serial stage, once enough buffers have arrived to complete a batch
+    return inputbuffer;
+  }
+
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  //virtual
+  void* filter_process_base<SUBCLASS, BUFFER, DELEGATE>::batch_filter::operator()(void* item) {
+    BUFFER* batch[pipeline_state_base::MAX_BATCH_SIZE];
+    const size_t n = f_->state_.add_to_batch(static_cast<BUFFER*> (item), batch);
+    if (n)
+      f_->process_batch(batch, n);
+    return NULL;
+  }
+
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::flush(void) {
+    BUFFER* batch[pipeline_state_base::MAX_BATCH_SIZE];
+    const size_t n = state_.take_batch(batch);
+    if (n)
+      process_batch(batch, n);
+  }
+
+  // Process the batch into every output block, then release its buffers.
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::process_batch(BUFFER** batch, size_t n) {
+    // (if the pipeline failed, only release the buffers)
+    if (state_.is_ok()) {
+      if (band_count_ > 1)
+        tbb::parallel_for(tbb::blocked_range<u32>(0, band_count_, 1), band_processor(this, batch, n), ap_);
+      else
+        process_band(batch, n, 0, state_.outputcount());
+    }
+
+    for (size_t i = 0; i != n; ++i)
+      finish_with(batch[i]);
+  }
+
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::band_processor::operator()(const tbb::blocked_range<u32>& r) const {
+    const u32 outputcount = f_->state_.outputcount();
+    f_->process_band(batch_, n_, (u32) ((u64) outputcount * r.begin() / f_->band_count_),
+                     (u32) ((u64) outputcount * r.end() / f_->band_count_));
+  }
+
+  // Process the batch into the output blocks first..last-1.
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::process_band(BUFFER** batch, size_t n, u32 first, u32 last) {
+    u32     inputindexes[pipeline_state_base::MAX_BATCH_SIZE];
+    buffer* inputbuffers[pipeline_state_base::MAX_BATCH_SIZE];
+    size_t  datalength = 0;
+    for (size_t i = 0; i != n; ++i) {
+//printf("inputbuffer->get_inputindex()=%u\n", batch[i]->get_inputindex());
+      inputindexes[i] = batch[i]->get_inputindex();
+      inputbuffers[i] = batch[i];
+      datalength = std::max(datalength, batch[i]->get_datalength());
+    }
+    // (only as much of the buffers as any of them has data in is processed)
+    delegate_.ProcessDataForOutputIndex(first, last, state_.blocklength(),
+                                        delegate_.GetReedSolomon().ProcessedLength(datalength, state_.blocklength()),
+                                        (u32) n, inputindexes, inputbuffers);
+  }
+
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::finish_with(BUFFER* inputbuffer) {
+    wait_for_write(inputbuffer);
+    state_.release(inputbuffer);
+  }
 
+  template <typename SUBCLASS, typename BUFFER, typename DELEGATE>
+  void filter_process_base<SUBCLASS, BUFFER, DELEGATE>::wait_for_write(BUFFER* inputbuffer) {
     if (pipeline_buffer::ASYNC_WRITE == inputbuffer->get_write_status()) {
 #ifdef DEBUG_ASYNC_WRITE
 printf("waiting for async write at off=%llu to complete\n", (*inputbuffer->inputblock_)->GetOffset());
@@ -402,7 +739,7 @@ printf("waiting for async write at off=%llu to complete\n", (*inputbuffer->input
 // in diskfile.cpp: DiskFile::Create()
 if (102387 == (*inputbuffer->inputblock_)->GetOffset()) {
   for (unsigned i = 0; i != state_.blocklength(); ++i)
-    printf("%02x ", ((const unsigned char*) inputbuffer->get())[i]);
+    printf("%02x ", ((const unsigned char*) inputbuffer->data())[i]);
   printf("\n");
 }
 #endif
@@ -413,9 +750,6 @@ if (102387 == (*inputbuffer->inputblock_)->GetOffset()) {
       }
       inputbuffer->set_write_status(pipeline_buffer::NONE);
     }
-
-    state_.release(inputbuffer);
-    return NULL;
   }
 
 #endif // WANT_CONCURRENT && CONCURRENT_PIPELINE
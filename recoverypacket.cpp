@@ -85,6 +85,13 @@ bool RecoveryPacket::WriteData(u64 position,
   return datablock.WriteData(position, size, buffer, wrote);
 }
 
+// Update the packet hash with data that need not be written
+void RecoveryPacket::UpdateHash(const void *buffer,
+                                size_t size)
+{
+  packetcontext->Update(buffer, size);
+}
+
 // Write the header of the packet to disk
 bool RecoveryPacket::WriteHeader(void)
 {
@@ -46,6 +46,10 @@ public:
   bool WriteData(u64         position,  // Relative position within the data block
                  size_t      size,      // Size of data to write to block
                  const void *buffer);   // Buffer containing the data to write
+  // Update the recovery packet with data which is already in the data block
+  // (having been computed in a mapping of the file).
+  void UpdateHash(const void *buffer,   // The data
+                  size_t      size);    // Its size
   // Finish computing the hash of the recovery packet and write the header to disk.
   bool WriteHeader(void);
 
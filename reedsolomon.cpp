@@ -110,83 +110,6 @@ template <> bool ReedSolomon<Galois8>::SetInput(u32 count)
   return true;
 }
 
-template <> bool ReedSolomon<Galois8>::InternalProcess(
-  const Galois8 &factor, size_t size, buffer& ib, u32 outputindex, void *outputbuffer
-  )
-{
-  const void *inputbuffer = ib.get();
-
-#ifdef LONGMULTIPLY
-  // The 8-bit long multiplication tables
-  Galois8 *table = glmt->tables;
-
-  // Split the factor into Low and High bytes
-  unsigned int fl = (factor >> 0) & 0xff;
-
-  // Get the four separate multiplication tables
-  Galois8 *LL = &table[(0*256 + fl) * 256 + 0]; // factor.low  * source.low
-
-  // Combine the four multiplication tables into two
-  unsigned int L[256];
-
-  unsigned int *pL = &L[0];
-
-  for (unsigned int i=0; i<256; i++)
-  {
-    *pL = *LL;
-
-    pL++;
-    LL++;
-  }
-
-  // Treat the buffers as arrays of 32-bit unsigned ints.
-  u32 *src4 = (u32 *)inputbuffer;
-  u32 *end4 = (u32 *)&((u8*)inputbuffer)[size & ~3];
-  u32 *dst4 = (u32 *)outputbuffer;
-
-  // Process the data
-  while (src4 < end4)
-  {
-    u32 s = *src4++;
-
-    // Use the two lookup tables computed earlier
-    *dst4++ ^= (L[(s >> 0) & 0xff]      )
-            ^  (L[(s >> 8) & 0xff] << 8 )
-            ^  (L[(s >> 16)& 0xff] << 16)
-            ^  (L[(s >> 24)& 0xff] << 24);
-  }
-
-  // Process any left over bytes at the end of the buffer
-  if (size & 3)
-  {
-    u8 *src1 = &((u8*)inputbuffer)[size & ~3];
-    u8 *end1 = &((u8*)inputbuffer)[size];
-    u8 *dst1 = &((u8*)outputbuffer)[size & ~3];
-
-    // Process the data
-    while (src1 < end1)
-    {
-      u8 s = *src1++;
-      *dst1++ ^= L[s];
-    }
-  }
-#else
-  // Treat the buffers as arrays of 16-bit Galois values.
-
-  Galois8 *src = (Galois8 *)inputbuffer;
-  Galois8 *end = (Galois8 *)&((u8*)inputbuffer)[size];
-  Galois8 *dst = (Galois8 *)outputbuffer;
-
-  // Process the data
-  while (src < end)
-  {
-    *dst++ += *src++ * factor;
-  }
-#endif
-
-  return eSuccess;
-}
-
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////
@@ -483,182 +406,1189 @@ template <> bool ReedSolomon<Galois16>::SetInput(u32 count)
 
 #endif
 
-template <> bool ReedSolomon<Galois16>::InternalProcess(
-  const Galois16 &factor, size_t size, buffer& ib, u32 outputindex, void *outputbuffer)
-{
-  const void *inputbuffer = ib.get();
-#ifdef LONGMULTIPLY
-  // The 8-bit long multiplication tables
-  Galois16 *table = glmt->tables;
-
-  // Split the factor into Low and High bytes
-  unsigned int fl = (factor >> 0) & 0xff;
-  unsigned int fh = (factor >> 8) & 0xff;
+// PSHUFB ("split nibble") kernels for the 16-bit field.
+//
+// Multiplying a 16-bit word w = n0 | n1<<4 | n2<<8 | n3<<12 by a constant factor f
+// is the XOR of four products f*(nk<<4k), each of which can be looked up in a 16-entry
+// table. Splitting each of those four tables into a low-byte half and a high-byte half
+// gives eight 16-byte tables, which is exactly what a single PSHUFB instruction can
+// index. The input words are de-interleaved into a vector of low bytes and a vector
+// of high bytes (packus), the eight lookups are XORed together, and the two result
+// vectors are re-interleaved (punpck) before being XORed into the output buffer.
+// Because both packus and punpck operate within 128-bit lanes the same code works
+// for the 16-, 32- and 64-byte register widths.
+//
+// GFNI kernels use the same de-interleaving, but since multiplication by a constant
+// is linear over GF(2) the product is instead computed as four 8x8 bit-matrix
+// transforms (vgf2p8affineqb) of the low and high byte planes:
+//   product.low  = A_ll * source.low ^ A_lh * source.high
+//   product.high = A_hl * source.low ^ A_hh * source.high
+//
+// The kernels are compiled with GCC's per-function target attribute so that the rest
+// of the program does not require -mssse3/-mavx2/-mavx512bw/-mgfni. The fastest kernel
+// supported by the CPU and OS is chosen at start up, unless a particular one is forced
+// with the PAR2_KERNEL environment variable or the -k command line option.
+#if defined(LONGMULTIPLY) && __GNUC__ && (__i386__ || __x86_64__) && \
+    (__clang__ || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+  #define HAVE_SPLIT_NIBBLE_KERNELS 1
+  #if (__clang__ && __clang_major__ >= 7) || (!__clang__ && __GNUC__ >= 8)
+    #define HAVE_GFNI_KERNELS 1
+  #endif
+#endif
 
-  // Get the four separate multiplication tables
-  Galois16 *LL = &table[(0*256 + fl) * 256 + 0]; // factor.low  * source.low
-  Galois16 *LH = &table[(1*256 + fl) * 256 + 0]; // factor.low  * source.high
-  Galois16 *HL = &table[(1*256 + 0) * 256 + fh]; // factor.high * source.low
-  Galois16 *HH = &table[(2*256 + fh) * 256 + 0]; // factor.high * source.high
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  #include <cpuid.h>
+  #include <immintrin.h>
 
-  // Combine the four multiplication tables into two
-  typedef unsigned int LHEntry;
-//LHEntry L[512]; // Double the space required but
-//LHEntry H[512]; // save ONE shift instruction.
-  // mult tables (using an array of ints forces the compiler to align on a 4-byte boundary):
-  LHEntry lhTable[256*2 *1];
-  LHEntry* L = &lhTable[0];
-  LHEntry* H = &lhTable[256];
-//LHEntry lhTable[256*2 *2];
-//LHEntry* L = &lhTable[0];
-//LHEntry* H = &lhTable[512];
+  namespace DetectVectorUnit {
+    // The SIMD instruction set extensions usable by this process (i.e. supported
+    // by the CPU, and for the wider registers, also saved and restored by the OS).
+    struct Capabilities
+    {
+      bool sse2;
+      bool ssse3;
+      bool avx2;
+      bool avx512bw;       // AVX512F + AVX512BW
+      bool gfni;
+    };
 
-  #if __BYTE_ORDER == __LITTLE_ENDIAN
-  LHEntry *pL = &L[0];
-  LHEntry *pH = &H[0];
-  #else
-  LHEntry *pL = &H[0];
-  LHEntry *pH = &L[0];
-  #endif
+    namespace internal {
+      static u64 xgetbv0(void) {
+        u32 eax, edx;
+        // xgetbv with ecx=0 (spelt out for assemblers which do not know the mnemonic)
+        __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+        return ((u64) edx << 32) | eax;
+      }
 
-  for (unsigned int i=0; i<256; i++)
-  {
-    LHEntry temp;
-    {
-      temp = *LL + *HL;
-  #if __BYTE_ORDER == __LITTLE_ENDIAN
-  #else
-      temp = (temp >> 8) & 0xff | (temp << 8) & 0xff00;
-  #endif
+      static Capabilities DetectCapabilities(void) {
+        Capabilities caps = { false, false, false, false, false };
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+          return caps;
+        caps.sse2  = 0 != (edx & bit_SSE2);
+        caps.ssse3 = 0 != (ecx & bit_SSSE3);
+
+        // AVX2 and AVX-512 also require the OS to save the wider register state.
+        const bool osxsave = 0 != (ecx & bit_OSXSAVE);
+        const u64 xcr0 = osxsave ? xgetbv0() : 0;
+        const bool os_ymm = 0x06 == (xcr0 & 0x06);
+        const bool os_zmm = 0xe6 == (xcr0 & 0xe6);
+
+        if (__get_cpuid_max(0, 0) < 7)
+          return caps;
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+        caps.avx2     = os_ymm && 0 != (ebx & (1u << 5));
+        caps.avx512bw = os_zmm && 0 != (ebx & (1u << 16)) && 0 != (ebx & (1u << 30));
+        caps.gfni     = caps.sse2 && 0 != (ecx & (1u << 8));
+        return caps;
+      }
+    }
 
-      *pL++ = temp;
-      LL++;
-      HL+=256;
+    static const Capabilities capabilities = internal::DetectCapabilities();
+  }
 
-      //pL[255] = temp << 16;
+  // Build the eight 16-byte nibble tables from the L and H tables used by the other
+  // kernels: L[b] = factor * b and H[b] = factor * (b << 8).
+  static void rs_build_nibble_tables(u8 *nt, const u32 *L, const u32 *H) {
+    for (unsigned int n=0; n<16; n++) {
+      const u32 t0 = L[n], t1 = L[n << 4], t2 = H[n], t3 = H[n << 4];
+      nt[0*16 + n] = u8(t0);  nt[1*16 + n] = u8(t0 >> 8);
+      nt[2*16 + n] = u8(t1);  nt[3*16 + n] = u8(t1 >> 8);
+      nt[4*16 + n] = u8(t2);  nt[5*16 + n] = u8(t2 >> 8);
+      nt[6*16 + n] = u8(t3);  nt[7*16 + n] = u8(t3 >> 8);
     }
+  }
 
-    {
-      temp = *LH + *HH;
-  #if __BYTE_ORDER == __LITTLE_ENDIAN
-  #else
-      temp = (temp >> 8) & 0xff | (temp << 8) & 0xff00;
-  #endif
+  // Each kernel processes (size & ~(2*sizeof(register)-1)) bytes and returns that count.
+  // If store is true the products are written to dst instead of being XORed into it.
+  // The _multi kernels sum the products of n source buffers (each with its own factor)
+  // in registers, a block of RS_BLOCK_* sources at a time: the tables of a block are
+  // loaded into registers once, and stay there while it is processed into all of dst,
+  // so that dst (a strip which is in the L1 cache) is read and written once per block.
+  //
+  // The split instantiations work on buffers in the split-plane layout, in which each
+  // pair of registers already holds the low bytes and then the high bytes of the words
+  // (see rs_split_planes()), so they neither pack the source nor unpack the products.
+
+  // The PSHUFB kernels need 8 registers of tables per source and the GFNI kernels 4,
+  // out of 16 registers (32 with AVX-512).
+  enum {
+    RS_BLOCK_SSSE3 = 2, RS_BLOCK_AVX2 = 2, RS_BLOCK_AVX512BW = 4,
+    RS_BLOCK_GFNI = 4,  RS_BLOCK_GFNI_AVX2 = 4, RS_BLOCK_GFNI_AVX512 = 8
+  };
+
+  // The product of the 32 bytes a:b and the factor whose nibble tables are t[0..7].
+  template <bool split>
+  __attribute__((target("ssse3"), always_inline))
+  static inline void rs_mul_ssse3(const __m128i *t, __m128i a, __m128i b, __m128i &r0, __m128i &r1) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i lobyte = _mm_set1_epi16(0x00ff);
+    const __m128i lo = split ? a : _mm_packus_epi16(_mm_and_si128(a, lobyte), _mm_and_si128(b, lobyte));
+    const __m128i hi = split ? b : _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    const __m128i n0 = _mm_and_si128(lo, nibble), n1 = _mm_and_si128(_mm_srli_epi16(lo, 4), nibble);
+    const __m128i n2 = _mm_and_si128(hi, nibble), n3 = _mm_and_si128(_mm_srli_epi16(hi, 4), nibble);
+    const __m128i rl = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(t[0], n0), _mm_shuffle_epi8(t[2], n1)),
+                                     _mm_xor_si128(_mm_shuffle_epi8(t[4], n2), _mm_shuffle_epi8(t[6], n3)));
+    const __m128i rh = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(t[1], n0), _mm_shuffle_epi8(t[3], n1)),
+                                     _mm_xor_si128(_mm_shuffle_epi8(t[5], n2), _mm_shuffle_epi8(t[7], n3)));
+    r0 = split ? rl : _mm_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm_unpackhi_epi8(rl, rh);
+  }
 
-      *pH++ = temp;
-      LH++;
-      HH++;
+  __attribute__((target("ssse3"), always_inline))
+  static inline void rs_load_tables_ssse3(__m128i *t, const u8 *nt) {
+    for (unsigned int k=0; k<8; k++)
+      t[k] = _mm_loadu_si128((const __m128i*) &nt[k*16]);
+  }
 
-      //pH[255] = temp << 16;
+  template <bool split>
+  __attribute__((target("ssse3")))
+  static size_t rs_process_ssse3(void *dst, const void *src, size_t size, const u8 *nt, bool store) {
+    __m128i t[8];
+    rs_load_tables_ssse3(t, nt);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m128i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m128i)) {
+      __m128i *pd = (__m128i*) &d[i];
+      __m128i r0, r1;
+      rs_mul_ssse3<split>(t, _mm_loadu_si128((const __m128i*) &s[i]), _mm_loadu_si128((const __m128i*) &s[i + sizeof(__m128i)]), r0, r1);
+      if (!store) {
+        r0 = _mm_xor_si128(r0, _mm_loadu_si128(pd + 0));
+        r1 = _mm_xor_si128(r1, _mm_loadu_si128(pd + 1));
+      }
+      _mm_storeu_si128(pd + 0, r0);
+      _mm_storeu_si128(pd + 1, r1);
     }
+    return vsz;
   }
 
-  #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
-  if (has_gpu_ && size >= sizeof(u32) && 0 == (size & (sizeof(u32)-1))) {
-    const size_t n = (size / sizeof(u32));
-    // when called from pipeline_state in par2pipeline.h, ib will always be an instance
-    // of pipeline_buffer and hence always an instance of rcbuffer:
-    if (cuda::Process(n, static_cast<rcbuffer&> (ib), lhTable, outputindex)) // EXECUTE
-      return eSuccess;
+  template <bool split, unsigned int G>
+  __attribute__((target("ssse3")))
+  static void rs_process_block_ssse3(u8 *d, const u8 * const *src, size_t vsz, const u8 * const *nt, bool store) {
+    __m128i t[G][8];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_tables_ssse3(t[g], nt[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m128i)) {
+      __m128i *pd = (__m128i*) &d[i];
+      __m128i r0 = _mm_setzero_si128(), r1 = _mm_setzero_si128();
+      if (!store) {
+        r0 = _mm_loadu_si128(pd + 0);
+        r1 = _mm_loadu_si128(pd + 1);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m128i p0, p1;
+        rs_mul_ssse3<split>(t[g], _mm_loadu_si128((const __m128i*) &src[g][i]), _mm_loadu_si128((const __m128i*) &src[g][i + sizeof(__m128i)]), p0, p1);
+        r0 = _mm_xor_si128(r0, p0);
+        r1 = _mm_xor_si128(r1, p1);
+      }
+      _mm_storeu_si128(pd + 0, r0);
+      _mm_storeu_si128(pd + 1, r1);
+    }
   }
-  #endif
 
-  if (DetectVectorUnit::hasVectorUnit) {
-    enum { sizeof_work_unit = DetectVectorUnit::sizeof_work_unit };
-    // asz = alignment size = # of bytes to process using scalar code before vector code can be used
-    // vsz = vector size = # of bytes to process using vector code
-    size_t asz = (sizeof_work_unit - (uintptr_t) inputbuffer) & (sizeof_work_unit-1); // 0...(sizeof_work_unit-1)
-    size_t vsz = (size-asz) & ~(sizeof_work_unit-1);
-    if (vsz) {
-      if (asz) {
-  #if __GNUC__ &&  __x86_64__
-        rs_process_x86_64_scalar(outputbuffer, inputbuffer, asz, lhTable);
-  #elif __GNUC__ &&  __i386__
-        rs_process_i386_scalar(outputbuffer, inputbuffer, asz, lhTable);
-  #else
-        // Treat the buffers as arrays of 32-bit unsigned ints.
-        u32 *src = (u32 *)inputbuffer;
-        u32 *end = (u32 *)&((u8*)inputbuffer)[asz];
-        u32 *dst = (u32 *)outputbuffer;
-  
-        // Process the data
-        do {
-          u32 s = *src++;
+  template <bool split>
+  static size_t rs_process_multi_ssse3(void *dst, const u8 * const *src, u32 n, size_t size, const u8 * const *nt, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m128i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_SSSE3 <= n; k += RS_BLOCK_SSSE3)
+      rs_process_block_ssse3<split, RS_BLOCK_SSSE3>(d, src + k, vsz, nt + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_ssse3<split, 1>(d, src + k, vsz, nt + k, store && 0 == k);
+    return vsz;
+  }
 
-          // Use the two lookup tables computed earlier
+  template <bool split>
+  __attribute__((target("avx2"), always_inline))
+  static inline void rs_mul_avx2(const __m256i *t, __m256i a, __m256i b, __m256i &r0, __m256i &r1) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i lobyte = _mm256_set1_epi16(0x00ff);
+    const __m256i lo = split ? a : _mm256_packus_epi16(_mm256_and_si256(a, lobyte), _mm256_and_si256(b, lobyte));
+    const __m256i hi = split ? b : _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+    const __m256i n0 = _mm256_and_si256(lo, nibble), n1 = _mm256_and_si256(_mm256_srli_epi16(lo, 4), nibble);
+    const __m256i n2 = _mm256_and_si256(hi, nibble), n3 = _mm256_and_si256(_mm256_srli_epi16(hi, 4), nibble);
+    const __m256i rl = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(t[0], n0), _mm256_shuffle_epi8(t[2], n1)),
+                                        _mm256_xor_si256(_mm256_shuffle_epi8(t[4], n2), _mm256_shuffle_epi8(t[6], n3)));
+    const __m256i rh = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(t[1], n0), _mm256_shuffle_epi8(t[3], n1)),
+                                        _mm256_xor_si256(_mm256_shuffle_epi8(t[5], n2), _mm256_shuffle_epi8(t[7], n3)));
+    r0 = split ? rl : _mm256_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm256_unpackhi_epi8(rl, rh);
+  }
 
-          // Visual C++ generates better code with this version (mostly because of the casts):
-          u16 sw = u16(s >> 16);
-          u32 d  = L[u8(sw >> 0)];
-              d ^= H[u8(sw >> 8)];
-              d <<= 16;
-              d ^= *dst ^ (L[u8(       s  >>  0)]      )
-                        ^ (H[u8(((u16) s) >>  8)]      );
-        //u32 d  = (L+256)[u8(sw >> 0)]; // use pre-shifted entries
-        //    d ^= (H+256)[u8(sw >> 8)]; // use pre-shifted entries
-        //    d ^= *dst ^ (L[u8(       s  >>  0)]      )
-        //              ^ (H[u8(((u16) s) >>  8)]      );
+  __attribute__((target("avx2"), always_inline))
+  static inline void rs_load_tables_avx2(__m256i *t, const u8 *nt) {
+    for (unsigned int k=0; k<8; k++)
+      t[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &nt[k*16]));
+  }
 
-          // the original version (too many shift's and and's):
-        //u32 d = *dst ^ (L[(s >> 0) & 0xff]      )
-        //             ^ (H[(s >> 8) & 0xff]      )
-        //             ^ (L[(s >> 16)& 0xff] << 16)
-        //             ^ (H[(s >> 24)& 0xff] << 16);
-          *dst++ = d;
-        } while (src < end);
+  template <bool split>
+  __attribute__((target("avx2")))
+  static size_t rs_process_avx2(void *dst, const void *src, size_t size, const u8 *nt, bool store) {
+    __m256i t[8];
+    rs_load_tables_avx2(t, nt);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m256i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m256i)) {
+      __m256i *pd = (__m256i*) &d[i];
+      __m256i r0, r1;
+      rs_mul_avx2<split>(t, _mm256_loadu_si256((const __m256i*) &s[i]), _mm256_loadu_si256((const __m256i*) &s[i + sizeof(__m256i)]), r0, r1);
+      if (!store) {
+        r0 = _mm256_xor_si256(r0, _mm256_loadu_si256(pd + 0));
+        r1 = _mm256_xor_si256(r1, _mm256_loadu_si256(pd + 1));
+      }
+      _mm256_storeu_si256(pd + 0, r0);
+      _mm256_storeu_si256(pd + 1, r1);
+    }
+    return vsz;
+  }
 
-  #endif
-        (u8*&) outputbuffer += asz;
-        (u8*&) inputbuffer  += asz;
-        size -= asz;
-      } // if (asz)
+  template <bool split, unsigned int G>
+  __attribute__((target("avx2")))
+  static void rs_process_block_avx2(u8 *d, const u8 * const *src, size_t vsz, const u8 * const *nt, bool store) {
+    __m256i t[G][8];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_tables_avx2(t[g], nt[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m256i)) {
+      __m256i *pd = (__m256i*) &d[i];
+      __m256i r0 = _mm256_setzero_si256(), r1 = _mm256_setzero_si256();
+      if (!store) {
+        r0 = _mm256_loadu_si256(pd + 0);
+        r1 = _mm256_loadu_si256(pd + 1);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m256i p0, p1;
+        rs_mul_avx2<split>(t[g], _mm256_loadu_si256((const __m256i*) &src[g][i]), _mm256_loadu_si256((const __m256i*) &src[g][i + sizeof(__m256i)]), p0, p1);
+        r0 = _mm256_xor_si256(r0, p0);
+        r1 = _mm256_xor_si256(r1, p1);
+      }
+      _mm256_storeu_si256(pd + 0, r0);
+      _mm256_storeu_si256(pd + 1, r1);
+    }
+  }
 
-  #if __GNUC__ &&  __x86_64__
-      rs_process_x86_64_mmx(outputbuffer, inputbuffer, vsz, lhTable);
-  #elif __GNUC__ &&  __i386__
-      rs_process_i686_mmx(outputbuffer, inputbuffer, vsz, lhTable);
-    //rs_process_i686_sse2(outputbuffer, inputbuffer, vsz, lhTable);
-  #elif defined(WIN64) || defined(WIN32)
-      rs_process_simd(outputbuffer, inputbuffer, vsz, lhTable);
-  #else
-      vsz = 0; // no SIMD unit, so set vsz = 0
-  #endif
+  template <bool split>
+  static size_t rs_process_multi_avx2(void *dst, const u8 * const *src, u32 n, size_t size, const u8 * const *nt, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m256i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_AVX2 <= n; k += RS_BLOCK_AVX2)
+      rs_process_block_avx2<split, RS_BLOCK_AVX2>(d, src + k, vsz, nt + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_avx2<split, 1>(d, src + k, vsz, nt + k, store && 0 == k);
+    return vsz;
+  }
 
-      (u8*&) outputbuffer += vsz;
-      (u8*&) inputbuffer  += vsz;
-      size -= vsz;
-    } // if (vsz)
+  template <bool split>
+  __attribute__((target("avx512f,avx512bw"), always_inline))
+  static inline void rs_mul_avx512bw(const __m512i *t, __m512i a, __m512i b, __m512i &r0, __m512i &r1) {
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i lobyte = _mm512_set1_epi16(0x00ff);
+    const __m512i lo = split ? a : _mm512_packus_epi16(_mm512_and_si512(a, lobyte), _mm512_and_si512(b, lobyte));
+    const __m512i hi = split ? b : _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8));
+    const __m512i n0 = _mm512_and_si512(lo, nibble), n1 = _mm512_and_si512(_mm512_srli_epi16(lo, 4), nibble);
+    const __m512i n2 = _mm512_and_si512(hi, nibble), n3 = _mm512_and_si512(_mm512_srli_epi16(hi, 4), nibble);
+    const __m512i rl = _mm512_xor_si512(_mm512_xor_si512(_mm512_shuffle_epi8(t[0], n0), _mm512_shuffle_epi8(t[2], n1)),
+                                        _mm512_xor_si512(_mm512_shuffle_epi8(t[4], n2), _mm512_shuffle_epi8(t[6], n3)));
+    const __m512i rh = _mm512_xor_si512(_mm512_xor_si512(_mm512_shuffle_epi8(t[1], n0), _mm512_shuffle_epi8(t[3], n1)),
+                                        _mm512_xor_si512(_mm512_shuffle_epi8(t[5], n2), _mm512_shuffle_epi8(t[7], n3)));
+    r0 = split ? rl : _mm512_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm512_unpackhi_epi8(rl, rh);
   }
 
-  if (size) {
-  #if __GNUC__ && __x86_64__
-    rs_process_x86_64_scalar(outputbuffer, inputbuffer, size, lhTable);
-  #elif __GNUC__ &&  __i386__
-    rs_process_i386_scalar(outputbuffer, inputbuffer, size, lhTable);
-  #else // only Visual C++ produces decent x86 code for the following:
-    // Treat the buffers as arrays of 32-bit unsigned ints.
-    u32 *src = (u32 *)inputbuffer;
-    u32 *end = (u32 *)&((u8*)inputbuffer)[size];
-    u32 *dst = (u32 *)outputbuffer;
-  
-    // Process the data
-    do {
-      u32 s = *src++;
+  __attribute__((target("avx512f,avx512bw"), always_inline))
+  static inline void rs_load_tables_avx512bw(__m512i *t, const u8 *nt) {
+    // (the maskz form avoids a spurious -Wuninitialized from some GCC versions of avx512fintrin.h)
+    for (unsigned int k=0; k<8; k++)
+      t[k] = _mm512_maskz_broadcast_i32x4((__mmask16) -1, _mm_loadu_si128((const __m128i*) &nt[k*16]));
+  }
 
-      // Use the two lookup tables computed earlier
+  template <bool split>
+  __attribute__((target("avx512f,avx512bw")))
+  static size_t rs_process_avx512bw(void *dst, const void *src, size_t size, const u8 *nt, bool store) {
+    __m512i t[8];
+    rs_load_tables_avx512bw(t, nt);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m512i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m512i)) {
+      u8 *pd = &d[i];
+      __m512i r0, r1;
+      rs_mul_avx512bw<split>(t, _mm512_loadu_si512((const void*) &s[i]), _mm512_loadu_si512((const void*) &s[i + sizeof(__m512i)]), r0, r1);
+      if (!store) {
+        r0 = _mm512_xor_si512(r0, _mm512_loadu_si512((const void*) &pd[0]));
+        r1 = _mm512_xor_si512(r1, _mm512_loadu_si512((const void*) &pd[sizeof(__m512i)]));
+      }
+      _mm512_storeu_si512((void*) &pd[0],               r0);
+      _mm512_storeu_si512((void*) &pd[sizeof(__m512i)], r1);
+    }
+    return vsz;
+  }
 
-      // Visual C++ generates better code with this version (mostly because of the casts):
-      u16 sw = u16(s >> 16);
-      u32 d  = L[u8(sw >> 0)];
-          d ^= H[u8(sw >> 8)];
-          d <<= 16;
-          d ^= *dst ^ (L[u8(       s  >>  0)]      )
-                    ^ (H[u8(((u16) s) >>  8)]      );
-    /*u32 d  = (L+256)[u8(sw >> 0)]; // use pre-shifted entries
-          d ^= (H+256)[u8(sw >> 8)]; // use pre-shifted entries
-          d ^= *dst ^ (L[u8(       s  >>  0)]      )
-                    ^ (H[u8(((u16) s) >>  8)]      )
-                    ; // <- one shift instruction eliminated*/
+  template <bool split, unsigned int G>
+  __attribute__((target("avx512f,avx512bw")))
+  static void rs_process_block_avx512bw(u8 *d, const u8 * const *src, size_t vsz, const u8 * const *nt, bool store) {
+    __m512i t[G][8];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_tables_avx512bw(t[g], nt[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m512i)) {
+      u8 *pd = &d[i];
+      __m512i r0 = _mm512_setzero_si512(), r1 = _mm512_setzero_si512();
+      if (!store) {
+        r0 = _mm512_loadu_si512((const void*) &pd[0]);
+        r1 = _mm512_loadu_si512((const void*) &pd[sizeof(__m512i)]);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m512i p0, p1;
+        rs_mul_avx512bw<split>(t[g], _mm512_loadu_si512((const void*) &src[g][i]), _mm512_loadu_si512((const void*) &src[g][i + sizeof(__m512i)]), p0, p1);
+        r0 = _mm512_xor_si512(r0, p0);
+        r1 = _mm512_xor_si512(r1, p1);
+      }
+      _mm512_storeu_si512((void*) &pd[0],               r0);
+      _mm512_storeu_si512((void*) &pd[sizeof(__m512i)], r1);
+    }
+  }
+
+  template <bool split>
+  static size_t rs_process_multi_avx512bw(void *dst, const u8 * const *src, u32 n, size_t size, const u8 * const *nt, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m512i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_AVX512BW <= n; k += RS_BLOCK_AVX512BW)
+      rs_process_block_avx512bw<split, RS_BLOCK_AVX512BW>(d, src + k, vsz, nt + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_avx512bw<split, 1>(d, src + k, vsz, nt + k, store && 0 == k);
+    return vsz;
+  }
+
+  #if HAVE_GFNI_KERNELS
+  // Build the four 8x8 bit matrices (in the operand format of vgf2p8affineqb, i.e.
+  // row i of the matrix in byte 7-i) from the L and H tables: column j of the 16x16
+  // bit matrix for the multiplication is factor * (1 << j).
+  static void rs_build_affine_matrices(u64 *m, const u32 *L, const u32 *H) {
+    u32 column[16];
+    for (unsigned int j=0; j<8; j++) {
+      column[j]     = L[1 << j];
+      column[j + 8] = H[1 << j];
+    }
+    m[0] = m[1] = m[2] = m[3] = 0;
+    for (unsigned int i=0; i<8; i++) {
+      u64 ll = 0, lh = 0, hl = 0, hh = 0;
+      for (unsigned int j=0; j<8; j++) {
+        ll |= ((column[j]     >>  i     ) & 1) << j; // product.low  from source.low
+        lh |= ((column[j + 8] >>  i     ) & 1) << j; // product.low  from source.high
+        hl |= ((column[j]     >> (i + 8)) & 1) << j; // product.high from source.low
+        hh |= ((column[j + 8] >> (i + 8)) & 1) << j; // product.high from source.high
+      }
+      m[0] |= ll << (8*(7-i));
+      m[1] |= lh << (8*(7-i));
+      m[2] |= hl << (8*(7-i));
+      m[3] |= hh << (8*(7-i));
+    }
+  }
+
+  // The product of the 32 bytes a:b and the factor whose bit matrices are m[0..3].
+  template <bool split>
+  __attribute__((target("sse2,gfni"), always_inline))
+  static inline void rs_mul_gfni(const __m128i *m, __m128i a, __m128i b, __m128i &r0, __m128i &r1) {
+    const __m128i lobyte = _mm_set1_epi16(0x00ff);
+    const __m128i lo = split ? a : _mm_packus_epi16(_mm_and_si128(a, lobyte), _mm_and_si128(b, lobyte));
+    const __m128i hi = split ? b : _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    const __m128i rl = _mm_xor_si128(_mm_gf2p8affine_epi64_epi8(lo, m[0], 0), _mm_gf2p8affine_epi64_epi8(hi, m[1], 0));
+    const __m128i rh = _mm_xor_si128(_mm_gf2p8affine_epi64_epi8(lo, m[2], 0), _mm_gf2p8affine_epi64_epi8(hi, m[3], 0));
+    r0 = split ? rl : _mm_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm_unpackhi_epi8(rl, rh);
+  }
+
+  __attribute__((target("sse2,gfni"), always_inline))
+  static inline void rs_load_matrices_gfni(__m128i *mv, const u64 *m) {
+    for (unsigned int k=0; k<4; k++)
+      mv[k] = _mm_set1_epi64x(m[k]);
+  }
+
+  template <bool split>
+  __attribute__((target("sse2,gfni")))
+  static size_t rs_process_gfni(void *dst, const void *src, size_t size, const u64 *m, bool store) {
+    __m128i mv[4];
+    rs_load_matrices_gfni(mv, m);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m128i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m128i)) {
+      __m128i *pd = (__m128i*) &d[i];
+      __m128i r0, r1;
+      rs_mul_gfni<split>(mv, _mm_loadu_si128((const __m128i*) &s[i]), _mm_loadu_si128((const __m128i*) &s[i + sizeof(__m128i)]), r0, r1);
+      if (!store) {
+        r0 = _mm_xor_si128(r0, _mm_loadu_si128(pd + 0));
+        r1 = _mm_xor_si128(r1, _mm_loadu_si128(pd + 1));
+      }
+      _mm_storeu_si128(pd + 0, r0);
+      _mm_storeu_si128(pd + 1, r1);
+    }
+    return vsz;
+  }
+
+  template <bool split, unsigned int G>
+  __attribute__((target("sse2,gfni")))
+  static void rs_process_block_gfni(u8 *d, const u8 * const *src, size_t vsz, const u64 * const *m, bool store) {
+    __m128i mv[G][4];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_matrices_gfni(mv[g], m[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m128i)) {
+      __m128i *pd = (__m128i*) &d[i];
+      __m128i r0 = _mm_setzero_si128(), r1 = _mm_setzero_si128();
+      if (!store) {
+        r0 = _mm_loadu_si128(pd + 0);
+        r1 = _mm_loadu_si128(pd + 1);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m128i p0, p1;
+        rs_mul_gfni<split>(mv[g], _mm_loadu_si128((const __m128i*) &src[g][i]), _mm_loadu_si128((const __m128i*) &src[g][i + sizeof(__m128i)]), p0, p1);
+        r0 = _mm_xor_si128(r0, p0);
+        r1 = _mm_xor_si128(r1, p1);
+      }
+      _mm_storeu_si128(pd + 0, r0);
+      _mm_storeu_si128(pd + 1, r1);
+    }
+  }
+
+  template <bool split>
+  static size_t rs_process_multi_gfni(void *dst, const u8 * const *src, u32 n, size_t size, const u64 * const *m, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m128i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_GFNI <= n; k += RS_BLOCK_GFNI)
+      rs_process_block_gfni<split, RS_BLOCK_GFNI>(d, src + k, vsz, m + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_gfni<split, 1>(d, src + k, vsz, m + k, store && 0 == k);
+    return vsz;
+  }
+
+  template <bool split>
+  __attribute__((target("avx2,gfni"), always_inline))
+  static inline void rs_mul_gfni_avx2(const __m256i *m, __m256i a, __m256i b, __m256i &r0, __m256i &r1) {
+    const __m256i lobyte = _mm256_set1_epi16(0x00ff);
+    const __m256i lo = split ? a : _mm256_packus_epi16(_mm256_and_si256(a, lobyte), _mm256_and_si256(b, lobyte));
+    const __m256i hi = split ? b : _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+    const __m256i rl = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(lo, m[0], 0), _mm256_gf2p8affine_epi64_epi8(hi, m[1], 0));
+    const __m256i rh = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(lo, m[2], 0), _mm256_gf2p8affine_epi64_epi8(hi, m[3], 0));
+    r0 = split ? rl : _mm256_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm256_unpackhi_epi8(rl, rh);
+  }
+
+  __attribute__((target("avx2,gfni"), always_inline))
+  static inline void rs_load_matrices_gfni_avx2(__m256i *mv, const u64 *m) {
+    for (unsigned int k=0; k<4; k++)
+      mv[k] = _mm256_set1_epi64x(m[k]);
+  }
+
+  template <bool split>
+  __attribute__((target("avx2,gfni")))
+  static size_t rs_process_gfni_avx2(void *dst, const void *src, size_t size, const u64 *m, bool store) {
+    __m256i mv[4];
+    rs_load_matrices_gfni_avx2(mv, m);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m256i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m256i)) {
+      __m256i *pd = (__m256i*) &d[i];
+      __m256i r0, r1;
+      rs_mul_gfni_avx2<split>(mv, _mm256_loadu_si256((const __m256i*) &s[i]), _mm256_loadu_si256((const __m256i*) &s[i + sizeof(__m256i)]), r0, r1);
+      if (!store) {
+        r0 = _mm256_xor_si256(r0, _mm256_loadu_si256(pd + 0));
+        r1 = _mm256_xor_si256(r1, _mm256_loadu_si256(pd + 1));
+      }
+      _mm256_storeu_si256(pd + 0, r0);
+      _mm256_storeu_si256(pd + 1, r1);
+    }
+    return vsz;
+  }
+
+  template <bool split, unsigned int G>
+  __attribute__((target("avx2,gfni")))
+  static void rs_process_block_gfni_avx2(u8 *d, const u8 * const *src, size_t vsz, const u64 * const *m, bool store) {
+    __m256i mv[G][4];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_matrices_gfni_avx2(mv[g], m[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m256i)) {
+      __m256i *pd = (__m256i*) &d[i];
+      __m256i r0 = _mm256_setzero_si256(), r1 = _mm256_setzero_si256();
+      if (!store) {
+        r0 = _mm256_loadu_si256(pd + 0);
+        r1 = _mm256_loadu_si256(pd + 1);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m256i p0, p1;
+        rs_mul_gfni_avx2<split>(mv[g], _mm256_loadu_si256((const __m256i*) &src[g][i]), _mm256_loadu_si256((const __m256i*) &src[g][i + sizeof(__m256i)]), p0, p1);
+        r0 = _mm256_xor_si256(r0, p0);
+        r1 = _mm256_xor_si256(r1, p1);
+      }
+      _mm256_storeu_si256(pd + 0, r0);
+      _mm256_storeu_si256(pd + 1, r1);
+    }
+  }
+
+  template <bool split>
+  static size_t rs_process_multi_gfni_avx2(void *dst, const u8 * const *src, u32 n, size_t size, const u64 * const *m, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m256i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_GFNI_AVX2 <= n; k += RS_BLOCK_GFNI_AVX2)
+      rs_process_block_gfni_avx2<split, RS_BLOCK_GFNI_AVX2>(d, src + k, vsz, m + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_gfni_avx2<split, 1>(d, src + k, vsz, m + k, store && 0 == k);
+    return vsz;
+  }
+
+  template <bool split>
+  __attribute__((target("avx512f,avx512bw,gfni"), always_inline))
+  static inline void rs_mul_gfni_avx512(const __m512i *m, __m512i a, __m512i b, __m512i &r0, __m512i &r1) {
+    const __m512i lobyte = _mm512_set1_epi16(0x00ff);
+    const __m512i lo = split ? a : _mm512_packus_epi16(_mm512_and_si512(a, lobyte), _mm512_and_si512(b, lobyte));
+    const __m512i hi = split ? b : _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8));
+    const __m512i rl = _mm512_xor_si512(_mm512_gf2p8affine_epi64_epi8(lo, m[0], 0), _mm512_gf2p8affine_epi64_epi8(hi, m[1], 0));
+    const __m512i rh = _mm512_xor_si512(_mm512_gf2p8affine_epi64_epi8(lo, m[2], 0), _mm512_gf2p8affine_epi64_epi8(hi, m[3], 0));
+    r0 = split ? rl : _mm512_unpacklo_epi8(rl, rh);
+    r1 = split ? rh : _mm512_unpackhi_epi8(rl, rh);
+  }
+
+  __attribute__((target("avx512f,avx512bw,gfni"), always_inline))
+  static inline void rs_load_matrices_gfni_avx512(__m512i *mv, const u64 *m) {
+    for (unsigned int k=0; k<4; k++)
+      mv[k] = _mm512_set1_epi64(m[k]);
+  }
+
+  template <bool split>
+  __attribute__((target("avx512f,avx512bw,gfni")))
+  static size_t rs_process_gfni_avx512(void *dst, const void *src, size_t size, const u64 *m, bool store) {
+    __m512i mv[4];
+    rs_load_matrices_gfni_avx512(mv, m);
+
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m512i)-1);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m512i)) {
+      u8 *pd = &d[i];
+      __m512i r0, r1;
+      rs_mul_gfni_avx512<split>(mv, _mm512_loadu_si512((const void*) &s[i]), _mm512_loadu_si512((const void*) &s[i + sizeof(__m512i)]), r0, r1);
+      if (!store) {
+        r0 = _mm512_xor_si512(r0, _mm512_loadu_si512((const void*) &pd[0]));
+        r1 = _mm512_xor_si512(r1, _mm512_loadu_si512((const void*) &pd[sizeof(__m512i)]));
+      }
+      _mm512_storeu_si512((void*) &pd[0],               r0);
+      _mm512_storeu_si512((void*) &pd[sizeof(__m512i)], r1);
+    }
+    return vsz;
+  }
+
+  template <bool split, unsigned int G>
+  __attribute__((target("avx512f,avx512bw,gfni")))
+  static void rs_process_block_gfni_avx512(u8 *d, const u8 * const *src, size_t vsz, const u64 * const *m, bool store) {
+    __m512i mv[G][4];
+    for (unsigned int g = 0; g != G; ++g)
+      rs_load_matrices_gfni_avx512(mv[g], m[g]);
+
+    for (size_t i = 0; i < vsz; i += 2*sizeof(__m512i)) {
+      u8 *pd = &d[i];
+      __m512i r0 = _mm512_setzero_si512(), r1 = _mm512_setzero_si512();
+      if (!store) {
+        r0 = _mm512_loadu_si512((const void*) &pd[0]);
+        r1 = _mm512_loadu_si512((const void*) &pd[sizeof(__m512i)]);
+      }
+      for (unsigned int g = 0; g != G; ++g) {
+        __m512i p0, p1;
+        rs_mul_gfni_avx512<split>(mv[g], _mm512_loadu_si512((const void*) &src[g][i]), _mm512_loadu_si512((const void*) &src[g][i + sizeof(__m512i)]), p0, p1);
+        r0 = _mm512_xor_si512(r0, p0);
+        r1 = _mm512_xor_si512(r1, p1);
+      }
+      _mm512_storeu_si512((void*) &pd[0],               r0);
+      _mm512_storeu_si512((void*) &pd[sizeof(__m512i)], r1);
+    }
+  }
+
+  template <bool split>
+  static size_t rs_process_multi_gfni_avx512(void *dst, const u8 * const *src, u32 n, size_t size, const u64 * const *m, bool store) {
+    const size_t vsz = size & ~(size_t)(2*sizeof(__m512i)-1);
+    u8 *d = (u8*) dst;
+    u32 k = 0;
+    for (; k + RS_BLOCK_GFNI_AVX512 <= n; k += RS_BLOCK_GFNI_AVX512)
+      rs_process_block_gfni_avx512<split, RS_BLOCK_GFNI_AVX512>(d, src + k, vsz, m + k, store && 0 == k);
+    for (; k != n; ++k)
+      rs_process_block_gfni_avx512<split, 1>(d, src + k, vsz, m + k, store && 0 == k);
+    return vsz;
+  }
+  #endif
+#endif
+
+// Selection of the kernel used by ReedSolomon<Galois16>::InternalProcess() (and by the
+// Galois8 version, which has the same PSHUFB and GFNI variants).
+namespace DetectVectorUnit {
+  typedef enum
+  {
+    kScalar = 0,   // 32 bits at a time using the L and H tables
+    kMMX,          // 64 bits at a time using the L and H tables (MMX or SSE2 registers)
+    kSSSE3,        // PSHUFB, 32 bytes per iteration
+    kAVX2,         // PSHUFB, 64 bytes per iteration
+    kAVX512BW,     // PSHUFB, 128 bytes per iteration
+    kGFNI,         // GF2P8AFFINEQB, 32 bytes per iteration
+    kGFNI_AVX2,    // GF2P8AFFINEQB, 64 bytes per iteration
+    kGFNI_AVX512,  // GF2P8AFFINEQB, 128 bytes per iteration
+    kCount
+  } Kernel;
+
+  static const char * const kernelNames[kCount] = {
+    "scalar", "mmx", "ssse3", "avx2", "avx512bw", "gfni", "gfni-avx2", "gfni-avx512"
+  };
+
+  namespace internal {
+    static bool IsAvailable(Kernel k) {
+      switch (k) {
+      case kScalar:      return true;
+#ifdef LONGMULTIPLY
+      case kMMX:         return hasVectorUnit;
+#endif
+#if HAVE_SPLIT_NIBBLE_KERNELS
+      case kSSSE3:       return capabilities.ssse3;
+      case kAVX2:        return capabilities.avx2;
+      case kAVX512BW:    return capabilities.avx512bw;
+#endif
+#if HAVE_GFNI_KERNELS
+      case kGFNI:        return capabilities.gfni;
+      case kGFNI_AVX2:   return capabilities.gfni && capabilities.avx2;
+      case kGFNI_AVX512: return capabilities.gfni && capabilities.avx512bw;
+#endif
+      default:           return false;
+      }
+    }
+
+    static Kernel Fastest(void) {
+      // in order of preference
+      static const Kernel order[] = {
+        kGFNI_AVX512, kAVX512BW, kGFNI_AVX2, kAVX2, kGFNI, kSSSE3, kMMX
+      };
+      for (size_t i = 0; i < sizeof(order)/sizeof(order[0]); ++i)
+        if (IsAvailable(order[i]))
+          return order[i];
+      return kScalar;
+    }
+
+    static bool Lookup(const char *name, Kernel &k) {
+      for (int i = 0; i < kCount; ++i) {
+        if (0 == stricmp(name, kernelNames[i])) {
+          k = (Kernel) i;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    static Kernel InitialKernel(void) {
+      const char *name = getenv("PAR2_KERNEL");
+      Kernel k;
+      if (name && *name && 0 != stricmp(name, "auto")) {
+        if (Lookup(name, k) && IsAvailable(k))
+          return k;
+        cerr << "Ignoring PAR2_KERNEL=" << name << " (not supported on this computer)." << endl;
+      }
+      return Fastest();
+    }
+  }
+
+  static Kernel kernel = internal::InitialKernel();
+}
+
+bool SelectGalois16Kernel(const string &name)
+{
+  if (0 == stricmp(name.c_str(), "auto"))
+  {
+    DetectVectorUnit::kernel = DetectVectorUnit::internal::Fastest();
+    return true;
+  }
+
+  DetectVectorUnit::Kernel k;
+  if (!DetectVectorUnit::internal::Lookup(name.c_str(), k) || !DetectVectorUnit::internal::IsAvailable(k))
+    return false;
+
+  DetectVectorUnit::kernel = k;
+  return true;
+}
+
+const char* Galois16KernelName(void)
+{
+  return DetectVectorUnit::kernelNames[DetectVectorUnit::kernel];
+}
+
+string AvailableGalois16Kernels(void)
+{
+  string names;
+  for (int i = 0; i < DetectVectorUnit::kCount; ++i)
+  {
+    if (DetectVectorUnit::internal::IsAvailable((DetectVectorUnit::Kernel) i))
+    {
+      if (!names.empty())
+        names += ' ';
+      names += DetectVectorUnit::kernelNames[i];
+    }
+  }
+  return names;
+}
+
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  // Convert the pairs of registers in size bytes (a multiple of 2*sizeof(register)) of
+  // src to the split-plane layout in dst (which is either src or does not overlap it), in
+  // which the first register holds the low bytes of the words and the second the high
+  // bytes (in the order the kernels unpack them in), or back again if inverse is true.
+  __attribute__((target("sse2")))
+  static void rs_split_planes_sse2(void *dst, const void *src, size_t size, bool inverse) {
+    const __m128i lobyte = _mm_set1_epi16(0x00ff);
+    const __m128i *s = (const __m128i*) src;
+    __m128i *p = (__m128i*) dst;
+    for (size_t i = 0; i < size / sizeof(__m128i); i += 2) {
+      const __m128i a = _mm_loadu_si128(s + i), b = _mm_loadu_si128(s + i + 1);
+      if (inverse) {
+        _mm_storeu_si128(p + i,     _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128(p + i + 1, _mm_unpackhi_epi8(a, b));
+      } else {
+        _mm_storeu_si128(p + i,     _mm_packus_epi16(_mm_and_si128(a, lobyte), _mm_and_si128(b, lobyte)));
+        _mm_storeu_si128(p + i + 1, _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+      }
+    }
+  }
+
+  __attribute__((target("avx2")))
+  static void rs_split_planes_avx2(void *dst, const void *src, size_t size, bool inverse) {
+    const __m256i lobyte = _mm256_set1_epi16(0x00ff);
+    const __m256i *s = (const __m256i*) src;
+    __m256i *p = (__m256i*) dst;
+    for (size_t i = 0; i < size / sizeof(__m256i); i += 2) {
+      const __m256i a = _mm256_loadu_si256(s + i), b = _mm256_loadu_si256(s + i + 1);
+      if (inverse) {
+        _mm256_storeu_si256(p + i,     _mm256_unpacklo_epi8(a, b));
+        _mm256_storeu_si256(p + i + 1, _mm256_unpackhi_epi8(a, b));
+      } else {
+        _mm256_storeu_si256(p + i,     _mm256_packus_epi16(_mm256_and_si256(a, lobyte), _mm256_and_si256(b, lobyte)));
+        _mm256_storeu_si256(p + i + 1, _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)));
+      }
+    }
+  }
+
+  __attribute__((target("avx512f,avx512bw")))
+  static void rs_split_planes_avx512bw(void *dst, const void *src, size_t size, bool inverse) {
+    const __m512i lobyte = _mm512_set1_epi16(0x00ff);
+    const u8 *s = (const u8*) src;
+    u8 *p = (u8*) dst;
+    for (size_t i = 0; i < size; i += 2*sizeof(__m512i)) {
+      const __m512i a = _mm512_loadu_si512((const void*) &s[i]);
+      const __m512i b = _mm512_loadu_si512((const void*) &s[i + sizeof(__m512i)]);
+      if (inverse) {
+        _mm512_storeu_si512((void*) &p[i],                   _mm512_unpacklo_epi8(a, b));
+        _mm512_storeu_si512((void*) &p[i + sizeof(__m512i)], _mm512_unpackhi_epi8(a, b));
+      } else {
+        _mm512_storeu_si512((void*) &p[i],                   _mm512_packus_epi16(_mm512_and_si512(a, lobyte), _mm512_and_si512(b, lobyte)));
+        _mm512_storeu_si512((void*) &p[i + sizeof(__m512i)], _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8)));
+      }
+    }
+  }
+
+  // The tables for one factor in the form used by the PSHUFB or GFNI kernels.
+  struct rs_wide_tables
+  {
+    u8  nt[8*16];  // nibble tables (PSHUFB)
+    u64 m[4];      // bit matrices (GFNI)
+  };
+
+  // The number of bytes the selected PSHUFB or GFNI kernel processes per iteration,
+  // or 0 if neither is selected.
+  static size_t rs_wide_unit(void) {
+    switch (DetectVectorUnit::kernel) {
+    case DetectVectorUnit::kSSSE3:
+    case DetectVectorUnit::kGFNI:        return 2*sizeof(__m128i);
+    case DetectVectorUnit::kAVX2:
+    case DetectVectorUnit::kGFNI_AVX2:   return 2*sizeof(__m256i);
+    case DetectVectorUnit::kAVX512BW:
+    case DetectVectorUnit::kGFNI_AVX512: return 2*sizeof(__m512i);
+    default:                             return 0;
+    }
+  }
+
+  // Convert the first (size & ~(rs_wide_unit()-1)) bytes of src to or from the split-plane
+  // layout of the selected PSHUFB or GFNI kernel in dst (the rest is always in the normal
+  // layout, and is copied if dst is not src). Returns how many bytes were converted.
+  static size_t rs_split_planes(void *dst, const void *src, size_t size, bool inverse) {
+    const size_t unit = rs_wide_unit();
+    const size_t vsz = unit ? size & ~(unit-1) : 0;
+    switch (unit) {
+    case 2*sizeof(__m128i): rs_split_planes_sse2(dst, src, vsz, inverse); break;
+    case 2*sizeof(__m256i): rs_split_planes_avx2(dst, src, vsz, inverse); break;
+    case 2*sizeof(__m512i): rs_split_planes_avx512bw(dst, src, vsz, inverse); break;
+    default:                break;
+    }
+    if (dst != src)
+      memcpy((u8*) dst + vsz, (const u8*) src + vsz, size - vsz);
+    return vsz;
+  }
+
+  // Both kinds of table are built, so that the tables suit whichever PSHUFB or GFNI
+  // kernel is selected (and the nibble tables also serve rs_process_nibble()).
+  static void rs_build_wide_tables(rs_wide_tables &t, const u32 *L, const u32 *H) {
+    rs_build_nibble_tables(t.nt, L, H);
+  #if HAVE_GFNI_KERNELS
+    rs_build_affine_matrices(t.m, L, H);
+  #endif
+  }
+
+  // Process size bytes (which are in the normal layout) one word at a time using the
+  // nibble tables nt; this handles what is left over after the PSHUFB or GFNI kernel.
+  // (dst may be the same as src.)
+  static void rs_process_nibble(void *dst, const void *src, size_t size, const u8 *nt, bool store = false) {
+    u8 *d = (u8*) dst;
+    const u8 *s = (const u8*) src;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+      const unsigned int lo = s[i], hi = s[i + 1];
+      const u8 pl = nt[0*16 + (lo & 15)] ^ nt[2*16 + (lo >> 4)] ^ nt[4*16 + (hi & 15)] ^ nt[6*16 + (hi >> 4)];
+      const u8 ph = nt[1*16 + (lo & 15)] ^ nt[3*16 + (lo >> 4)] ^ nt[5*16 + (hi & 15)] ^ nt[7*16 + (hi >> 4)];
+      d[i]     = store ? pl : u8(d[i] ^ pl);
+      d[i + 1] = store ? ph : u8(d[i + 1] ^ ph);
+    }
+  }
+
+  // Run the selected PSHUFB or GFNI kernel over size bytes (a multiple of rs_wide_unit()),
+  // which are in the split-plane layout if split is true.
+  template <bool split>
+  static void rs_process_wide_tables(void *dst, const void *src, size_t size, const rs_wide_tables &t, bool store) {
+    switch (DetectVectorUnit::kernel) {
+    case DetectVectorUnit::kAVX512BW:    rs_process_avx512bw<split>(dst, src, size, t.nt, store); break;
+    case DetectVectorUnit::kAVX2:        rs_process_avx2<split>(dst, src, size, t.nt, store); break;
+    case DetectVectorUnit::kSSSE3:       rs_process_ssse3<split>(dst, src, size, t.nt, store); break;
+  #if HAVE_GFNI_KERNELS
+    case DetectVectorUnit::kGFNI_AVX512: rs_process_gfni_avx512<split>(dst, src, size, t.m, store); break;
+    case DetectVectorUnit::kGFNI_AVX2:   rs_process_gfni_avx2<split>(dst, src, size, t.m, store); break;
+    case DetectVectorUnit::kGFNI:        rs_process_gfni<split>(dst, src, size, t.m, store); break;
+  #endif
+    default:                             break;
+    }
+  }
+
+  // Run the selected PSHUFB or GFNI kernel over size bytes (a multiple of rs_wide_unit())
+  // starting at offset, summing the products of the n source buffers src[k] (with
+  // factors t[k]) into dst.
+  template <bool split>
+  static void rs_process_multi_wide_tables(u8 *dst, const u8 * const *src, const rs_wide_tables * const *t, u32 n,
+                                           size_t offset, size_t size, bool store) {
+    enum { maxinputs = ReedSolomon<Galois16>::ProcessMultipleInputCount };
+    assert(n <= maxinputs);
+    const u8 *s[maxinputs];
+    for (u32 k = 0; k != n; ++k)
+      s[k] = src[k] + offset;
+
+    switch (DetectVectorUnit::kernel) {
+  #if HAVE_GFNI_KERNELS
+    case DetectVectorUnit::kGFNI_AVX512:
+    case DetectVectorUnit::kGFNI_AVX2:
+    case DetectVectorUnit::kGFNI:
+      {
+        const u64 *m[maxinputs];
+        for (u32 k = 0; k != n; ++k)
+          m[k] = t[k]->m;
+        if (DetectVectorUnit::kGFNI_AVX512 == DetectVectorUnit::kernel)
+          rs_process_multi_gfni_avx512<split>(dst + offset, s, n, size, m, store);
+        else if (DetectVectorUnit::kGFNI_AVX2 == DetectVectorUnit::kernel)
+          rs_process_multi_gfni_avx2<split>(dst + offset, s, n, size, m, store);
+        else
+          rs_process_multi_gfni<split>(dst + offset, s, n, size, m, store);
+      }
+      break;
+  #endif
+    default:
+      {
+        const u8 *nt[maxinputs];
+        for (u32 k = 0; k != n; ++k)
+          nt[k] = t[k]->nt;
+        if (DetectVectorUnit::kAVX512BW == DetectVectorUnit::kernel)
+          rs_process_multi_avx512bw<split>(dst + offset, s, n, size, nt, store);
+        else if (DetectVectorUnit::kAVX2 == DetectVectorUnit::kernel)
+          rs_process_multi_avx2<split>(dst + offset, s, n, size, nt, store);
+        else if (DetectVectorUnit::kSSSE3 == DetectVectorUnit::kernel)
+          rs_process_multi_ssse3<split>(dst + offset, s, n, size, nt, store);
+      }
+      break;
+    }
+  }
+
+  // Run the selected PSHUFB or GFNI kernel. Returns the number of bytes processed
+  // (the remainder is left for rs_process_nibble()).
+  static size_t rs_process_wide(void *dst, const void *src, size_t size, const rs_wide_tables &t, bool split, bool store) {
+    const size_t unit = rs_wide_unit();
+    const size_t vsz = unit ? size & ~(unit-1) : 0;
+    if (vsz) {
+      if (split)
+        rs_process_wide_tables<true>(dst, src, vsz, t, store);
+      else
+        rs_process_wide_tables<false>(dst, src, vsz, t, store);
+    }
+    return vsz;
+  }
+
+  // ProcessMultiple() works through the input in strips of this many bytes. A strip of
+  // the input and one of the output stay in the L1 cache while the strip is combined
+  // with each of the output buffers in turn. (Must be a multiple of every rs_wide_unit().)
+  static const size_t rs_strip_size = 8 * 1024;
+
+  // The strip length when n input strips are summed into each output strip: the strips
+  // are shortened so that all of them still fit in about the same amount of cache.
+  static size_t rs_strip_length(u32 n) {
+    const size_t length = (2 * rs_strip_size / (n + 1)) & ~(size_t)(2*sizeof(__m512i)-1);
+    return max(length, (size_t) 1024);
+  }
+
+  namespace DetectCache {
+    namespace internal {
+      // The size of the L2 cache of one core, or 0 if it cannot be determined.
+      static size_t L2Size(void) {
+    #if defined(_SC_LEVEL2_CACHE_SIZE)
+        long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (size > 0)
+          return (size_t) size;
+    #elif __APPLE__
+        u64 size = 0;
+        size_t length = sizeof(size);
+        if (0 == sysctlbyname("hw.l2cachesize", &size, &length, NULL, 0) && size > 0)
+          return (size_t) size;
+    #endif
+        // AMD and Intel CPUs both report the L2 size (in KB) in CPUID 0x80000006
+        unsigned int a, b, c, d;
+        if (__get_cpuid(0x80000006, &a, &b, &c, &d))
+          return (size_t) (c >> 16) * 1024;
+        return 0;
+      }
+
+      // The size of the shared L3 cache, or 0 if there isn't one.
+      static size_t L3Size(void) {
+    #if defined(_SC_LEVEL3_CACHE_SIZE)
+        long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size > 0)
+          return (size_t) size;
+    #elif __APPLE__
+        u64 size = 0;
+        size_t length = sizeof(size);
+        if (0 == sysctlbyname("hw.l3cachesize", &size, &length, NULL, 0) && size > 0)
+          return (size_t) size;
+    #endif
+        return 0;
+      }
+
+      // How much cache the input tiles of ProcessMultiple() may use: half of the L2
+      // cache, leaving the rest for the output rows, the tables and everything else.
+      // Without a (reported) L2 cache, the share of the L3 cache of a core is used.
+      static size_t TileCacheSize(void) {
+        size_t size = L2Size();
+    #if WANT_CONCURRENT
+        if (0 == size)
+          size = L3Size() / max(tbb::task_scheduler_init::default_num_threads(), 1);
+    #else
+        if (0 == size)
+          size = L3Size();
+    #endif
+        if (0 == size)
+          size = 256 * 1024;
+        return max(size / 2, 4 * rs_strip_size);
+      }
+    }
+
+    static const size_t tileCacheSize = internal::TileCacheSize();
+  }
+
+  // ProcessMultiple() combines a tile of this many bytes of each of n input blocks with
+  // every output block before moving on to the next tile, so that the input tiles are
+  // only read from memory once. (A multiple of rs_strip_size, so the strips are unchanged.)
+  static size_t rs_tile_length(u32 n) {
+    const size_t length = (DetectCache::tileCacheSize / n) & ~(rs_strip_size-1);
+    return max(length, rs_strip_size);
+  }
+#endif
+
+#ifdef LONGMULTIPLY
+// Combine the four 8-bit long multiplication tables for factor into the two
+// tables L (factor * source.low) and H (factor * source.high) used by the kernels.
+static void rs_build_lh_tables(const Galois16 *table, const Galois16 &factor, unsigned int *lhTable)
+{
+  // Split the factor into Low and High bytes
+  unsigned int fl = (factor >> 0) & 0xff;
+  unsigned int fh = (factor >> 8) & 0xff;
+
+  // Get the four separate multiplication tables
+  const Galois16 *LL = &table[(0*256 + fl) * 256 + 0]; // factor.low  * source.low
+  const Galois16 *LH = &table[(1*256 + fl) * 256 + 0]; // factor.low  * source.high
+  const Galois16 *HL = &table[(1*256 + 0) * 256 + fh]; // factor.high * source.low
+  const Galois16 *HH = &table[(2*256 + fh) * 256 + 0]; // factor.high * source.high
+
+  // Combine the four multiplication tables into two
+  typedef unsigned int LHEntry;
+//LHEntry L[512]; // Double the space required but
+//LHEntry H[512]; // save ONE shift instruction.
+  LHEntry* L = &lhTable[0];
+  LHEntry* H = &lhTable[256];
+//LHEntry lhTable[256*2 *2];
+//LHEntry* L = &lhTable[0];
+//LHEntry* H = &lhTable[512];
+
+  #if __BYTE_ORDER == __LITTLE_ENDIAN
+  LHEntry *pL = &L[0];
+  LHEntry *pH = &H[0];
+  #else
+  LHEntry *pL = &H[0];
+  LHEntry *pH = &L[0];
+  #endif
+
+  for (unsigned int i=0; i<256; i++)
+  {
+    LHEntry temp;
+    {
+      temp = *LL + *HL;
+  #if __BYTE_ORDER == __LITTLE_ENDIAN
+  #else
+      temp = (temp >> 8) & 0xff | (temp << 8) & 0xff00;
+  #endif
+
+      *pL++ = temp;
+      LL++;
+      HL+=256;
+
+      //pL[255] = temp << 16;
+    }
+
+    {
+      temp = *LH + *HH;
+  #if __BYTE_ORDER == __LITTLE_ENDIAN
+  #else
+      temp = (temp >> 8) & 0xff | (temp << 8) & 0xff00;
+  #endif
+
+      *pH++ = temp;
+      LH++;
+      HH++;
+
+      //pH[255] = temp << 16;
+    }
+  }
+}
+
+// Process size bytes using the L and H tables (lhTable) with the MMX and/or scalar code.
+static void rs_process_lh(void *outputbuffer, const void *inputbuffer, size_t size, const unsigned int *lhTable)
+{
+  #if !(__GNUC__ && (__x86_64__ || __i386__))
+  const unsigned int *L = &lhTable[0];
+  const unsigned int *H = &lhTable[256];
+  #endif
+
+  if (DetectVectorUnit::kernel != DetectVectorUnit::kScalar && size) {
+    enum { sizeof_work_unit = DetectVectorUnit::sizeof_work_unit };
+    // asz = alignment size = # of bytes to process using scalar code before vector code can be used
+    // vsz = vector size = # of bytes to process using vector code
+    size_t asz = (sizeof_work_unit - (uintptr_t) inputbuffer) & (sizeof_work_unit-1); // 0...(sizeof_work_unit-1)
+    size_t vsz = (size-asz) & ~(sizeof_work_unit-1);
+    if (vsz) {
+      if (asz) {
+  #if __GNUC__ &&  __x86_64__
+        rs_process_x86_64_scalar(outputbuffer, inputbuffer, asz, lhTable);
+  #elif __GNUC__ &&  __i386__
+        rs_process_i386_scalar(outputbuffer, inputbuffer, asz, lhTable);
+  #else
+        // Treat the buffers as arrays of 32-bit unsigned ints.
+        u32 *src = (u32 *)inputbuffer;
+        u32 *end = (u32 *)&((u8*)inputbuffer)[asz];
+        u32 *dst = (u32 *)outputbuffer;
+  
+        // Process the data
+        do {
+          u32 s = *src++;
+
+          // Use the two lookup tables computed earlier
+
+          // Visual C++ generates better code with this version (mostly because of the casts):
+          u16 sw = u16(s >> 16);
+          u32 d  = L[u8(sw >> 0)];
+              d ^= H[u8(sw >> 8)];
+              d <<= 16;
+              d ^= *dst ^ (L[u8(       s  >>  0)]      )
+                        ^ (H[u8(((u16) s) >>  8)]      );
+        //u32 d  = (L+256)[u8(sw >> 0)]; // use pre-shifted entries
+        //    d ^= (H+256)[u8(sw >> 8)]; // use pre-shifted entries
+        //    d ^= *dst ^ (L[u8(       s  >>  0)]      )
+        //              ^ (H[u8(((u16) s) >>  8)]      );
+
+          // the original version (too many shift's and and's):
+        //u32 d = *dst ^ (L[(s >> 0) & 0xff]      )
+        //             ^ (H[(s >> 8) & 0xff]      )
+        //             ^ (L[(s >> 16)& 0xff] << 16)
+        //             ^ (H[(s >> 24)& 0xff] << 16);
+          *dst++ = d;
+        } while (src < end);
+
+  #endif
+        (u8*&) outputbuffer += asz;
+        (u8*&) inputbuffer  += asz;
+        size -= asz;
+      } // if (asz)
+
+  #if __GNUC__ &&  __x86_64__
+      rs_process_x86_64_mmx(outputbuffer, inputbuffer, vsz, lhTable);
+  #elif __GNUC__ &&  __i386__
+      rs_process_i686_mmx(outputbuffer, inputbuffer, vsz, lhTable);
+    //rs_process_i686_sse2(outputbuffer, inputbuffer, vsz, lhTable);
+  #elif defined(WIN64) || defined(WIN32)
+      rs_process_simd(outputbuffer, inputbuffer, vsz, lhTable);
+  #else
+      vsz = 0; // no SIMD unit, so set vsz = 0
+  #endif
+
+      (u8*&) outputbuffer += vsz;
+      (u8*&) inputbuffer  += vsz;
+      size -= vsz;
+    } // if (vsz)
+  }
+
+  if (size) {
+  #if __GNUC__ && __x86_64__
+    rs_process_x86_64_scalar(outputbuffer, inputbuffer, size, lhTable);
+  #elif __GNUC__ &&  __i386__
+    rs_process_i386_scalar(outputbuffer, inputbuffer, size, lhTable);
+  #else // only Visual C++ produces decent x86 code for the following:
+    // Treat the buffers as arrays of 32-bit unsigned ints.
+    u32 *src = (u32 *)inputbuffer;
+    u32 *end = (u32 *)&((u8*)inputbuffer)[size];
+    u32 *dst = (u32 *)outputbuffer;
+  
+    // Process the data
+    do {
+      u32 s = *src++;
+
+      // Use the two lookup tables computed earlier
+
+      // Visual C++ generates better code with this version (mostly because of the casts):
+      u16 sw = u16(s >> 16);
+      u32 d  = L[u8(sw >> 0)];
+          d ^= H[u8(sw >> 8)];
+          d <<= 16;
+          d ^= *dst ^ (L[u8(       s  >>  0)]      )
+                    ^ (H[u8(((u16) s) >>  8)]      );
+    /*u32 d  = (L+256)[u8(sw >> 0)]; // use pre-shifted entries
+          d ^= (H+256)[u8(sw >> 8)]; // use pre-shifted entries
+          d ^= *dst ^ (L[u8(       s  >>  0)]      )
+                    ^ (H[u8(((u16) s) >>  8)]      )
+                    ; // <- one shift instruction eliminated*/
 
       // the original version (too many shift's and and's):
     //u32 d = *dst ^ (L[(s >> 0) & 0xff]      )
@@ -670,6 +1600,197 @@ template <> bool ReedSolomon<Galois16>::InternalProcess(
 
   #endif
   }
+}
+#endif
+
+RSTableCache::RSTableCache(void)
+: arena(0)
+, slotsize(0)
+, slotcount(0)
+, state(0)
+{
+  slotsused = 0;
+}
+
+RSTableCache::~RSTableCache(void)
+{
+  delete [] arena;
+  delete [] state;
+}
+
+void RSTableCache::Reset(size_t _slotsize, size_t slots)
+{
+  delete [] arena;
+  arena = 0;
+
+  slotsize = _slotsize;
+  slotcount = slots;
+  slotsused = 0;
+
+  if (!state)
+    state = new state_type[Keys];
+  for (u32 key=0; key<Keys; key++)
+    state[key] = 0;
+
+  if (slotsize > 0 && slotcount > 0)
+    arena = new u8[slotsize * slotcount];
+}
+
+const void* RSTableCache::Find(u32 key, void **slot)
+{
+  *slot = 0;
+  if (!arena)
+    return 0;
+
+  const u32 s = state[key];
+  if (s >= 2)
+    return &arena[(s - 2) * slotsize];
+
+  // Claim the key, then a slot for it. A key which cannot have a slot is left
+  // claimed so that later calls do not try again.
+  if (0 == s)
+  {
+#if WANT_CONCURRENT
+    if (0 == state[key].compare_and_swap(1, 0))
+    {
+      const size_t n = slotsused.fetch_and_increment();
+#else
+    {
+      state[key] = 1;
+      const size_t n = slotsused++;
+#endif
+      if (n < slotcount)
+        *slot = &arena[n * slotsize];
+    }
+  }
+
+  return 0;
+}
+
+void RSTableCache::Publish(u32 key, void *slot)
+{
+  state[key] = 2 + (u32) (((u8*) slot - arena) / slotsize);
+}
+
+#ifdef LONGMULTIPLY
+// The L and H tables for one factor, as used by the MMX and scalar code.
+struct rs_lh_tables
+{
+  unsigned int lh[256*2]; // (using an array of ints forces the compiler to align on a 4-byte boundary)
+};
+
+// The most memory the table cache of a ReedSolomon<Galois16> may use.
+static const size_t rs_table_cache_limit = 16 * 1024 * 1024;
+
+// The L and H tables for factor: the cached ones, or else those built in local.
+static const unsigned int* rs_cached_lh_tables(RSTableCache &cache, const Galois16 *table, const Galois16 &factor, rs_lh_tables &local)
+{
+  void *slot = 0;
+  if (sizeof(rs_lh_tables) == cache.SlotSize())
+  {
+    const void *cached = cache.Find(factor, &slot);
+    if (cached)
+      return ((const rs_lh_tables*) cached)->lh;
+  }
+
+  rs_lh_tables *t = slot ? (rs_lh_tables*) slot : &local;
+  rs_build_lh_tables(table, factor, t->lh);
+  if (slot)
+    cache.Publish(factor, slot);
+  return t->lh;
+}
+
+  #if HAVE_SPLIT_NIBBLE_KERNELS
+// The PSHUFB and GFNI tables for factor: the cached ones, or else those built in local.
+static const rs_wide_tables& rs_cached_wide_tables(RSTableCache &cache, const Galois16 *table, const Galois16 &factor, rs_wide_tables &local)
+{
+  void *slot = 0;
+  if (sizeof(rs_wide_tables) == cache.SlotSize())
+  {
+    const void *cached = cache.Find(factor, &slot);
+    if (cached)
+      return *(const rs_wide_tables*) cached;
+  }
+
+  rs_wide_tables *t = slot ? (rs_wide_tables*) slot : &local;
+  rs_lh_tables lh;
+  rs_build_lh_tables(table, factor, lh.lh);
+  rs_build_wide_tables(*t, &lh.lh[0], &lh.lh[256]);
+  if (slot)
+    cache.Publish(factor, slot);
+  return *t;
+}
+  #endif
+#endif
+
+// The cache holds the tables of whichever code processes the data: the PSHUFB or GFNI
+// kernels if one is selected, otherwise the MMX and scalar code.
+template <> void ReedSolomon<Galois16>::ResetTables(u32 elements)
+{
+#ifdef LONGMULTIPLY
+  size_t slotsize = sizeof(rs_lh_tables);
+  #if HAVE_SPLIT_NIBBLE_KERNELS
+  if (0 != rs_wide_unit())
+    slotsize = sizeof(rs_wide_tables);
+  #endif
+
+  // There are no more factors than matrix elements or Galois16 values.
+  const size_t slots = min(min((size_t) elements, (size_t) RSTableCache::Keys), rs_table_cache_limit / slotsize);
+  tablecache.Reset(slotsize, slots);
+#endif
+}
+
+// Used for the matrix rows while solving them: long rows go through the PSHUFB or
+// GFNI kernel with the cached tables for factor, short ones are left to the scalar
+// code (the matrices are always in the normal layout).
+template <> void ReedSolomon<Galois16>::MultiplyAdd(Galois16 *dst, const Galois16 *src, u32 count, const Galois16 &factor, bool store)
+{
+#if defined(LONGMULTIPLY) && HAVE_SPLIT_NIBBLE_KERNELS
+  const size_t size = count * sizeof(Galois16);
+  if (0 != rs_wide_unit() && size >= 4 * rs_wide_unit())
+  {
+    rs_wide_tables local;
+    const rs_wide_tables &t = rs_cached_wide_tables(tablecache, glmt->tables, factor, local);
+    const size_t psz = rs_process_wide(dst, src, size, t, false, store);
+    rs_process_nibble((u8*) dst + psz, (const u8*) src + psz, size - psz, t.nt, store);
+    return;
+  }
+#endif
+
+  rs_multiply_add(dst, src, count, factor, store);
+}
+
+template <> bool ReedSolomon<Galois16>::InternalProcess(
+  const Galois16 &factor, size_t size, buffer& ib, u32 outputindex, void *outputbuffer)
+{
+  const void *inputbuffer = ib.data();
+#ifdef LONGMULTIPLY
+  #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
+  if (has_gpu_ && size >= sizeof(u32) && 0 == (size & (sizeof(u32)-1))) {
+    const size_t n = (size / sizeof(u32));
+    rs_lh_tables local;
+    const unsigned int *lhTable = rs_cached_lh_tables(tablecache, glmt->tables, factor, local);
+    // when called from pipeline_state in par2pipeline.h, ib will always be an instance
+    // of pipeline_buffer and hence always an instance of rcbuffer:
+    if (cuda::Process(n, static_cast<rcbuffer&> (ib), lhTable, outputindex)) // EXECUTE
+      return eSuccess;
+  }
+  #endif
+
+  #if HAVE_SPLIT_NIBBLE_KERNELS
+  if (0 != rs_wide_unit()) {
+    // bytes processed by the selected PSHUFB or GFNI kernel; any remainder
+    // is then handled one word at a time with its nibble tables.
+    rs_wide_tables local;
+    const rs_wide_tables &t = rs_cached_wide_tables(tablecache, glmt->tables, factor, local);
+    const size_t psz = rs_process_wide(outputbuffer, inputbuffer, size, t, splitplanes_, false);
+    rs_process_nibble((u8*) outputbuffer + psz, (const u8*) inputbuffer + psz, size - psz, t.nt);
+    return eSuccess;
+  }
+  #endif
+
+  rs_lh_tables local;
+  rs_process_lh(outputbuffer, inputbuffer, size, rs_cached_lh_tables(tablecache, glmt->tables, factor, local));
 #else
   // Treat the buffers as arrays of 16-bit Galois values.
 
@@ -687,3 +1808,423 @@ template <> bool ReedSolomon<Galois16>::InternalProcess(
 
   return eSuccess;
 }
+
+#if HAVE_SPLIT_NIBBLE_KERNELS
+// The inputs ProcessMultiple() adds to one output block, with their tables (which
+// are only built in tables[] if they are not in the table cache).
+struct rs_multi_row
+{
+  u8                   *dst;
+  bool                  store;  // overwrite dst rather than add to it
+  u32                   inputs;
+  const u8             *src[ReedSolomon<Galois16>::ProcessMultipleInputCount];
+  const rs_wide_tables *t[ReedSolomon<Galois16>::ProcessMultipleInputCount];
+  rs_wide_tables        tables[ReedSolomon<Galois16>::ProcessMultipleInputCount];
+};
+
+// The rows for count output blocks, kept by each thread from one call of
+// ProcessMultiple() to the next rather than allocated by every call.
+static rs_multi_row *rs_multi_rows(u32 count)
+{
+#if WANT_CONCURRENT
+  static tbb::enumerable_thread_specific< std::vector<rs_multi_row> > perthread;
+  std::vector<rs_multi_row> &rows = perthread.local();
+#else
+  static std::vector<rs_multi_row> rows;
+#endif
+  if (rows.size() < count)
+    rows.resize(count);
+  return &rows[0];
+}
+#endif
+
+// Process several blocks of input data into several output blocks.
+template <> bool ReedSolomon<Galois16>::ProcessMultiple(
+  size_t size, u32 incount, const u32 *inputindex, buffer * const *ib,
+  u32 count, const u32 *outputindex, void * const *outputbuffer, u8 *initialised)
+{
+  if (0 == size)
+    return true;
+
+  const u32 columns = datapresent + datamissing;
+
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  const size_t unit = rs_wide_unit();
+  size_t vsz = unit ? size & ~(unit-1) : 0;
+  #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
+  if (has_gpu_)
+    vsz = 0; // InternalProcess() decides which blocks the GPU processes
+  #endif
+
+  if (vsz) {
+    // The tables for every output row are built first. Then each tile of the inputs
+    // is combined with all of the output rows while it is in the L2 cache: the rows
+    // in batches, each working through the tile in strips which stay in the L1 cache.
+    enum { maxrows = ProcessMultipleCount, maxinputs = ProcessMultipleInputCount };
+    rs_multi_row             *rows = rs_multi_rows(count);
+    const u8                 *src[maxinputs];
+
+    for (u32 ifirst = 0; ifirst < incount; ifirst += maxinputs) {
+      const u32 ilast = min(incount, ifirst + (u32) maxinputs);
+      for (u32 k = ifirst; k != ilast; ++k)
+        src[k - ifirst] = ib[k]->data();
+
+      u32 n = 0;
+      size_t maxin = 0;
+      for (u32 i = 0; i != count; ++i) {
+        rs_multi_row &row = rows[n];
+        row.dst = (u8 *) outputbuffer[i];
+        row.store = initialised && !initialised[i];
+
+        u32 m = 0;
+        for (u32 k = ifirst; k != ilast; ++k) {
+          // Look up the appropriate element in the RS matrix
+          const Galois16 factor = leftmatrix[outputindex[i] * columns + inputindex[k]];
+          if (factor == 0)
+            continue;
+
+          row.t[m] = &rs_cached_wide_tables(tablecache, glmt->tables, factor, row.tables[m]);
+          row.src[m] = src[k - ifirst];
+
+          // The end of the block (less than one kernel unit) is done a word at a time.
+          if (size > vsz) {
+            if (row.store && 0 == m)
+              memset(row.dst + vsz, 0, size - vsz);
+            rs_process_nibble(row.dst + vsz, src[k - ifirst] + vsz, size - vsz, row.t[m]->nt);
+          }
+          ++m;
+        }
+        if (0 == m)
+          continue; // nothing to add to this output block
+
+        if (initialised)
+          initialised[i] = true;
+        row.inputs = m;
+        maxin = max(maxin, (size_t) m);
+        ++n;
+      }
+      if (0 == n)
+        continue;
+
+      const size_t tile = rs_tile_length((u32) maxin);
+      const size_t strip = rs_strip_length((u32) maxin);
+      for (size_t tfirst = 0; tfirst < vsz; tfirst += tile) {
+        const size_t tlast = min(vsz, tfirst + tile);
+        for (u32 first = 0; first < n; first += maxrows) {
+          const u32 last = min(n, first + (u32) maxrows);
+          for (size_t offset = tfirst; offset < tlast; offset += strip) {
+            const size_t length = min(strip, tlast - offset);
+            for (u32 r = first; r != last; ++r) {
+              if (splitplanes_)
+                rs_process_multi_wide_tables<true>(rows[r].dst, rows[r].src, rows[r].t, rows[r].inputs, offset, length, rows[r].store);
+              else
+                rs_process_multi_wide_tables<false>(rows[r].dst, rows[r].src, rows[r].t, rows[r].inputs, offset, length, rows[r].store);
+            }
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+#endif
+
+  // No PSHUFB or GFNI kernel: one input and output block at a time.
+  for (u32 i = 0; i != count; ++i) {
+    for (u32 k = 0; k != incount; ++k) {
+      const Galois16 factor = leftmatrix[outputindex[i] * columns + inputindex[k]];
+      if (factor == 0)
+        continue;
+      if (initialised && !initialised[i]) {
+        memset(outputbuffer[i], 0, size);
+        initialised[i] = true;
+      }
+      InternalProcess(factor, size, *ib[k], outputindex[i], outputbuffer[i]);
+    }
+  }
+
+  return true;
+}
+
+template <> bool ReedSolomon<Galois16>::SetSplitPlanes(bool enable)
+{
+  splitplanes_ = false;
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
+  if (has_gpu_)
+    return !enable; // the GPU processes buffers in the normal layout
+  #endif
+  if (enable && 0 != rs_wide_unit())
+    splitplanes_ = true;
+#endif
+  return enable == splitplanes_;
+}
+
+template <> size_t ReedSolomon<Galois16>::ProcessedLength(size_t datalength, size_t size) const
+{
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  #if WANT_CONCURRENT && CONCURRENT_PIPELINE && GPGPU_CUDA
+  if (has_gpu_)
+    return size; // the GPU processes whole blocks
+  #endif
+  const size_t unit = rs_wide_unit();
+  if (unit) {
+    // The units of the kernel, the last of which is followed by a tail which is
+    // processed (and laid out) a word at a time
+    const size_t length = (datalength + unit-1) & ~(unit-1);
+    return length < (size & ~(unit-1)) ? length : size;
+  }
+#endif
+  return min(size, (datalength + 15) & ~(size_t)15);
+}
+
+template <> void ReedSolomon<Galois16>::ToSplitPlanes(void *buffer, size_t size) const
+{
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  if (splitplanes_)
+    rs_split_planes(buffer, buffer, size, false);
+#endif
+}
+
+template <> void ReedSolomon<Galois16>::ToSplitPlanes(void *dst, const void *src, size_t size) const
+{
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  if (splitplanes_)
+  {
+    rs_split_planes(dst, src, size, false);
+    return;
+  }
+#endif
+  memcpy(dst, src, size);
+}
+
+template <> void ReedSolomon<Galois16>::FromSplitPlanes(void *buffer, size_t size) const
+{
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  if (splitplanes_)
+    rs_split_planes(buffer, buffer, size, true);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////
+
+
+
+#if HAVE_SPLIT_NIBBLE_KERNELS
+  // The Galois8 (PAR 1.0) versions of the PSHUFB and GFNI kernels, selected in the
+  // same way. Each byte is multiplied by the factor using the tables nt[0..15] and
+  // nt[16..31] of the products of its low and high nibble (PSHUFB), or the 8x8 bit
+  // matrix m of the multiplication (GFNI). They process (size & ~(sizeof(register)-1))
+  // bytes, XORing the products into dst, and return that count.
+  static void rs_build_nibble_tables8(u8 *nt, const u32 *L) {
+    for (unsigned int n=0; n<16; n++) {
+      nt[0*16 + n] = u8(L[n]);
+      nt[1*16 + n] = u8(L[n << 4]);
+    }
+  }
+
+  __attribute__((target("ssse3")))
+  static size_t rs_process8_ssse3(void *dst, const void *src, size_t size, const u8 *nt) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i tl = _mm_loadu_si128((const __m128i*) &nt[0]), th = _mm_loadu_si128((const __m128i*) &nt[16]);
+    const __m128i *s = (const __m128i*) src;
+    __m128i *d = (__m128i*) dst;
+    const size_t n = size / sizeof(__m128i);
+    for (size_t i = 0; i < n; ++i) {
+      const __m128i a = _mm_loadu_si128(s + i);
+      const __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tl, _mm_and_si128(a, nibble)),
+                                      _mm_shuffle_epi8(th, _mm_and_si128(_mm_srli_epi16(a, 4), nibble)));
+      _mm_storeu_si128(d + i, _mm_xor_si128(_mm_loadu_si128(d + i), p));
+    }
+    return n * sizeof(__m128i);
+  }
+
+  __attribute__((target("avx2")))
+  static size_t rs_process8_avx2(void *dst, const void *src, size_t size, const u8 *nt) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i tl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &nt[0]));
+    const __m256i th = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) &nt[16]));
+    const __m256i *s = (const __m256i*) src;
+    __m256i *d = (__m256i*) dst;
+    const size_t n = size / sizeof(__m256i);
+    for (size_t i = 0; i < n; ++i) {
+      const __m256i a = _mm256_loadu_si256(s + i);
+      const __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tl, _mm256_and_si256(a, nibble)),
+                                         _mm256_shuffle_epi8(th, _mm256_and_si256(_mm256_srli_epi16(a, 4), nibble)));
+      _mm256_storeu_si256(d + i, _mm256_xor_si256(_mm256_loadu_si256(d + i), p));
+    }
+    return n * sizeof(__m256i);
+  }
+
+  __attribute__((target("avx512f,avx512bw")))
+  static size_t rs_process8_avx512bw(void *dst, const void *src, size_t size, const u8 *nt) {
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i tl = _mm512_maskz_broadcast_i32x4((__mmask16) -1, _mm_loadu_si128((const __m128i*) &nt[0]));
+    const __m512i th = _mm512_maskz_broadcast_i32x4((__mmask16) -1, _mm_loadu_si128((const __m128i*) &nt[16]));
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    const size_t n = size / sizeof(__m512i);
+    for (size_t i = 0; i < n * sizeof(__m512i); i += sizeof(__m512i)) {
+      const __m512i a = _mm512_loadu_si512((const void*) &s[i]);
+      const __m512i p = _mm512_xor_si512(_mm512_shuffle_epi8(tl, _mm512_and_si512(a, nibble)),
+                                         _mm512_shuffle_epi8(th, _mm512_and_si512(_mm512_srli_epi16(a, 4), nibble)));
+      _mm512_storeu_si512((void*) &d[i], _mm512_xor_si512(_mm512_loadu_si512((const void*) &d[i]), p));
+    }
+    return n * sizeof(__m512i);
+  }
+
+  #if HAVE_GFNI_KERNELS
+  // The bit matrix (in the operand format of vgf2p8affineqb) of the multiplication
+  // whose column j is L[1 << j].
+  static u64 rs_build_affine_matrix8(const u32 *L) {
+    u64 m = 0;
+    for (unsigned int i=0; i<8; i++) {
+      u64 row = 0;
+      for (unsigned int j=0; j<8; j++)
+        row |= (u64) ((L[1 << j] >> i) & 1) << j;
+      m |= row << (8*(7-i));
+    }
+    return m;
+  }
+
+  __attribute__((target("sse2,gfni")))
+  static size_t rs_process8_gfni(void *dst, const void *src, size_t size, u64 m) {
+    const __m128i mv = _mm_set1_epi64x(m);
+    const __m128i *s = (const __m128i*) src;
+    __m128i *d = (__m128i*) dst;
+    const size_t n = size / sizeof(__m128i);
+    for (size_t i = 0; i < n; ++i)
+      _mm_storeu_si128(d + i, _mm_xor_si128(_mm_loadu_si128(d + i), _mm_gf2p8affine_epi64_epi8(_mm_loadu_si128(s + i), mv, 0)));
+    return n * sizeof(__m128i);
+  }
+
+  __attribute__((target("avx2,gfni")))
+  static size_t rs_process8_gfni_avx2(void *dst, const void *src, size_t size, u64 m) {
+    const __m256i mv = _mm256_set1_epi64x(m);
+    const __m256i *s = (const __m256i*) src;
+    __m256i *d = (__m256i*) dst;
+    const size_t n = size / sizeof(__m256i);
+    for (size_t i = 0; i < n; ++i)
+      _mm256_storeu_si256(d + i, _mm256_xor_si256(_mm256_loadu_si256(d + i), _mm256_gf2p8affine_epi64_epi8(_mm256_loadu_si256(s + i), mv, 0)));
+    return n * sizeof(__m256i);
+  }
+
+  __attribute__((target("avx512f,avx512bw,gfni")))
+  static size_t rs_process8_gfni_avx512(void *dst, const void *src, size_t size, u64 m) {
+    const __m512i mv = _mm512_set1_epi64(m);
+    const u8 *s = (const u8*) src;
+    u8 *d = (u8*) dst;
+    const size_t n = size / sizeof(__m512i);
+    for (size_t i = 0; i < n * sizeof(__m512i); i += sizeof(__m512i))
+      _mm512_storeu_si512((void*) &d[i], _mm512_xor_si512(_mm512_loadu_si512((const void*) &d[i]),
+                                                          _mm512_gf2p8affine_epi64_epi8(_mm512_loadu_si512((const void*) &s[i]), mv, 0)));
+    return n * sizeof(__m512i);
+  }
+  #endif
+
+  // Run the selected PSHUFB or GFNI kernel for the factor whose products are L[0..255].
+  // Returns the number of bytes processed (the remainder is left for the scalar code).
+  static size_t rs_process8_wide(void *dst, const void *src, size_t size, const u32 *L) {
+    u8 nt[2*16];
+    switch (DetectVectorUnit::kernel) {
+    case DetectVectorUnit::kSSSE3:       rs_build_nibble_tables8(nt, L); return rs_process8_ssse3(dst, src, size, nt);
+    case DetectVectorUnit::kAVX2:        rs_build_nibble_tables8(nt, L); return rs_process8_avx2(dst, src, size, nt);
+    case DetectVectorUnit::kAVX512BW:    rs_build_nibble_tables8(nt, L); return rs_process8_avx512bw(dst, src, size, nt);
+  #if HAVE_GFNI_KERNELS
+    case DetectVectorUnit::kGFNI:        return rs_process8_gfni(dst, src, size, rs_build_affine_matrix8(L));
+    case DetectVectorUnit::kGFNI_AVX2:   return rs_process8_gfni_avx2(dst, src, size, rs_build_affine_matrix8(L));
+    case DetectVectorUnit::kGFNI_AVX512: return rs_process8_gfni_avx512(dst, src, size, rs_build_affine_matrix8(L));
+  #endif
+    default:                             return 0;
+    }
+  }
+#endif
+
+template <> bool ReedSolomon<Galois8>::InternalProcess(
+  const Galois8 &factor, size_t size, buffer& ib, u32 outputindex, void *outputbuffer
+  )
+{
+  const void *inputbuffer = ib.data();
+
+#ifdef LONGMULTIPLY
+  // The 8-bit long multiplication tables
+  Galois8 *table = glmt->tables;
+
+  // Split the factor into Low and High bytes
+  unsigned int fl = (factor >> 0) & 0xff;
+
+  // Get the four separate multiplication tables
+  Galois8 *LL = &table[(0*256 + fl) * 256 + 0]; // factor.low  * source.low
+
+  // Combine the four multiplication tables into two
+  unsigned int L[256];
+
+  unsigned int *pL = &L[0];
+
+  for (unsigned int i=0; i<256; i++)
+  {
+    *pL = *LL;
+
+    pL++;
+    LL++;
+  }
+
+  #if HAVE_SPLIT_NIBBLE_KERNELS
+  {
+    // bytes processed by the selected PSHUFB or GFNI kernel; any remainder
+    // is then handled by the code below.
+    const size_t psz = rs_process8_wide(outputbuffer, inputbuffer, size, L);
+    (u8*&) outputbuffer += psz;
+    (const u8*&) inputbuffer += psz;
+    size -= psz;
+  }
+  #endif
+
+  // Treat the buffers as arrays of 32-bit unsigned ints.
+  u32 *src4 = (u32 *)inputbuffer;
+  u32 *end4 = (u32 *)&((u8*)inputbuffer)[size & ~3];
+  u32 *dst4 = (u32 *)outputbuffer;
+
+  // Process the data
+  while (src4 < end4)
+  {
+    u32 s = *src4++;
+
+    // Use the two lookup tables computed earlier
+    *dst4++ ^= (L[(s >> 0) & 0xff]      )
+            ^  (L[(s >> 8) & 0xff] << 8 )
+            ^  (L[(s >> 16)& 0xff] << 16)
+            ^  (L[(s >> 24)& 0xff] << 24);
+  }
+
+  // Process any left over bytes at the end of the buffer
+  if (size & 3)
+  {
+    u8 *src1 = &((u8*)inputbuffer)[size & ~3];
+    u8 *end1 = &((u8*)inputbuffer)[size];
+    u8 *dst1 = &((u8*)outputbuffer)[size & ~3];
+
+    // Process the data
+    while (src1 < end1)
+    {
+      u8 s = *src1++;
+      *dst1++ ^= L[s];
+    }
+  }
+#else
+  // Treat the buffers as arrays of 16-bit Galois values.
+
+  Galois8 *src = (Galois8 *)inputbuffer;
+  Galois8 *end = (Galois8 *)&((u8*)inputbuffer)[size];
+  Galois8 *dst = (Galois8 *)outputbuffer;
+
+  // Process the data
+  while (src < end)
+  {
+    *dst++ += *src++ * factor;
+  }
+#endif
+
+  return eSuccess;
+}
@@ -26,6 +26,13 @@
 
 class buffer;
 
+// Choose the kernel used for the 16-bit multiply-accumulate in Process().
+// The fastest kernel supported by the CPU is used by default ("auto"); the
+// PAR2_KERNEL environment variable and the -k command line option override it.
+bool        SelectGalois16Kernel(const string &name); // false if unknown or unsupported
+const char* Galois16KernelName(void);                 // the kernel currently in use
+string      AvailableGalois16Kernels(void);           // space separated list
+
 // The ReedSolomon object is used to calculate and store the matrix
 // used during recovery block creation or data block reconstruction.
 //
@@ -33,6 +40,45 @@ class buffer;
 // recovery block that either needs to be created or is available for
 // use.
 
+// The multiplication tables ReedSolomon<Galois16> builds for each factor, kept so
+// that they are built once however many input blocks, output blocks and passes over
+// the data use that factor. Whichever thread first needs the tables for a factor
+// builds them into the next free slot of one contiguous arena, whose size is fixed
+// by Reset(); once it is full, the tables for further factors are not cached.
+class RSTableCache
+{
+public:
+  RSTableCache(void);
+  ~RSTableCache(void);
+
+  // Discard all of the tables and make room for up to slots tables of slotsize bytes.
+  void Reset(size_t slotsize, size_t slots);
+
+  size_t SlotSize(void) const { return slotsize; }
+
+  // The tables cached for key, or 0 if there are none yet. In that case *slot is set
+  // to where the caller should build them (and then call Publish()), or to 0 if
+  // they will not be cached (the arena is full or another thread is building them).
+  const void* Find(u32 key, void **slot);
+  void        Publish(u32 key, void *slot);
+
+  enum { Keys = 65536 }; // one per Galois16 value
+
+private:
+#if WANT_CONCURRENT
+  typedef tbb::atomic<u32> state_type;
+#else
+  typedef u32              state_type;
+#endif
+
+  u8         *arena;
+  size_t      slotsize;
+  size_t      slotcount;
+  state_type  slotsused;
+  state_type *state;     // for each key: 0 = not cached, 1 = not cacheable or being
+                         // built, otherwise 2 + the index of the slot holding it
+};
+
 class RSOutputRow
 {
 public:
@@ -61,8 +107,16 @@ public:
   bool SetOutput(bool present, u16 exponent);
   bool SetOutput(bool present, u16 lowexponent, u16 highexponent);
 
-  // Compute the RS Matrix
-  bool Compute(CommandLine::NoiseLevel noiselevel);
+  // Compute the RS Matrix. Its messages are written to out and its errors to err;
+  // the progress of the solve is only shown when out is cout.
+  bool Compute(CommandLine::NoiseLevel noiselevel, ostream &out = cout, ostream &err = cerr);
+
+  // The computed RS matrix, in host byte order. It can be saved and later given
+  // to SetMatrix() in place of calling Compute(), as long as the inputs and
+  // outputs have been set up in exactly the same way.
+  const void* GetMatrix(void) const {return leftmatrix;}
+  size_t MatrixSize(void) const {return (size_t)(datamissing + parmissing) * (datapresent + datamissing) * sizeof(G);}
+  bool SetMatrix(const void *matrix, size_t size);
 
   // Process a block of data
   bool Process(size_t size,             // The size of the block of data
@@ -71,6 +125,64 @@ public:
                u32 outputindex,         // The row in the RS matrix
                void *outputbuffer);     // Buffer containing output data
 
+  // How many output blocks ProcessMultiple() works on per pass over a tile of the input
+  enum { ProcessMultipleCount = 16 };
+  // How many input blocks ProcessMultiple() sums per pass over each output block
+  enum { ProcessMultipleInputCount = 8 };
+
+  // Process a block of data into several output blocks at once. The input is
+  // processed in strips which stay in the L1 cache while they are combined with
+  // every output buffer, so it is only read from memory once. If initialised is
+  // not NULL, an output buffer whose flag is false does not yet contain data: it
+  // is overwritten (so it need not be zeroed beforehand) and its flag is set.
+  bool ProcessMultiple(size_t size,                // The size of the block of data
+                       u32 inputindex,             // The column in the RS matrix
+                       buffer& ib,                 // Buffer containing input data
+                       u32 count,                  // The number of output blocks
+                       const u32 *outputindex,     // The rows in the RS matrix
+                       void * const *outputbuffer, // Buffers containing output data
+                       u8 *initialised);           // Which output buffers contain data
+
+  // Process several blocks of data into several output blocks at once. The products
+  // of the inputs are summed in registers before being combined with each output
+  // buffer, so that each output buffer is read and written once for all of them.
+  // The inputs are processed in tiles sized to stay in the L2 cache while they are
+  // combined with every output buffer, so pass as many output blocks as possible.
+  bool ProcessMultiple(size_t size,                // The size of the blocks of data
+                       u32 incount,                // The number of input blocks
+                       const u32 *inputindex,      // The columns in the RS matrix
+                       buffer * const *ib,         // Buffers containing input data
+                       u32 count,                  // The number of output blocks
+                       const u32 *outputindex,     // The rows in the RS matrix
+                       void * const *outputbuffer, // Buffers containing output data
+                       u8 *initialised);           // Which output buffers contain data
+
+  // In the split-plane ("ALTMAP") layout the words in each unit processed by the
+  // PSHUFB or GFNI kernel are stored as all of their low bytes followed by all of
+  // their high bytes, so the kernel does not have to separate and recombine them.
+  // While it is enabled, Process() and ProcessMultiple() expect every buffer to be
+  // in that layout: convert them with ToSplitPlanes() before processing and with
+  // FromSplitPlanes() before using the data. It cannot be enabled (false is
+  // returned) unless a PSHUFB or GFNI kernel is selected, which must not change.
+  bool SetSplitPlanes(bool enable);
+  bool SplitPlanes(void) const { return splitplanes_; }
+
+  // How much of a block of size bytes must be processed when only its first
+  // datalength bytes might not be zero (and so the rest contributes nothing).
+  // It is a whole number of the kernel's units, so it can be used with the
+  // split-plane layout, and at most size.
+  size_t ProcessedLength(size_t datalength, size_t size) const;
+  void ToSplitPlanes(void *buffer, size_t size) const;
+  void FromSplitPlanes(void *buffer, size_t size) const;
+  // The same, converting the data at src (which does not overlap dst) into dst
+  void ToSplitPlanes(void *dst, const void *src, size_t size) const;
+
+#if WANT_CONCURRENT
+  // Whether Compute() may use parallel_for for the larger matrices (it does not
+  // when the processing is to be serial).
+  void SetConcurrent(bool enable) { concurrent_ = enable; }
+#endif
+
 #if GPGPU_CUDA
   bool has_gpu(void) const { return has_gpu_; }
   void set_has_gpu(bool b) { has_gpu_ = b; }
@@ -78,16 +190,51 @@ public:
 
 private:
   bool InternalProcess(const g &factor, size_t size, buffer& ib, u32 outputindex, void *outputbuffer); // Optimization
+  void ResetTables(u32 elements); // Prepare any per-factor tables for a new matrix
+
+  // dst[i] += src[i] * factor for count values (or dst[i] = src[i] * factor if
+  // store is true, in which case dst may be the same as src).
+  void MultiplyAdd(G *dst, const G *src, u32 count, const G &factor, bool store);
+
+  // Subtract multiples of the pivot row (row) from the other rows first..last-1
+  // of the matrices so that their values in column row become zero.
+  void EliminateRows(u32 row, u32 first, u32 last, u32 rows, u32 leftcols, G *leftmatrix, G *rightmatrix);
+
+#if WANT_CONCURRENT
+  class ApplyEliminateRows;
+#endif
+
+  // Fill in rows first..last-1 of the matrices for Compute().
+  void FillMatrixRows(u32 first, u32 last, const u16 *exponents, const u32 *logpresent, const u32 *logmissing,
+                      G *rightmatrix);
+
+#if WANT_CONCURRENT
+  class ApplyFillMatrixRows;
+#endif
+
+  // Fill in rows first..last-1 of the solved matrix for SolveVandermonde().
+  void FillVandermondeRows(u32 first, u32 last, const G *master, const G *nodes, const G *rowscale,
+                           const G *points, const G *colscale, const u32 *powers);
+
+#if WANT_CONCURRENT
+  class ApplyFillVandermondeRows;
+#endif
 
 protected:
   // Perform Gaussian Elimination
   bool GaussElim(CommandLine::NoiseLevel noiselevel,
+                 ostream &out,
+                 ostream &err,
                  unsigned int rows, 
                  unsigned int leftcols, 
                  G *leftmatrix, 
                  G *rightmatrix, 
                  unsigned int datamissing);
 
+  // Solve the matrices directly from their Vandermonde structure. Returns false
+  // (without changing anything) if they do not have it.
+  bool SolveVandermonde(CommandLine::NoiseLevel noiselevel, ostream &out);
+
 protected:
   u32 inputcount;        // Total number of input blocks
 
@@ -115,6 +262,14 @@ protected:
 
 #ifdef LONGMULTIPLY
   GaloisLongMultiplyTable<g> *glmt;  // A multiplication table used by Process()
+
+  RSTableCache tablecache; // The tables built from glmt for each factor
+#endif
+
+  bool splitplanes_; // whether the buffers are in the split-plane layout
+
+#if WANT_CONCURRENT
+  bool concurrent_;  // whether Compute() may use parallel_for
 #endif
 
 #if GPGPU_CUDA
@@ -144,6 +299,12 @@ inline ReedSolomon<g>::ReedSolomon(void)
 
   leftmatrix = 0;
 
+  splitplanes_ = false;
+
+#if WANT_CONCURRENT
+  concurrent_ = true;
+#endif
+
 #ifdef LONGMULTIPLY
   glmt = new GaloisLongMultiplyTable<g>;
 #endif
@@ -186,6 +347,121 @@ inline bool ReedSolomon<g>::Process(size_t size, u32 inputindex, buffer& ib, u32
     return this->InternalProcess (factor, size, ib, outputindex, outputbuffer);
 }
 
+template<class g>
+inline bool ReedSolomon<g>::ProcessMultiple(size_t size, u32 inputindex, buffer& ib, u32 count,
+                                            const u32 *outputindex, void * const *outputbuffer, u8 *initialised)
+{
+  buffer *pib = &ib;
+  return ProcessMultiple(size, 1, &inputindex, &pib, count, outputindex, outputbuffer, initialised);
+}
+
+// The default processes one input and output block at a time.
+template<class g>
+inline bool ReedSolomon<g>::ProcessMultiple(size_t size, u32 incount, const u32 *inputindex, buffer * const *ib,
+                                            u32 count, const u32 *outputindex, void * const *outputbuffer, u8 *initialised)
+{
+  for (u32 i=0; i<count; i++)
+  {
+    for (u32 k=0; k<incount; k++)
+    {
+      // Look up the appropriate element in the RS matrix
+      g factor = leftmatrix[outputindex[i] * (datapresent + datamissing) + inputindex[k]];
+      // Do nothing if the factor happens to be 0
+      if (factor == 0 || 0 == size)
+        continue;
+
+      if (initialised && !initialised[i])
+      {
+        memset(outputbuffer[i], 0, size);
+        initialised[i] = true;
+      }
+
+      InternalProcess(factor, size, *ib[k], outputindex[i], outputbuffer[i]);
+    }
+  }
+
+  return true;
+}
+
+// The 16-bit version uses the PSHUFB or GFNI kernels on strips of the input (reedsolomon.cpp).
+template<> bool ReedSolomon<Galois16>::ProcessMultiple(size_t size, u32 incount, const u32 *inputindex, buffer * const *ib,
+                                                       u32 count, const u32 *outputindex, void * const *outputbuffer, u8 *initialised);
+
+template<class g>
+inline size_t ReedSolomon<g>::ProcessedLength(size_t datalength, size_t size) const
+{
+  return min(size, (datalength + 15) & ~(size_t)15);
+}
+
+template<> size_t ReedSolomon<Galois16>::ProcessedLength(size_t datalength, size_t size) const;
+
+// Only the 16-bit kernels have a split-plane layout.
+template<class g>
+inline bool ReedSolomon<g>::SetSplitPlanes(bool enable)
+{
+  splitplanes_ = false;
+  return !enable;
+}
+
+template<class g>
+inline void ReedSolomon<g>::ToSplitPlanes(void *buffer, size_t size) const
+{
+}
+
+template<class g>
+inline void ReedSolomon<g>::FromSplitPlanes(void *buffer, size_t size) const
+{
+}
+
+template<class g>
+inline void ReedSolomon<g>::ToSplitPlanes(void *dst, const void *src, size_t size) const
+{
+  memcpy(dst, src, size);
+}
+
+// Only the 16-bit kernels cache their tables.
+template<class g>
+inline void ReedSolomon<g>::ResetTables(u32 elements)
+{
+}
+
+// The scalar version of ReedSolomon<g>::MultiplyAdd().
+template<class G>
+inline void rs_multiply_add(G *dst, const G *src, u32 count, const G &factor, bool store)
+{
+  if (store)
+  {
+    for (u32 i=0; i<count; i++)
+      dst[i] = src[i] * factor;
+  }
+  else if (factor == 1)
+  {
+    for (u32 i=0; i<count; i++)
+      dst[i] += src[i];
+  }
+  else
+  {
+    for (u32 i=0; i<count; i++)
+    {
+      if (src[i] != 0)
+        dst[i] += src[i] * factor;
+    }
+  }
+}
+
+template<class g>
+inline void ReedSolomon<g>::MultiplyAdd(G *dst, const G *src, u32 count, const G &factor, bool store)
+{
+  rs_multiply_add(dst, src, count, factor, store);
+}
+
+template<> bool ReedSolomon<Galois16>::SetSplitPlanes(bool enable);
+template<> void ReedSolomon<Galois16>::ToSplitPlanes(void *buffer, size_t size) const;
+template<> void ReedSolomon<Galois16>::FromSplitPlanes(void *buffer, size_t size) const;
+template<> void ReedSolomon<Galois16>::ToSplitPlanes(void *dst, const void *src, size_t size) const;
+template<> void ReedSolomon<Galois16>::ResetTables(u32 elements);
+template<> void ReedSolomon<Galois16>::MultiplyAdd(Galois16 *dst, const Galois16 *src, u32 count, const Galois16 &factor, bool store);
+
 u32 gcd(u32 a, u32 b);
 
 // Record whether the recovery block with the specified
@@ -227,24 +503,26 @@ inline bool ReedSolomon<g>::SetOutput(bool present, u16 lowexponent, u16 highexp
 
 // Construct the Vandermonde matrix and solve it if necessary
 template<class g>
-inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
+inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel, ostream &out, ostream &err)
 {
   u32 outcount = datamissing + parmissing;
   u32 incount = datapresent + datamissing;
 
   if (datamissing > parpresent)
   {
-    cerr << "Not enough recovery blocks." << endl;
+    err << "Not enough recovery blocks." << endl;
     return false;
   }
   else if (outcount == 0)
   {
-    cerr << "No output blocks." << endl;
+    err << "No output blocks." << endl;
     return false;
   }
 
+  ResetTables(outcount * incount);
+
   if (noiselevel > CommandLine::nlQuiet)
-    cout << "Computing Reed Solomon matrix." << endl;
+    out << "Computing Reed Solomon matrix." << endl;
 
   /*  Layout of RS Matrix:
 
@@ -261,10 +539,15 @@ inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
                \                     |             / \                     |           /
   */
 
-  // Allocate the left hand matrix
+  // Allocate the left hand matrix (every element of which is set below, by
+  // SolveVandermonde() or FillMatrixRows())
 
   leftmatrix = new G[outcount * incount];
-  memset(leftmatrix, 0, outcount * incount * sizeof(G));
+
+  // When only data blocks are being recovered from consecutive recovery blocks
+  // the solution can be written down directly, without Gaussian Elimination.
+  if (datamissing > 0 && parmissing == 0 && SolveVandermonde(noiselevel, out))
+    return true;
 
   // Allocate the right hand matrix only if we are recovering
 
@@ -272,142 +555,242 @@ inline bool ReedSolomon<g>::Compute(CommandLine::NoiseLevel noiselevel)
   if (datamissing > 0)
   {
     rightmatrix = new G[outcount * outcount];
-    memset(rightmatrix, 0, outcount *outcount * sizeof(G));
   }
 
   // Fill in the two matrices:
 
-  vector<RSOutputRow>::const_iterator outputrow = outputrows.begin();
-
-  // One row for each present recovery block that will be used for a missing data block
-  for (unsigned int row=0; row<datamissing; row++)
+  // The exponent for each row: first those of the present recovery blocks that
+  // will be used for the missing data blocks, then those of the recovery blocks
+  // being computed.
+  vector<u16> exponents(outcount);
   {
-    if (noiselevel > CommandLine::nlQuiet)
-    {
-      int progress = row * 1000 / (datamissing+parmissing);
-      cout << "Constructing: " << progress/10 << '.' << progress%10 << "%\r" << flush;
-    }
-
-    // Get the exponent of the next present recovery block
-    while (!outputrow->present)
-    {
-      outputrow++;
-    }
-    u16 exponent = outputrow->exponent;
-
-    // One column for each present data block
-    for (unsigned int col=0; col<datapresent; col++)
-    {
-      leftmatrix[row * incount + col] = G(database[datapresentindex[col]]).pow(exponent);
-    }
-    // One column for each each present recovery block that will be used for a missing data block
-    for (unsigned int col=0; col<datamissing; col++)
+    u32 presentrow = 0;
+    u32 missingrow = datamissing;
+    for (vector<RSOutputRow>::const_iterator outputrow = outputrows.begin(); outputrow != outputrows.end(); ++outputrow)
     {
-      leftmatrix[row * incount + col + datapresent] = (row == col) ? 1 : 0;
-    }
-
-    if (datamissing > 0)
-    {
-      // One column for each missing data block
-      for (unsigned int col=0; col<datamissing; col++)
+      if (outputrow->present)
       {
-        rightmatrix[row * outcount + col] = G(database[datamissingindex[col]]).pow(exponent);
+        if (presentrow < datamissing)
+          exponents[presentrow++] = outputrow->exponent;
       }
-      // One column for each missing recovery block
-      for (unsigned int col=0; col<parmissing; col++)
+      else
       {
-        rightmatrix[row * outcount + col + datamissing] = 0;
+        exponents[missingrow++] = outputrow->exponent;
       }
     }
+  }
 
-    outputrow++;
+  // The logs of the bases, so that base ^ exponent can be obtained by adding up
+  // logs as the exponent increases from one row to the next.
+  vector<u32> logpresent(datapresent);
+  for (unsigned int col=0; col<datapresent; col++)
+    logpresent[col] = G(database[datapresentindex[col]]).Log();
+  vector<u32> logmissing(datamissing);
+  for (unsigned int col=0; col<datamissing; col++)
+    logmissing[col] = G(database[datamissingindex[col]]).Log();
+
+#if WANT_CONCURRENT
+  if (concurrent_ && (u64) outcount * incount >= 65536)
+    tbb::parallel_for(tbb::blocked_range<u32>(0, outcount),
+      ApplyFillMatrixRows(this, &exponents[0], datapresent ? &logpresent[0] : 0,
+                          datamissing ? &logmissing[0] : 0, rightmatrix),
+      tbb::auto_partitioner());
+  else
+#endif
+    FillMatrixRows(0, outcount, &exponents[0], datapresent ? &logpresent[0] : 0,
+                   datamissing ? &logmissing[0] : 0, rightmatrix);
+
+  if (noiselevel > CommandLine::nlQuiet)
+    out << "Constructing: done." << endl;
+
+  // Solve the matrices only if recovering data
+  if (datamissing > 0)
+  {
+    // Perform Gaussian Elimination and then delete the right matrix (which 
+    // will no longer be required).
+    bool success = GaussElim(noiselevel, out, err, outcount, incount, leftmatrix, rightmatrix, datamissing);
+    delete [] rightmatrix;
+    return success;
   }
-  // One row for each recovery block being computed
-  outputrow = outputrows.begin();
-  for (unsigned int row=0; row<parmissing; row++)
+
+  return true;
+}
+
+// Advance the logs log[c] * exponent (mod Limit) of count bases from one exponent
+// to a larger one.
+template<class G>
+inline void rs_advance_logs(u32 *acc, const u32 *log, u32 count, u32 delta)
+{
+  if (delta == 1)
   {
-    if (noiselevel > CommandLine::nlQuiet)
+    for (u32 c=0; c<count; c++)
     {
-      int progress = (row+datamissing) * 1000 / (datamissing+parmissing);
-      cout << "Constructing: " << progress/10 << '.' << progress%10 << "%\r" << flush;
+      u32 sum = acc[c] + log[c];
+      acc[c] = (sum >= G::Limit) ? sum - G::Limit : sum;
     }
+  }
+  else
+  {
+    for (u32 c=0; c<count; c++)
+      acc[c] = (u32) ((acc[c] + (u64) log[c] * delta) % G::Limit);
+  }
+}
+
+template<class g>
+inline void ReedSolomon<g>::FillMatrixRows(u32 first, u32 last, const u16 *exponents, const u32 *logpresent,
+                                           const u32 *logmissing, G *rightmatrix)
+{
+  const u32 outcount = datamissing + parmissing;
+  const u32 incount = datapresent + datamissing;
+
+  // log(base) * exponent for each column of the previous row
+  vector<u32> accpresent(datapresent, 0);
+  vector<u32> accmissing(datamissing, 0);
+  u32 exponent = 0;
 
-    // Get the exponent of the next missing recovery block
-    while (outputrow->present)
+  for (u32 row=first; row<last; row++)
+  {
+    // The exponents normally increase from one row to the next (other than where
+    // the rows of the recovery blocks being computed start); when they do not,
+    // start again from exponent 0.
+    if (row == first || exponents[row] < exponent)
     {
-      outputrow++;
+      exponent = 0;
+      fill(accpresent.begin(), accpresent.end(), 0);
+      fill(accmissing.begin(), accmissing.end(), 0);
     }
-    u16 exponent = outputrow->exponent;
+    rs_advance_logs<G>(datapresent ? &accpresent[0] : 0, logpresent, datapresent, exponents[row] - exponent);
+    rs_advance_logs<G>(datamissing ? &accmissing[0] : 0, logmissing, datamissing, exponents[row] - exponent);
+    exponent = exponents[row];
 
     // One column for each present data block
     for (unsigned int col=0; col<datapresent; col++)
-    {
-      leftmatrix[(row+datamissing) * incount + col] = G(database[datapresentindex[col]]).pow(exponent);
-    }
-    // One column for each each present recovery block that will be used for a missing data block
-    for (unsigned int col=0; col<datamissing; col++)
-    {
-      leftmatrix[(row+datamissing) * incount + col + datapresent] = 0;
-    }
+      leftmatrix[row * incount + col] = G((typename G::ValueType) accpresent[col]).ALog();
+
+    // One column for each present recovery block that will be used for a missing data block
+    std::fill_n(&leftmatrix[row * incount + datapresent], datamissing, G(0));
+    if (row < datamissing)
+      leftmatrix[row * incount + datapresent + row] = 1;
 
-    if (datamissing > 0)
+    if (rightmatrix)
     {
       // One column for each missing data block
       for (unsigned int col=0; col<datamissing; col++)
-      {
-        rightmatrix[(row+datamissing) * outcount + col] = G(database[datamissingindex[col]]).pow(exponent);
-      }
+        rightmatrix[row * outcount + col] = G((typename G::ValueType) accmissing[col]).ALog();
+
       // One column for each missing recovery block
-      for (unsigned int col=0; col<parmissing; col++)
-      {
-        rightmatrix[(row+datamissing) * outcount + col + datamissing] = (row == col) ? 1 : 0;
-      }
+      std::fill_n(&rightmatrix[row * outcount + datamissing], parmissing, G(0));
+      if (row >= datamissing)
+        rightmatrix[row * outcount + row] = 1;
     }
+  }
+}
 
-    outputrow++;
+#if WANT_CONCURRENT
+template<class g>
+class ReedSolomon<g>::ApplyFillMatrixRows {
+public:
+  ApplyFillMatrixRows(ReedSolomon<g>* obj, const u16 *exponents, const u32 *logpresent, const u32 *logmissing,
+                      G *rightmatrix) :
+    _obj(obj), _exponents(exponents), _logpresent(logpresent), _logmissing(logmissing), _rightmatrix(rightmatrix) {}
+  void operator()(const tbb::blocked_range<u32>& r) const {
+    _obj->FillMatrixRows(r.begin(), r.end(), _exponents, _logpresent, _logmissing, _rightmatrix);
   }
-  if (noiselevel > CommandLine::nlQuiet)
-    cout << "Constructing: done." << endl;
+private:
+  ReedSolomon<g>* _obj;
+  const u16      *_exponents;
+  const u32      *_logpresent;
+  const u32      *_logmissing;
+  G              *_rightmatrix;
+};
+#endif
 
-  // Solve the matrices only if recovering data
-  if (datamissing > 0)
+template<class g>
+inline void ReedSolomon<g>::EliminateRows(u32 row, u32 first, u32 last, u32 rows, u32 leftcols, G *leftmatrix, G *rightmatrix)
+{
+  for (u32 row2=first; row2<last; row2++)
   {
-    // Perform Gaussian Elimination and then delete the right matrix (which 
-    // will no longer be required).
-    bool success = GaussElim(noiselevel, outcount, incount, leftmatrix, rightmatrix, datamissing);
-    delete [] rightmatrix;
-    return success;
+    if (row != row2)
+    {
+      // Get the scaling factor for this row.
+      G scalevalue = rightmatrix[row2 * rows + row];
+
+      // If the scaling factor is not 0, then compute accordingly (subtraction
+      // is the same as addition in Galois arithmetic).
+      if (scalevalue != 0)
+      {
+        MultiplyAdd(&leftmatrix[row2 * leftcols], &leftmatrix[row * leftcols], leftcols, scalevalue, false);
+        MultiplyAdd(&rightmatrix[row2 * rows + row], &rightmatrix[row * rows + row], rows - row, scalevalue, false);
+      }
+    }
   }
+}
+
+#if WANT_CONCURRENT
+template<class g>
+class ReedSolomon<g>::ApplyEliminateRows {
+public:
+  ApplyEliminateRows(ReedSolomon<g>* obj, u32 row, u32 rows, u32 leftcols, G *leftmatrix, G *rightmatrix) :
+    _obj(obj), _row(row), _rows(rows), _leftcols(leftcols), _leftmatrix(leftmatrix), _rightmatrix(rightmatrix) {}
+  void operator()(const tbb::blocked_range<u32>& r) const {
+    _obj->EliminateRows(_row, r.begin(), r.end(), _rows, _leftcols, _leftmatrix, _rightmatrix);
+  }
+private:
+  ReedSolomon<g>* _obj;
+  u32             _row;
+  u32             _rows;
+  u32             _leftcols;
+  G              *_leftmatrix;
+  G              *_rightmatrix;
+};
+#endif
+
+// Use a previously computed RS matrix
+template<class g>
+inline bool ReedSolomon<g>::SetMatrix(const void *matrix, size_t size)
+{
+  if (size != MatrixSize() || size == 0)
+    return false;
+
+  const u32 outcount = datamissing + parmissing;
+  const u32 incount = datapresent + datamissing;
+
+  ResetTables(outcount * incount);
+
+  delete [] leftmatrix;
+  leftmatrix = new G[outcount * incount];
+  const G *elements = static_cast<const G*>(matrix);
+  std::copy(elements, elements + outcount * incount, leftmatrix);
 
   return true;
 }
 
 // Use Gaussian Elimination to solve the matrices
 template<class g>
-inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing)
+inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, ostream &out, ostream &err, unsigned int rows, unsigned int leftcols, G *leftmatrix, G *rightmatrix, unsigned int datamissing)
 {
   if (noiselevel == CommandLine::nlDebug)
   {
     for (unsigned int row=0; row<rows; row++)
     {
-      cout << ((row==0) ? "/"    : (row==rows-1) ? "\\"    : "|");
+      out << ((row==0) ? "/"    : (row==rows-1) ? "\\"    : "|");
       for (unsigned int col=0; col<leftcols; col++)
       {
-        cout << " "
+        out << " "
              << hex << setw(G::Bits>8?4:2) << setfill('0')
              << (unsigned int)leftmatrix[row*leftcols+col];
       }
-      cout << ((row==0) ? " \\ /" : (row==rows-1) ? " / \\" : " | |");
+      out << ((row==0) ? " \\ /" : (row==rows-1) ? " / \\" : " | |");
       for (unsigned int col=0; col<rows; col++)
       {
-        cout << " "
+        out << " "
              << hex << setw(G::Bits>8?4:2) << setfill('0')
              << (unsigned int)rightmatrix[row*rows+col];
       }
-      cout << ((row==0) ? " \\"   : (row==rows-1) ? " /"    : " | |");
-      cout << endl;
+      out << ((row==0) ? " \\"   : (row==rows-1) ? " /"    : " | |");
+      out << endl;
 
-      cout << dec << setw(0) << setfill(' ');
+      out << dec << setw(0) << setfill(' ');
     }
   }
 
@@ -425,6 +808,16 @@ inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsign
   // For each row in the matrix
   for (unsigned int row=0; row<datamissing; row++)
   {
+    if (noiselevel > CommandLine::nlQuiet && &out == &cout)
+    {
+      int newprogress = row * 1000 / datamissing;
+      if (progress != newprogress)
+      {
+        progress = newprogress;
+        out << "Solving: " << progress/10 << '.' << progress%10 << "%\r" << flush;
+      }
+    }
+
     // NB Row and column swapping to find a non zero pivot value or to find the largest value
     // is not necessary due to the nature of the arithmetic and construction of the RS matrix.
 
@@ -433,113 +826,53 @@ inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsign
     assert(pivotvalue != 0);
     if (pivotvalue == 0)
     {
-      cerr << "RS computation error." << endl;
+      err << "RS computation error." << endl;
       return false;
     }
 
     // If the pivot value is not 1, then the whole row has to be scaled
     if (pivotvalue != 1)
     {
-      for (unsigned int col=0; col<leftcols; col++)
-      {
-        if (leftmatrix[row * leftcols + col] != 0)
-        {
-          leftmatrix[row * leftcols + col] /= pivotvalue;
-        }
-      }
+      const G scale = G(1) / pivotvalue;
+      MultiplyAdd(&leftmatrix[row * leftcols], &leftmatrix[row * leftcols], leftcols, scale, true);
       rightmatrix[row * rows + row] = 1;
-      for (unsigned int col=row+1; col<rows; col++)
-      {
-        if (rightmatrix[row * rows + col] != 0)
-        {
-          rightmatrix[row * rows + col] /= pivotvalue;
-        }
-      }
+      MultiplyAdd(&rightmatrix[row * rows + row+1], &rightmatrix[row * rows + row+1], rows - (row+1), scale, true);
     }
 
-    // For every other row in the matrix
-    for (unsigned int row2=0; row2<rows; row2++)
-    {
-      if (noiselevel > CommandLine::nlQuiet)
-      {
-        int newprogress = (row*rows+row2) * 1000 / (datamissing*rows);
-        if (progress != newprogress)
-        {
-          progress = newprogress;
-          cout << "Solving: " << progress/10 << '.' << progress%10 << "%\r" << flush;
-        }
-      }
-
-      if (row != row2)
-      {
-        // Get the scaling factor for this row.
-        G scalevalue = rightmatrix[row2 * rows + row];
-
-        if (scalevalue == 1)
-        {
-          // If the scaling factor happens to be 1, just subtract rows
-          for (unsigned int col=0; col<leftcols; col++)
-          {
-            if (leftmatrix[row * leftcols + col] != 0)
-            {
-              leftmatrix[row2 * leftcols + col] -= leftmatrix[row * leftcols + col];
-            }
-          }
-
-          for (unsigned int col=row; col<rows; col++)
-          {
-            if (rightmatrix[row * rows + col] != 0)
-            {
-              rightmatrix[row2 * rows + col] -= rightmatrix[row * rows + col];
-            }
-          }
-        }
-        else if (scalevalue != 0)
-        {
-          // If the scaling factor is not 0, then compute accordingly.
-          for (unsigned int col=0; col<leftcols; col++)
-          {
-            if (leftmatrix[row * leftcols + col] != 0)
-            {
-              leftmatrix[row2 * leftcols + col] -= leftmatrix[row * leftcols + col] * scalevalue;
-            }
-          }
-
-          for (unsigned int col=row; col<rows; col++)
-          {
-            if (rightmatrix[row * rows + col] != 0)
-            {
-              rightmatrix[row2 * rows + col] -= rightmatrix[row * rows + col] * scalevalue;
-            }
-          }
-        }
-      }
-    }
+    // For every other row in the matrix. Each of them only reads the pivot row,
+    // so they can be processed at the same time.
+#if WANT_CONCURRENT
+    if (concurrent_ && (u64) rows * (leftcols + rows - row) >= 65536)
+      tbb::parallel_for(tbb::blocked_range<u32>(0, rows),
+        ApplyEliminateRows(this, row, rows, leftcols, leftmatrix, rightmatrix), tbb::auto_partitioner());
+    else
+#endif
+      EliminateRows(row, 0, rows, rows, leftcols, leftmatrix, rightmatrix);
   }
   if (noiselevel > CommandLine::nlQuiet)
-    cout << "Solving: done." << endl;
+    out << "Solving: done." << endl;
   if (noiselevel == CommandLine::nlDebug)
   {
     for (unsigned int row=0; row<rows; row++)
     {
-      cout << ((row==0) ? "/"    : (row==rows-1) ? "\\"    : "|");
+      out << ((row==0) ? "/"    : (row==rows-1) ? "\\"    : "|");
       for (unsigned int col=0; col<leftcols; col++)
       {
-        cout << " "
+        out << " "
              << hex << setw(G::Bits>8?4:2) << setfill('0')
              << (unsigned int)leftmatrix[row*leftcols+col];
       }
-      cout << ((row==0) ? " \\ /" : (row==rows-1) ? " / \\" : " | |");
+      out << ((row==0) ? " \\ /" : (row==rows-1) ? " / \\" : " | |");
       for (unsigned int col=0; col<rows; col++)
       {
-        cout << " "
+        out << " "
              << hex << setw(G::Bits>8?4:2) << setfill('0')
              << (unsigned int)rightmatrix[row*rows+col];
       }
-      cout << ((row==0) ? " \\"   : (row==rows-1) ? " /"    : " | |");
-      cout << endl;
+      out << ((row==0) ? " \\"   : (row==rows-1) ? " /"    : " | |");
+      out << endl;
 
-      cout << dec << setw(0) << setfill(' ');
+      out << dec << setw(0) << setfill(' ');
     }
   }
 
@@ -547,4 +880,166 @@ inline bool ReedSolomon<g>::GaussElim(CommandLine::NoiseLevel noiselevel, unsign
 }
 
 
+// When parmissing is zero, and the exponents of the recovery blocks are e0,
+// e0+d, e0+2d, ... (in some order), the row for exponent e0+t*d has the form:
+//
+//   left:  b[j]^e0 * (b[j]^d)^t   (b[j] is the base of present data block j)
+//   right: a[k]^e0 * (a[k]^d)^t   (a[k] is the base of missing data block k)
+//
+// The right matrix is therefore V * diag(a[k]^e0), where V is the Vandermonde
+// matrix of the nodes x[k] = a[k]^d with its rows reordered. Row k of the inverse
+// of V holds the coefficients of the Lagrange polynomial L[k](x) = M(x) / ((x - x[k]) * M'(x[k])),
+// where M(x) is the product of all of the (x - x[k]). Applying the inverse to the
+// left matrix evaluates L[k] at the points y[j] = b[j]^d, so every element of the
+// solution costs O(1) once M(x) is known, rather than O(n) per element when using
+// Gaussian Elimination.
+template<class g>
+inline bool ReedSolomon<g>::SolveVandermonde(CommandLine::NoiseLevel noiselevel, ostream &out)
+{
+  const u32 incount = datapresent + datamissing;
+
+  // Check that the exponents step evenly (in whatever order the recovery
+  // blocks were supplied), and find the power of x[k] used by each row.
+  vector<u32> exponents;
+  for (vector<RSOutputRow>::const_iterator outputrow = outputrows.begin(); outputrow != outputrows.end(); ++outputrow)
+  {
+    if (outputrow->present && exponents.size() < datamissing)
+      exponents.push_back(outputrow->exponent);
+  }
+  if (exponents.size() != datamissing)
+    return false;
+
+  vector<u32> sorted(exponents);
+  sort(sorted.begin(), sorted.end());
+  const u32 e0 = sorted[0];
+  const u32 d = (datamissing > 1) ? sorted[1] - sorted[0] : 1;
+  for (u32 s=1; s<datamissing; s++)
+  {
+    if (sorted[s] != e0 + s * d)
+      return false;
+  }
+
+  vector<u32> powers(datamissing);
+  for (u32 s=0; s<datamissing; s++)
+    powers[s] = (exponents[s] - e0) / d;
+
+  // The nodes must all be different (or V is singular) and none of the points
+  // may be equal to a node.
+  vector<G> nodes(datamissing);
+  vector<G> points(datapresent);
+  vector<bool> used(G::Count, false);
+  for (u32 k=0; k<datamissing; k++)
+  {
+    nodes[k] = G(database[datamissingindex[k]]).pow(d);
+    if (database[datamissingindex[k]] == 0 || used[nodes[k]])
+      return false;
+    used[nodes[k]] = true;
+  }
+  for (u32 j=0; j<datapresent; j++)
+  {
+    points[j] = G(database[datapresentindex[j]]).pow(d);
+    if (used[points[j]])
+      return false;
+  }
+
+  if (noiselevel > CommandLine::nlNormal)
+    out << "Solving using the Vandermonde structure of the matrix." << endl;
+
+  // M(x), with master[i] being the coefficient of x^i.
+  vector<G> master(datamissing + 1, G(0));
+  master[0] = 1;
+  for (u32 k=0; k<datamissing; k++)
+  {
+    for (u32 i=k+1; i>0; i--)
+      master[i] = master[i-1] + master[i] * nodes[k];
+    master[0] *= nodes[k];
+  }
+
+  // The scaling of each row (from diag(a[k]^e0)) and of each column (M(y[j]), and
+  // b[j]^e0 from the left matrix).
+  vector<G> rowscale(datamissing);
+  for (u32 k=0; k<datamissing; k++)
+    rowscale[k] = G(1) / G(database[datamissingindex[k]]).pow(e0);
+
+  vector<G> colscale(datapresent);
+  for (u32 j=0; j<datapresent; j++)
+  {
+    G value = 0;
+    for (u32 i=datamissing+1; i>0; i--)
+      value = value * points[j] + master[i-1];
+    colscale[j] = value * G(database[datapresentindex[j]]).pow(e0);
+  }
+
+#if WANT_CONCURRENT
+  if (concurrent_ && (u64) datamissing * incount >= 65536)
+    tbb::parallel_for(tbb::blocked_range<u32>(0, datamissing),
+      ApplyFillVandermondeRows(this, &master[0], &nodes[0], &rowscale[0],
+                               datapresent ? &points[0] : 0, datapresent ? &colscale[0] : 0, &powers[0]),
+      tbb::auto_partitioner());
+  else
+#endif
+    FillVandermondeRows(0, datamissing, &master[0], &nodes[0], &rowscale[0],
+                        datapresent ? &points[0] : 0, datapresent ? &colscale[0] : 0, &powers[0]);
+
+  if (noiselevel > CommandLine::nlQuiet)
+    out << "Solving: done." << endl;
+
+  return true;
+}
+
+template<class g>
+inline void ReedSolomon<g>::FillVandermondeRows(u32 first, u32 last, const G *master, const G *nodes, const G *rowscale,
+                                                const G *points, const G *colscale, const u32 *powers)
+{
+  const u32 incount = datapresent + datamissing;
+  vector<G> quotient(datamissing);
+
+  for (u32 k=first; k<last; k++)
+  {
+    // M(x) / (x - x[k]) by synthetic division, and its value at x[k], which is M'(x[k]).
+    G remainder = master[datamissing];
+    G derivative = 0;
+    for (u32 i=datamissing; i>0; i--)
+    {
+      quotient[i-1] = remainder;
+      derivative = derivative * nodes[k] + remainder;
+      remainder = master[i-1] + remainder * nodes[k];
+    }
+    assert(remainder == 0);
+
+    const G scale = rowscale[k] / derivative;
+    G *row = &leftmatrix[k * incount];
+
+    // The columns for the present data blocks: L[k](y[j]), scaled.
+    for (u32 j=0; j<datapresent; j++)
+      row[j] = scale * colscale[j] / (points[j] - nodes[k]);
+
+    // The columns for the recovery blocks: the coefficients of L[k](x), scaled.
+    for (u32 s=0; s<datamissing; s++)
+      row[datapresent + s] = scale * quotient[powers[s]];
+  }
+}
+
+#if WANT_CONCURRENT
+template<class g>
+class ReedSolomon<g>::ApplyFillVandermondeRows {
+public:
+  ApplyFillVandermondeRows(ReedSolomon<g>* obj, const G *master, const G *nodes, const G *rowscale,
+                           const G *points, const G *colscale, const u32 *powers) :
+    _obj(obj), _master(master), _nodes(nodes), _rowscale(rowscale), _points(points), _colscale(colscale),
+    _powers(powers) {}
+  void operator()(const tbb::blocked_range<u32>& r) const {
+    _obj->FillVandermondeRows(r.begin(), r.end(), _master, _nodes, _rowscale, _points, _colscale, _powers);
+  }
+private:
+  ReedSolomon<g>* _obj;
+  const G        *_master;
+  const G        *_nodes;
+  const G        *_rowscale;
+  const G        *_points;
+  const G        *_colscale;
+  const u32      *_powers;
+};
+#endif
+
 #endif // __REEDSOLOMON_H__